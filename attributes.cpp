@@ -0,0 +1,485 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "attributes.hpp"
+#include <cstring>
+
+namespace {
+	enum {
+		WM_MATCH = 0,
+		WM_NOMATCH = 1,
+		WM_ABORT_ALL = -1,
+		WM_ABORT_TO_STARSTAR = -2
+	};
+
+	// Git's gitattributes reader ignores lines and files at least this long
+	const size_t	MAX_LINE_LENGTH = 2048;
+	const size_t	MAX_FILE_SIZE = 100 * 1024 * 1024;
+
+	const char	BLANK[] = " \t\r\n";
+
+	// Character classes are ASCII-only, like Git's sane_ctype
+	bool	is_lower (unsigned char c) { return c >= 'a' && c <= 'z'; }
+	bool	is_upper (unsigned char c) { return c >= 'A' && c <= 'Z'; }
+	bool	is_digit (unsigned char c) { return c >= '0' && c <= '9'; }
+	bool	is_alpha (unsigned char c) { return is_lower(c) || is_upper(c); }
+	bool	is_alnum (unsigned char c) { return is_alpha(c) || is_digit(c); }
+	bool	is_space (unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+	bool	is_cntrl (unsigned char c) { return c < 0x20 || c == 0x7f; }
+	bool	is_print (unsigned char c) { return c >= 0x20 && c < 0x7f; }
+	bool	is_graph (unsigned char c) { return c > 0x20 && c < 0x7f; }
+	bool	is_punct (unsigned char c) { return is_graph(c) && !is_alnum(c); }
+	bool	is_xdigit (unsigned char c) { return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+
+	bool	is_glob_special (unsigned char c)
+	{
+		return c == '*' || c == '?' || c == '[' || c == '\\';
+	}
+
+	// Length of the leading part of pattern which has no wildcards
+	size_t	simple_length (const std::string& pattern)
+	{
+		size_t		len = 0;
+		while (len < pattern.size() && !is_glob_special(pattern[len])) {
+			++len;
+		}
+		return len;
+	}
+
+	bool	class_equals (const unsigned char* s, size_t len, const char* name)
+	{
+		return std::strlen(name) == len && std::memcmp(s, name, len) == 0;
+	}
+
+	// A straight port of dowild() from Git's wildmatch.c, minus WM_CASEFOLD
+	int	dowild (const unsigned char* p, const unsigned char* text, unsigned int flags)
+	{
+		const unsigned char*	pattern = p;
+		unsigned char		p_ch;
+
+		for ( ; (p_ch = *p) != '\0'; text++, p++) {
+			int		matched;
+			int		match_slash;
+			int		negated;
+			unsigned char	t_ch;
+			unsigned char	prev_ch;
+
+			if ((t_ch = *text) == '\0' && p_ch != '*') {
+				return WM_ABORT_ALL;
+			}
+			switch (p_ch) {
+			case '\\':
+				// Literal match with following character.  Note that the test
+				// in "default" handles the p[1] == '\0' failure case.
+				p_ch = *++p;
+				// fall through
+			default:
+				if (t_ch != p_ch) {
+					return WM_NOMATCH;
+				}
+				continue;
+			case '?':
+				// Match anything but '/'.
+				if ((flags & WM_PATHNAME) && t_ch == '/') {
+					return WM_NOMATCH;
+				}
+				continue;
+			case '*':
+				if (*++p == '*') {
+					const unsigned char*	prev_p = p - 2;
+					while (*++p == '*') { }
+					if (!(flags & WM_PATHNAME)) {
+						// without WM_PATHNAME, '*' == '**'
+						match_slash = 1;
+					} else if ((prev_p < pattern || *prev_p == '/') &&
+					           (*p == '\0' || *p == '/' || (p[0] == '\\' && p[1] == '/'))) {
+						// Assuming we already match 'foo/' and are at <star star slash>,
+						// just assume it matches nothing and go ahead match the rest of
+						// the pattern with the remaining string.  This helps make
+						// foo/<*><*>/bar match both foo/bar and foo/a/bar.
+						if (p[0] == '/' && dowild(p + 1, text, flags) == WM_MATCH) {
+							return WM_MATCH;
+						}
+						match_slash = 1;
+					} else {
+						match_slash = 0;
+					}
+				} else {
+					// without WM_PATHNAME, '*' == '**'
+					match_slash = (flags & WM_PATHNAME) ? 0 : 1;
+				}
+				if (*p == '\0') {
+					// Trailing "**" matches everything.  Trailing "*" matches
+					// only if there are no more slash characters.
+					if (!match_slash && std::strchr(reinterpret_cast<const char*>(text), '/')) {
+						return WM_NOMATCH;
+					}
+					return WM_MATCH;
+				} else if (!match_slash && *p == '/') {
+					// _one_ asterisk followed by a slash with WM_PATHNAME
+					// matches the next directory
+					const char*	slash = std::strchr(reinterpret_cast<const char*>(text), '/');
+					if (!slash) {
+						return WM_NOMATCH;
+					}
+					text = reinterpret_cast<const unsigned char*>(slash);
+					// the slash is consumed by the top-level for loop
+					break;
+				}
+				while (true) {
+					if (t_ch == '\0') {
+						break;
+					}
+					// Try to advance faster when an asterisk is followed by a
+					// literal.  We know in this case that the string before the
+					// literal must belong to "*".  If match_slash is false, do not
+					// look past the first slash as it cannot belong to '*'.
+					if (!is_glob_special(*p)) {
+						p_ch = *p;
+						while ((t_ch = *text) != '\0' && (match_slash || t_ch != '/')) {
+							if (t_ch == p_ch) {
+								break;
+							}
+							text++;
+						}
+						if (t_ch != p_ch) {
+							return WM_NOMATCH;
+						}
+					}
+					if ((matched = dowild(p, text, flags)) != WM_NOMATCH) {
+						if (!match_slash || matched != WM_ABORT_TO_STARSTAR) {
+							return matched;
+						}
+					} else if (!match_slash && t_ch == '/') {
+						return WM_ABORT_TO_STARSTAR;
+					}
+					t_ch = *++text;
+				}
+				return WM_ABORT_ALL;
+			case '[':
+				p_ch = *++p;
+				if (p_ch == '^') {
+					p_ch = '!';
+				}
+				negated = p_ch == '!' ? 1 : 0;
+				if (negated) {
+					// Inverted character class.
+					p_ch = *++p;
+				}
+				prev_ch = 0;
+				matched = 0;
+				do {
+					if (!p_ch) {
+						return WM_ABORT_ALL;
+					}
+					if (p_ch == '\\') {
+						p_ch = *++p;
+						if (!p_ch) {
+							return WM_ABORT_ALL;
+						}
+						if (t_ch == p_ch) {
+							matched = 1;
+						}
+					} else if (p_ch == '-' && prev_ch && p[1] && p[1] != ']') {
+						p_ch = *++p;
+						if (p_ch == '\\') {
+							p_ch = *++p;
+							if (!p_ch) {
+								return WM_ABORT_ALL;
+							}
+						}
+						if (t_ch <= p_ch && t_ch >= prev_ch) {
+							matched = 1;
+						}
+						p_ch = 0; // This makes "prev_ch" get set to 0.
+					} else if (p_ch == '[' && p[1] == ':') {
+						const unsigned char*	s;
+						for (s = p += 2; (p_ch = *p) && p_ch != ']'; p++) { }
+						if (!p_ch) {
+							return WM_ABORT_ALL;
+						}
+						const std::ptrdiff_t	i = p - s - 1;
+						if (i < 0 || p[-1] != ':') {
+							// Didn't find ":]", so treat like a normal set.
+							p = s - 2;
+							p_ch = '[';
+							if (t_ch == p_ch) {
+								matched = 1;
+							}
+							continue;
+						}
+						const size_t		len = i;
+						if (class_equals(s, len, "alnum")) {
+							matched |= is_alnum(t_ch);
+						} else if (class_equals(s, len, "alpha")) {
+							matched |= is_alpha(t_ch);
+						} else if (class_equals(s, len, "blank")) {
+							matched |= t_ch == ' ' || t_ch == '\t';
+						} else if (class_equals(s, len, "cntrl")) {
+							matched |= is_cntrl(t_ch);
+						} else if (class_equals(s, len, "digit")) {
+							matched |= is_digit(t_ch);
+						} else if (class_equals(s, len, "graph")) {
+							matched |= is_graph(t_ch);
+						} else if (class_equals(s, len, "lower")) {
+							matched |= is_lower(t_ch);
+						} else if (class_equals(s, len, "print")) {
+							matched |= is_print(t_ch);
+						} else if (class_equals(s, len, "punct")) {
+							matched |= is_punct(t_ch);
+						} else if (class_equals(s, len, "space")) {
+							matched |= is_space(t_ch);
+						} else if (class_equals(s, len, "upper")) {
+							matched |= is_upper(t_ch);
+						} else if (class_equals(s, len, "xdigit")) {
+							matched |= is_xdigit(t_ch);
+						} else {
+							// malformed [:class:] string
+							return WM_ABORT_ALL;
+						}
+						p_ch = 0; // This makes "prev_ch" get set to 0.
+					} else if (t_ch == p_ch) {
+						matched = 1;
+					}
+				} while (prev_ch = p_ch, (p_ch = *++p) != ']');
+				if (matched == negated || ((flags & WM_PATHNAME) && t_ch == '/')) {
+					return WM_NOMATCH;
+				}
+				continue;
+			}
+		}
+
+		return *text ? WM_NOMATCH : WM_MATCH;
+	}
+
+	bool	is_valid_attribute_name (const std::string& name)
+	{
+		if (name.empty() || name[0] == '-') {
+			return false;
+		}
+		for (std::string::const_iterator it(name.begin()); it != name.end(); ++it) {
+			if (!(*it == '-' || *it == '.' || *it == '_' || is_alnum(*it))) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+bool wildmatch (const char* pattern, const char* text, unsigned int flags)
+{
+	return dowild(reinterpret_cast<const unsigned char*>(pattern), reinterpret_cast<const unsigned char*>(text), flags) == WM_MATCH;
+}
+
+// Parses one line of an attributes file into rule, leaving rule.pattern empty if the
+// line is blank or a comment.  Returns false if the line uses an unsupported construct.
+bool		Attribute_matcher::parse_line (const std::string& line, Rule& rule)
+{
+	if (line.size() >= MAX_LINE_LENGTH) {
+		return false;
+	}
+
+	std::string::size_type		pos = line.find_first_not_of(BLANK);
+	if (pos == std::string::npos || line[pos] == '#') {
+		return true;
+	}
+	if (line[pos] == '"') {
+		// quoted pattern
+		return false;
+	}
+
+	std::string::size_type		end = line.find_first_of(BLANK, pos);
+	std::string			pattern(line, pos, end == std::string::npos ? std::string::npos : end - pos);
+	if (pattern[0] == '!' || pattern.compare(0, 6, "[attr]") == 0) {
+		// negative pattern (which Git ignores) or macro definition
+		return false;
+	}
+
+	rule.must_be_dir = false;
+	if (pattern[pattern.size() - 1] == '/') {
+		pattern.erase(pattern.size() - 1);
+		rule.must_be_dir = true;
+	}
+	rule.match_basename = pattern.find('/') == std::string::npos;
+	if (!rule.match_basename && pattern[0] == '/') {
+		pattern.erase(0, 1);
+	}
+
+	rule.assignments.clear();
+	while (end != std::string::npos && (pos = line.find_first_not_of(BLANK, end)) != std::string::npos) {
+		end = line.find_first_of(BLANK, pos);
+		const std::string	token(line, pos, end == std::string::npos ? std::string::npos : end - pos);
+
+		// Like parse_attr() in Git's attr.c, "-name=value" unsets name
+		const std::string::size_type	equals = token.find('=');
+		Assignment		assignment;
+		assignment.name.assign(token, 0, equals);
+		if (token[0] == '-' || token[0] == '!') {
+			assignment.value = token[0] == '-' ? "unset" : "unspecified";
+			assignment.name.erase(0, 1);
+		} else if (equals == std::string::npos) {
+			assignment.value = "set";
+		} else {
+			assignment.value.assign(token, equals + 1, std::string::npos);
+		}
+
+		if (!is_valid_attribute_name(assignment.name)) {
+			// Git ignores the whole line
+			return false;
+		}
+
+		if (assignment.name == "binary") {
+			// The built-in binary macro is -diff -merge -text.  Git only expands
+			// it where binary is set, so be conservative about anything else.
+			if (assignment.value != "set") {
+				return false;
+			}
+			assignment.name = "diff";
+			assignment.value = "unset";
+			rule.assignments.push_back(assignment);
+		} else if (assignment.name == "filter" || assignment.name == "diff") {
+			rule.assignments.push_back(assignment);
+		}
+	}
+
+	rule.pattern.swap(pattern);
+	return true;
+}
+
+bool		Attribute_matcher::add_file (Level level, const std::string& dir, const std::string& contents)
+{
+	if (contents.size() >= MAX_FILE_SIZE) {
+		return false;
+	}
+
+	Rule_list			rules;
+	std::string::size_type		line_start = 0;
+	if (contents.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+		// UTF-8 byte order mark
+		line_start = 3;
+	}
+	while (line_start < contents.size()) {
+		std::string::size_type	line_end = contents.find('\n', line_start);
+		if (line_end == std::string::npos) {
+			line_end = contents.size();
+		}
+
+		Rule			rule;
+		if (!parse_line(contents.substr(line_start, line_end - line_start), rule)) {
+			return false;
+		}
+		if (!rule.pattern.empty() || rule.must_be_dir) {
+			rules.push_back(rule);
+		}
+		line_start = line_end + 1;
+	}
+
+	if (level == GLOBAL) {
+		global_rules.push_back(rules);
+	} else if (level == DIRECTORY) {
+		directory_rules[dir].swap(rules);
+	} else {
+		info_rules.swap(rules);
+	}
+	return true;
+}
+
+// Matches like path_matches() in Git's attr.c
+bool		Attribute_matcher::rule_matches (const Rule& rule, const std::string& dir, const std::string& path, const std::string& basename)
+{
+	if (rule.must_be_dir) {
+		return false;
+	}
+	if (rule.match_basename) {
+		return wildmatch(rule.pattern.c_str(), basename.c_str(), 0);
+	}
+
+	// match_pathname(): the path must be inside dir, and the part of the pattern
+	// before the first wildcard is compared literally
+	const std::string::size_type	name_pos = dir.empty() ? 0 : dir.size() + 1;
+	if (name_pos != 0 && (path.size() < name_pos || path.compare(0, dir.size(), dir) != 0 || path[dir.size()] != '/')) {
+		return false;
+	}
+	const size_t			prefix = simple_length(rule.pattern);
+	if (prefix) {
+		if (path.size() - name_pos < prefix || path.compare(name_pos, prefix, rule.pattern, 0, prefix) != 0) {
+			return false;
+		}
+		if (prefix == rule.pattern.size() && path.size() - name_pos == prefix) {
+			return true;
+		}
+	}
+	return wildmatch(rule.pattern.c_str() + prefix, path.c_str() + name_pos + prefix, WM_PATHNAME);
+}
+
+void		Attribute_matcher::apply_rules (const Rule_list& rules, const std::string& dir, const std::string& path, const std::string& basename, std::string& filter, std::string& diff)
+{
+	// Later rules, and later assignments within a rule, take precedence
+	for (Rule_list::const_iterator rule(rules.begin()); rule != rules.end(); ++rule) {
+		if (rule->assignments.empty() || !rule_matches(*rule, dir, path, basename)) {
+			continue;
+		}
+		for (std::vector<Assignment>::const_iterator assignment(rule->assignments.begin()); assignment != rule->assignments.end(); ++assignment) {
+			if (assignment->name == "filter") {
+				filter = assignment->value;
+			} else {
+				diff = assignment->value;
+			}
+		}
+	}
+}
+
+void		Attribute_matcher::get (const std::string& path, std::string& filter, std::string& diff) const
+{
+	filter = "unspecified";
+	diff = "unspecified";
+
+	const std::string::size_type	slash = path.rfind('/');
+	const std::string		basename(slash == std::string::npos ? path : path.substr(slash + 1));
+
+	for (std::vector<Rule_list>::const_iterator rules(global_rules.begin()); rules != global_rules.end(); ++rules) {
+		apply_rules(*rules, "", path, basename, filter, diff);
+	}
+
+	// .gitattributes files in deeper directories take precedence
+	std::string::size_type		dir_end = 0;
+	while (true) {
+		const std::string	dir(path, 0, dir_end);
+		const std::map<std::string, Rule_list>::const_iterator rules(directory_rules.find(dir));
+		if (rules != directory_rules.end()) {
+			apply_rules(rules->second, dir, path, basename, filter, diff);
+		}
+		if ((dir_end = path.find('/', dir_end + (dir_end != 0))) == std::string::npos) {
+			break;
+		}
+	}
+
+	apply_rules(info_rules, "", path, basename, filter, diff);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_ATTRIBUTES_HPP
+#define GIT_CRYPT_ATTRIBUTES_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+// Evaluates the filter and diff attributes of paths in-process, following Git's
+// rules for .gitattributes files, so that we don't need `git check-attr`.
+//
+// Only the common subset of the gitattributes syntax is supported: add_file()
+// returns false if a file uses anything else (macro definitions, quoted or
+// negative patterns, overlong lines, ...), in which case the caller should fall
+// back to `git check-attr`.  Case-insensitive matching (core.ignorecase) is not
+// supported either, so the caller must check for that too.
+class Attribute_matcher {
+public:
+	enum Level {
+		GLOBAL,		// system-wide and per-user files, lowest precedence (add in that order)
+		DIRECTORY,	// .gitattributes files in the working tree or index
+		INFO		// $GIT_DIR/info/attributes, highest precedence
+	};
+
+private:
+	struct Assignment {
+		std::string	name;		// "filter" or "diff"
+		std::string	value;		// as output by `git check-attr` ("set", "unset", "unspecified" or the value)
+	};
+	struct Rule {
+		std::string	pattern;	// without the leading or trailing slash
+		bool		match_basename;	// pattern has no slash, so it's matched against the basename
+		bool		must_be_dir;	// pattern had a trailing slash, so it never matches a file
+		std::vector<Assignment> assignments;
+	};
+	typedef std::vector<Rule> Rule_list;
+
+	std::vector<Rule_list>			global_rules;
+	std::map<std::string, Rule_list>	directory_rules;	// by directory relative to top ("" for top)
+	Rule_list				info_rules;
+
+	static bool	parse_line (const std::string& line, Rule& rule);
+	static bool	rule_matches (const Rule& rule, const std::string& dir, const std::string& path, const std::string& basename);
+	static void	apply_rules (const Rule_list& rules, const std::string& dir, const std::string& path, const std::string& basename, std::string& filter, std::string& diff);
+
+public:
+	// dir is the directory containing the file, relative to the top of the working
+	// tree, without a trailing slash ("" for the top, and for GLOBAL and INFO files)
+	bool		add_file (Level level, const std::string& dir, const std::string& contents);
+
+	// path is relative to the top of the working tree, and must be a file rather than
+	// a directory.  Values are output as by `git check-attr`.
+	void		get (const std::string& path, std::string& filter, std::string& diff) const;
+};
+
+// Git's wildmatch(), as used for gitattributes and gitignore patterns
+enum {
+	WM_PATHNAME = 1		// wildcards don't match slashes, except **
+};
+bool wildmatch (const char* pattern, const char* text, unsigned int flags);
+
+#endif
@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+#
+# The speed of the cipher suites (see git-crypt-cipher in git-crypt(1)).  Commits an
+# incompressible file in the original format, and in the chunked format with each
+# suite: HMAC-SHA1 with AES-CTR (the default), AES-256-GCM and ChaCha20-Poly1305.
+# Reports the time taken to clean the file (`git add`) and to smudge it
+# (`git checkout`), and the clean throughput.
+#
+# Usage: benchmarks/cipher_suites.sh [SIZE_BYTES [THREADS]]
+#
+# THREADS sets git-crypt.threads (default: unset, so one per CPU).
+
+. "$(dirname "$0")/common.sh"
+
+size=${1:-200000000}
+threads=$2
+
+random_fixture "$BENCH_DIR/fixture" "$size"
+
+printf '%-10s %10s %10s %12s\n' suite clean_s smudge_s clean_MB/s
+for suite in original hmac-sha1 aes-gcm chacha20; do
+	case $suite in
+		original)	attributes= ;;
+		hmac-sha1)	attributes=git-crypt-format=chunked ;;
+		*)		attributes="git-crypt-format=chunked git-crypt-cipher=$suite" ;;
+	esac
+	new_repo "$BENCH_DIR/$suite" "$attributes"
+	# Otherwise zlib-compressing the (incompressible) blob takes longer than encrypting it
+	git config core.looseCompression 0
+	if [ -n "$threads" ]; then
+		git config git-crypt.threads "$threads"
+	fi
+	cp "$BENCH_DIR/fixture" file
+	clean_time=$(seconds git add file)
+	git commit -qm 0
+	rm file
+	smudge_time=$(seconds git checkout file)
+	if ! cmp -s file "$BENCH_DIR/fixture"; then
+		echo "$0: $suite: checked-out file differs from the original" >&2
+		exit 1
+	fi
+
+	printf '%-10s %10s %10s %12.0f\n' "$suite" "$clean_time" "$smudge_time" \
+		"$(awk -v size="$size" -v seconds="$clean_time" 'BEGIN { print size / 1000000 / seconds }')"
+done
@@ -0,0 +1,81 @@
+# Helpers shared by the benchmark scripts in this directory; source it, don't run it.
+#
+# GIT_CRYPT is the git-crypt binary to benchmark (default: the one built in the
+# parent directory), and BENCH_DIR is where the scratch repositories go (default:
+# a new temporary directory, removed afterwards).
+
+set -e
+
+GIT_CRYPT=${GIT_CRYPT:-$(cd "$(dirname "$0")/.." && pwd)/git-crypt}
+if [ ! -x "$GIT_CRYPT" ]; then
+	echo "$0: $GIT_CRYPT not found - run make first, or set GIT_CRYPT" >&2
+	exit 1
+fi
+if [ -z "$BENCH_DIR" ]; then
+	BENCH_DIR=$(mktemp -d)
+	trap 'rm -rf "$BENCH_DIR"' EXIT
+fi
+
+TIMEFORMAT=%R
+
+# random_fixture FILE BYTES - pseudo-random, incompressible data, the same every run
+random_fixture () {
+	head -c "$2" /dev/zero | openssl enc -aes-128-ctr -nosalt -K 00000000000000000000000000000000 -iv 00000000000000000000000000000000 > "$1"
+}
+
+# text_fixture FILE BYTES - compressible, JSON-like records, the same every run
+text_fixture () {
+	awk -v bytes="$2" 'BEGIN {
+		srand(1)
+		while (len < bytes) {
+			line = sprintf("{\"id\": %d, \"name\": \"user%d\", \"score\": %.4f, \"active\": %s}\n", n, int(rand() * 100000), rand() * 1000, rand() < 0.5 ? "true" : "false")
+			printf "%s", line
+			len += length(line)
+			++n
+		}
+	}' | head -c "$2" > "$1"
+}
+
+# new_repo DIR ATTRIBUTES - a repository with a fresh git-crypt key, in which
+# the file named "file" has the given attributes
+new_repo () {
+	rm -rf "$1"
+	mkdir -p "$1"
+	cd "$1"
+	git init -q
+	git config user.name bench
+	git config user.email bench@example.com
+	"$GIT_CRYPT" init > /dev/null 2>&1
+	echo "file filter=git-crypt diff=git-crypt $2" > .gitattributes
+	git add .gitattributes
+	git commit -qm attributes
+}
+
+# edit_file FILE N - the Nth small edit: odd edits overwrite 100 bytes in place,
+# even ones insert 8 bytes (shifting the rest of the file).  Offsets are the same every run.
+edit_file () {
+	size=$(wc -c < "$1")
+	offset=$(awk -v seed="$2" -v size="$size" 'BEGIN { srand(seed); print int(rand() * (size - 100)) }')
+	if [ $(($2 % 2)) -eq 1 ]; then
+		head -c 100 /dev/zero | tr '\0' x | dd of="$1" bs=1 seek="$offset" conv=notrunc 2> /dev/null
+	else
+		{ head -c "$offset" "$1"; printf 'inserted'; tail -c +$((offset + 1)) "$1"; } > "$1.new"
+		mv "$1.new" "$1"
+	fi
+}
+
+# pack_size - the size of the packed objects in KiB, after packing everything
+pack_size () {
+	git repack -adfq
+	git count-objects -v | sed -n 's/^size-pack: //p'
+}
+
+# sum A B - A + B, for adding up times
+sum () {
+	awk -v a="$1" -v b="$2" 'BEGIN { print a + b }'
+}
+
+# seconds COMMAND... - the wall-clock time taken by COMMAND, in seconds
+seconds () {
+	{ time "$@" > /dev/null 2>&1; } 2>&1
+}
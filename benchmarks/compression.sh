@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+#
+# The size and CPU trade-off of compressing before encrypting (see git-crypt-compress
+# in git-crypt(1)).  Commits a compressible text file with and without compression,
+# in the chunked and cdc formats, then EDITS small edits to it.  Reports the pack size
+# from `git count-objects -v` (after `git repack -adf`) before and after the edits, and
+# the time taken to clean the file (`git add`) and to smudge it (`git checkout`).
+#
+# Usage: benchmarks/compression.sh [SIZE_BYTES [EDITS]]
+
+. "$(dirname "$0")/common.sh"
+
+size=${1:-50000000}
+edits=${2:-10}
+
+text_fixture "$BENCH_DIR/fixture" "$size"
+
+printf '%-10s %12s %12s %12s %12s\n' format initial_KiB final_KiB clean_s smudge_s
+for format in chunked chunked+zlib cdc cdc+zlib; do
+	attributes=git-crypt-format=${format%+zlib}
+	if [ "$format" != "${format%+zlib}" ]; then
+		attributes="$attributes git-crypt-compress=zlib"
+	fi
+	new_repo "$BENCH_DIR/$format" "$attributes"
+	cp "$BENCH_DIR/fixture" file
+	clean_time=$(seconds git add file)
+	git commit -qm 0
+	rm file
+	smudge_time=$(seconds git checkout file)
+	if ! cmp -s file "$BENCH_DIR/fixture"; then
+		echo "$0: $format: checked-out file differs from the original" >&2
+		exit 1
+	fi
+	initial=$(pack_size)
+
+	for i in $(seq "$edits"); do
+		edit_file file "$i"
+		git add file
+		git commit -qm "$i"
+	done
+	final=$(pack_size)
+
+	printf '%-10s %12s %12s %12s %12s\n' "$format" "$initial" "$final" "$clean_time" "$smudge_time"
+done
@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+#
+# Parsing speed of `git ls-files -cotsz` output, which git-crypt reads for every file
+# in the repository when unlocking, locking, or running status.  Builds
+# ls_files_parse.cpp against the objects of the last `make`, generates a synthetic
+# stream of ENTRIES records (regular files, with some symlinks, submodules and
+# untracked files mixed in), then reports the time taken to parse it with
+# Nul_record_reader and with the operator>> loop it replaced.
+#
+# Usage: benchmarks/ls_files_parse.sh [ENTRIES]
+
+. "$(dirname "$0")/common.sh"
+
+entries=${1:-5000000}
+
+src=$(cd "$(dirname "$0")/.." && pwd)
+${CXX:-c++} -std=c++11 -O2 -o "$BENCH_DIR/ls_files_parse" "$src/benchmarks/ls_files_parse.cpp" "$src/ls_files.o"
+
+awk -v entries="$entries" 'BEGIN {
+	srand(1)
+	for (n = 0; n < entries; ++n) {
+		path = sprintf("src/module%d/component%d/file%d.c", n % 997, n % 89, n)
+		r = rand()
+		if (r < 0.01) {
+			printf "? %s%c", path, 0
+		} else {
+			mode = r < 0.02 ? "120000" : r < 0.025 ? "160000" : "100644"
+			printf "H %s %08x%032x 0\t%s%c", mode, n, n * 2654435761 % 4294967296, path, 0
+		}
+	}
+}' > "$BENCH_DIR/ls_files"
+
+printf '%-20s %10s %10s\n' parser seconds files
+"$BENCH_DIR/ls_files_parse" "$BENCH_DIR/ls_files" | while read -r parser seconds files; do
+	printf '%-20s %10.2f %10s\n' "$parser" "$seconds" "$files"
+done
@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+#
+# How much the repository grows when a large encrypted file is edited repeatedly,
+# for each format (see git-crypt-format in git-crypt(1)).  Commits a random file,
+# then EDITS small edits to it, and reports the pack size from `git count-objects -v`
+# (after `git repack -adf`) before and after, along with the time taken to
+# commit the file and then all of the edits.
+#
+# Usage: benchmarks/pack_growth.sh [SIZE_BYTES [EDITS]]
+
+. "$(dirname "$0")/common.sh"
+
+size=${1:-50000000}
+edits=${2:-10}
+
+random_fixture "$BENCH_DIR/fixture" "$size"
+
+printf '%-10s %12s %12s %12s %12s %12s\n' format initial_KiB final_KiB growth_KiB first_add_s edits_s
+for format in original chunked cdc; do
+	if [ "$format" = original ]; then
+		attributes=
+	else
+		attributes=git-crypt-format=$format
+	fi
+	new_repo "$BENCH_DIR/$format" "$attributes"
+	cp "$BENCH_DIR/fixture" file
+	first_add_time=$(seconds sh -c 'git add file && git commit -qm 0')
+	initial=$(pack_size)
+
+	edits_time=0
+	for i in $(seq "$edits"); do
+		edit_file file "$i"
+		edits_time=$(sum "$edits_time" "$(seconds sh -c "git add file && git commit -qm $i")")
+	done
+	final=$(pack_size)
+
+	printf '%-10s %12s %12s %12s %12s %12s\n' "$format" "$initial" "$final" $((final - initial)) "$first_add_time" "$edits_time"
+done
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+// Launch latency of Coprocess::spawn, which uses posix_spawnp, against the fork and
+// exec which it falls back to.  Spawns COUNT `true` processes each way, with their
+// stdin and stdout on pipes like git-crypt's coprocesses, after touching BALLAST_MIB
+// of memory (fork must copy the page tables which map it, posix_spawnp needn't).
+// Built and run by spawn_latency.sh.
+
+#include "../git-crypt.hpp"
+#include "../coprocess.hpp"
+#include "../util.hpp"
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const char*	argv0;	// used by util.cpp
+
+namespace {
+	double microseconds_since (std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	bool spawn_with_coprocess (const std::vector<std::string>& command)
+	{
+		Coprocess	proc;
+		proc.stdin_pipe();
+		proc.stdout_pipe();
+		proc.spawn(command);
+		proc.close_stdin();
+		proc.close_stdout();
+		return successful_exit(proc.wait());
+	}
+
+	// What Coprocess::spawn does when posix_spawnp fails
+	bool spawn_with_fork (const std::vector<std::string>& command)
+	{
+		int		stdin_fds[2];
+		int		stdout_fds[2];
+		if (pipe(stdin_fds) == -1 || pipe(stdout_fds) == -1) {
+			throw System_error("pipe", "", errno);
+		}
+
+		const pid_t	pid = fork();
+		if (pid == -1) {
+			throw System_error("fork", "", errno);
+		}
+		if (pid == 0) {
+			close(stdin_fds[1]);
+			close(stdout_fds[0]);
+			dup2(stdin_fds[0], 0);
+			close(stdin_fds[0]);
+			dup2(stdout_fds[1], 1);
+			close(stdout_fds[1]);
+			execlp(command[0].c_str(), command[0].c_str(), static_cast<char*>(0));
+			_exit(-1);
+		}
+
+		close(stdin_fds[0]);
+		close(stdin_fds[1]);
+		close(stdout_fds[0]);
+		close(stdout_fds[1]);
+		int		status;
+		while (waitpid(pid, &status, 0) == -1) {
+			if (errno != EINTR) {
+				throw System_error("waitpid", "", errno);
+			}
+		}
+		return successful_exit(status);
+	}
+}
+
+int main (int argc, const char** argv)
+{
+	if (argc != 3) {
+		std::clog << "Usage: spawn_latency COUNT BALLAST_MIB" << std::endl;
+		return 2;
+	}
+	argv0 = argv[0];
+	const int			count = std::atoi(argv[1]);
+	const size_t			ballast_len = static_cast<size_t>(std::atoi(argv[2])) << 20;
+
+	// Touch every page, so it's really mapped
+	std::vector<char>		ballast(ballast_len);
+	for (size_t i = 0; i < ballast.size(); i += 4096) {
+		ballast[i] = 1;
+	}
+
+	std::vector<std::string>	command;
+	command.push_back("true");
+
+	try {
+		std::chrono::steady_clock::time_point	start(std::chrono::steady_clock::now());
+		for (int i = 0; i < count; ++i) {
+			if (!spawn_with_coprocess(command)) {
+				std::clog << "spawn_latency: 'true' failed" << std::endl;
+				return 1;
+			}
+		}
+		const double	posix_spawn_us = microseconds_since(start) / count;
+
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < count; ++i) {
+			if (!spawn_with_fork(command)) {
+				std::clog << "spawn_latency: 'true' failed" << std::endl;
+				return 1;
+			}
+		}
+		const double	fork_us = microseconds_since(start) / count;
+
+		std::cout << posix_spawn_us << ' ' << fork_us << std::endl;
+	} catch (const System_error& e) {
+		std::clog << "spawn_latency: " << e.message() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+#
+# The launch latency of coprocesses (see Coprocess::spawn), which git-crypt starts
+# thousands of when unlocking or locking.  Builds spawn_latency.cpp against the objects
+# of the last `make`, then reports the average time to launch `true` with posix_spawnp
+# (as Coprocess does) and with fork and exec (its fallback), while holding each amount
+# of touched memory, since fork's cost grows with the size of the parent process.
+#
+# Usage: benchmarks/spawn_latency.sh [COUNT [BALLAST_MIB...]]
+
+. "$(dirname "$0")/common.sh"
+
+count=${1:-1000}
+shift || true
+ballasts=${*:-0 256 1024}
+
+src=$(cd "$(dirname "$0")/.." && pwd)
+${CXX:-c++} -std=c++11 -O2 -pthread -o "$BENCH_DIR/spawn_latency" "$src/benchmarks/spawn_latency.cpp" \
+	"$src/coprocess.o" "$src/fhstream.o" "$src/util.o"
+
+printf '%-12s %16s %10s\n' ballast_MiB posix_spawnp_us fork_us
+for ballast in $ballasts; do
+	times=$("$BENCH_DIR/spawn_latency" "$count" "$ballast")
+	printf '%-12s %16.1f %10.1f\n' "$ballast" ${times}
+done
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "cat_file.hpp"
+#include "commands.hpp"
+#include "util.hpp"
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+Cat_file_batch::Cat_file_batch ()
+: bytes_left(0), in_object(false)
+{
+	// git cat-file --batch
+	std::vector<std::string>	command;
+	command.push_back("git");
+	command.push_back("cat-file");
+	command.push_back("--batch");
+
+	cat_file_stdin = cat_file.stdin_pipe();
+	cat_file_stdout = cat_file.stdout_pipe();
+	cat_file.spawn(command);
+}
+
+Cat_file_batch::~Cat_file_batch ()
+{
+	// cat_file's destructor closes its pipes, which makes `git cat-file` exit
+}
+
+bool		Cat_file_batch::open (const std::string& object_id, std::string* type, uint64_t* size)
+{
+	skip_rest();
+
+	*cat_file_stdin << object_id << '\n';
+	cat_file_stdin->flush();
+
+	// Output looks like:
+	// <object_id> SP <type> SP <size> LF <contents> LF
+	// or, if the object doesn't exist:
+	// <object_id> SP missing LF
+	std::string			header;
+	if (!std::getline(*cat_file_stdout, header)) {
+		throw Error("Unexpected end of 'git cat-file' output");
+	}
+
+	if (header == object_id + " missing" || header == object_id + " ambiguous") {
+		// (checked explicitly, since the name may contain spaces if it's <rev>:<path>)
+		return false;
+	}
+	const std::string::size_type	size_pos = header.rfind(' ');
+	if (size_pos == std::string::npos || size_pos == 0) {
+		throw Error("Malformed 'git cat-file' output");
+	}
+	const std::string::size_type	type_pos = header.rfind(' ', size_pos - 1);
+	if (type_pos == std::string::npos) {
+		throw Error("Malformed 'git cat-file' output");
+	}
+
+	if (type) {
+		*type = header.substr(type_pos + 1, size_pos - type_pos - 1);
+	}
+	bytes_left = std::strtoull(header.c_str() + size_pos + 1, nullptr, 10);
+	in_object = true;
+	if (size) {
+		*size = bytes_left;
+	}
+	return true;
+}
+
+size_t		Cat_file_batch::read (char* p, size_t len)
+{
+	len = std::min<uint64_t>(len, bytes_left);
+	cat_file_stdout->read(p, len);
+	if (static_cast<size_t>(cat_file_stdout->gcount()) != len) {
+		throw Error("Unexpected end of 'git cat-file' output");
+	}
+	bytes_left -= len;
+	return len;
+}
+
+void		Cat_file_batch::skip_rest ()
+{
+	if (!in_object) {
+		return;
+	}
+
+	while (bytes_left > 0) {
+		const std::streamsize	len = std::min<uint64_t>(bytes_left, std::numeric_limits<std::streamsize>::max());
+		cat_file_stdout->ignore(len);
+		if (cat_file_stdout->gcount() != len) {
+			throw Error("Unexpected end of 'git cat-file' output");
+		}
+		bytes_left -= len;
+	}
+	if (cat_file_stdout->get() != '\n') {
+		throw Error("Malformed 'git cat-file' output");
+	}
+	in_object = false;
+}
+
+void		Cat_file_batch::close ()
+{
+	skip_rest();
+	cat_file.close_stdin();
+	if (!successful_exit(cat_file.wait())) {
+		throw Error("'git cat-file' failed - is this a Git repository?");
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_CAT_FILE_HPP
+#define GIT_CRYPT_CAT_FILE_HPP
+
+#include "coprocess.hpp"
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+// Reads objects from the repository through a single, long-lived
+// `git cat-file --batch` process, instead of running a separate
+// `git cat-file` process for each object.  Only the parts of an object
+// which are actually read are copied; the rest is skipped when the next
+// object is requested.
+class Cat_file_batch {
+	Coprocess	cat_file;
+	std::ostream*	cat_file_stdin;
+	std::istream*	cat_file_stdout;
+	uint64_t	bytes_left;	// bytes of the current object's contents not yet read
+	bool		in_object;	// true if the current object's trailing LF has not been read
+
+			Cat_file_batch (const Cat_file_batch&);	// Disallow copy
+	Cat_file_batch&	operator= (const Cat_file_batch&);	// Disallow assignment
+public:
+			Cat_file_batch ();
+			~Cat_file_batch ();
+
+	// Start reading the given object.  Returns false if it doesn't exist.
+	bool		open (const std::string& object_id, std::string* type =0, uint64_t* size =0);
+
+	// Read up to len bytes of the current object's contents, returning the number of bytes read
+	size_t		read (char* p, size_t len);
+
+	// Discard the rest of the current object's contents
+	void		skip_rest ();
+
+	// Stop the `git cat-file` process, throwing an Error if it failed
+	void		close ();
+};
+
+#endif
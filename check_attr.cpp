@@ -0,0 +1,172 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "check_attr.hpp"
+#include "commands.hpp"
+#include "util.hpp"
+#include <istream>
+#include <ostream>
+#include <sstream>
+
+void		Check_attr_output_parser::add (const char* p, size_t len)
+{
+	buffer.erase(0, start);
+	start = 0;
+	buffer.append(p, len);
+}
+
+bool		Check_attr_output_parser::next (std::string& path, std::string& attribute, std::string& value)
+{
+	const std::string::size_type	path_end = buffer.find('\0', start);
+	if (path_end == std::string::npos) {
+		return false;
+	}
+	const std::string::size_type	attribute_end = buffer.find('\0', path_end + 1);
+	if (attribute_end == std::string::npos) {
+		return false;
+	}
+	const std::string::size_type	value_end = buffer.find('\0', attribute_end + 1);
+	if (value_end == std::string::npos) {
+		return false;
+	}
+
+	path.assign(buffer, start, path_end - start);
+	attribute.assign(buffer, path_end + 1, attribute_end - path_end - 1);
+	value.assign(buffer, attribute_end + 1, value_end - attribute_end - 1);
+	start = value_end + 1;
+	return true;
+}
+
+Check_attr_batch::Check_attr_batch (const std::vector<std::string>& arg_attributes)
+: attributes(arg_attributes), is_batched(git_version() >= make_version(1, 8, 5)), check_attr_stdin(nullptr), check_attr_stdout(nullptr)
+{
+	if (!is_batched) {
+		return;
+	}
+
+	// git check-attr --stdin -z attribute...
+	std::vector<std::string>	command;
+	command.push_back("git");
+	command.push_back("check-attr");
+	command.push_back("--stdin");
+	command.push_back("-z");
+	command.insert(command.end(), attributes.begin(), attributes.end());
+
+	check_attr_stdin = check_attr.stdin_pipe();
+	check_attr_stdout = check_attr.stdout_pipe();
+	check_attr.spawn(command);
+}
+
+Check_attr_batch::~Check_attr_batch ()
+{
+	// check_attr's destructor closes its pipes, which makes `git check-attr` exit
+}
+
+void		Check_attr_batch::get (const std::string& path, std::vector<std::string>& values)
+{
+	if (!is_batched) {
+		get_unbatched(path, values);
+		return;
+	}
+
+	check_attr_stdin->write(path.c_str(), path.size() + 1);
+	check_attr_stdin->flush();
+
+	values.resize(attributes.size());
+	for (size_t i = 0; i < attributes.size(); ++i) {
+		std::string		output_path;
+		std::string		attribute;
+		while (!output.next(output_path, attribute, values[i])) {
+			// Wait for the first byte, then take whatever else has already arrived
+			char		buffer[4096];
+			if (!check_attr_stdout->read(buffer, 1)) {
+				throw Error("Unexpected end of 'git check-attr' output");
+			}
+			output.add(buffer, 1 + check_attr_stdout->readsome(buffer + 1, sizeof(buffer) - 1));
+		}
+		if (attribute != attributes[i]) {
+			throw Error("Malformed 'git check-attr' output");
+		}
+	}
+}
+
+void		Check_attr_batch::get_unbatched (const std::string& path, std::vector<std::string>& values)
+{
+	// git check-attr attribute... -- path
+	std::vector<std::string>	command;
+	command.push_back("git");
+	command.push_back("check-attr");
+	command.insert(command.end(), attributes.begin(), attributes.end());
+	command.push_back("--");
+	command.push_back(path);
+
+	std::stringstream		output;
+	if (!successful_exit(exec_command(command, output))) {
+		throw Error("'git check-attr' failed - is this a Git repository?");
+	}
+
+	values.assign(attributes.size(), "unspecified");
+
+	// Example output:
+	// filename: filter: git-crypt
+	// filename: diff: git-crypt
+	std::string			line;
+	while (std::getline(output, line)) {
+		// filename might contain ": ", so parse line backwards
+		// filename: attr_name: attr_value
+		//         ^name_pos  ^value_pos
+		const std::string::size_type	value_pos(line.rfind(": "));
+		if (value_pos == std::string::npos || value_pos == 0) {
+			continue;
+		}
+		const std::string::size_type	name_pos(line.rfind(": ", value_pos - 1));
+		if (name_pos == std::string::npos) {
+			continue;
+		}
+
+		const std::string		attr_name(line.substr(name_pos + 2, value_pos - (name_pos + 2)));
+		for (size_t i = 0; i < attributes.size(); ++i) {
+			if (attr_name == attributes[i]) {
+				values[i] = line.substr(value_pos + 2);
+			}
+		}
+	}
+}
+
+void		Check_attr_batch::close ()
+{
+	if (!is_batched) {
+		return;
+	}
+	check_attr.close_stdin();
+	if (!successful_exit(check_attr.wait())) {
+		throw Error("'git check-attr' failed - is this a Git repository?");
+	}
+}
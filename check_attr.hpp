@@ -0,0 +1,95 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_CHECK_ATTR_HPP
+#define GIT_CRYPT_CHECK_ATTR_HPP
+
+#include "coprocess.hpp"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Splits the output of `git check-attr -z`, which is <path> NUL <attribute> NUL <value> NUL
+// for each attribute of each path, into records.  Output can be added in arbitrary pieces,
+// e.g. as it arrives from a Coprocess_multiplexer.
+class Check_attr_output_parser {
+	std::string			buffer;
+	size_t				start;		// offset in buffer of the first record not yet returned
+
+public:
+				Check_attr_output_parser () : start(0) { }
+
+	void			add (const char* p, size_t len);
+
+	// Gets the next complete record, returning false if there isn't one yet
+	bool			next (std::string& path, std::string& attribute, std::string& value);
+
+	// Returns true if there's no partial record left over
+	bool			is_empty () const { return start == buffer.size(); }
+};
+
+// Looks up the attributes of paths through a single, long-lived
+// `git check-attr --stdin -z` process, instead of running a separate
+// `git check-attr` process for each path.
+//
+// Git versions before 1.8.5 don't support --stdin and -z, so with them,
+// get() falls back to running `git check-attr` for each path.
+class Check_attr_batch {
+	std::vector<std::string>	attributes;
+	bool				is_batched;
+	Coprocess			check_attr;
+	std::ostream*			check_attr_stdin;
+	std::istream*			check_attr_stdout;
+	Check_attr_output_parser	output;
+
+	void			get_unbatched (const std::string& path, std::vector<std::string>& values);
+
+				Check_attr_batch (const Check_attr_batch&);	// Disallow copy
+	Check_attr_batch&	operator= (const Check_attr_batch&);	// Disallow assignment
+public:
+	explicit		Check_attr_batch (const std::vector<std::string>& attributes);
+				~Check_attr_batch ();
+
+	// Get the values of the attributes of path (relative to the current directory),
+	// in the same order as they were passed to the constructor.  Values are output
+	// as by `git check-attr` ("set", "unset", "unspecified" or the value).
+	void			get (const std::string& path, std::vector<std::string>& values);
+
+	// Instead of calling get(), a batched process can be driven by a Coprocess_multiplexer
+	// to keep it busy: write NUL-terminated paths to the coprocess and pass its output
+	// to a Check_attr_output_parser.  (Don't mix the two.)
+	bool			has_coprocess () const { return is_batched; }
+	Coprocess&		coprocess () { return check_attr; }
+
+	// Stop the `git check-attr` process, throwing an Error if it failed
+	void			close ();
+};
+
+#endif
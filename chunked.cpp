@@ -0,0 +1,701 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "chunked.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace {
+	// Read len bytes into p, appending them to stored
+	bool read_stored (std::istream& in, std::string& stored, unsigned char* p, size_t len)
+	{
+		in.read(reinterpret_cast<char*>(p), len);
+		if (in.gcount() != static_cast<std::streamsize>(len)) {
+			return false;
+		}
+		stored.append(reinterpret_cast<const char*>(p), len);
+		return true;
+	}
+
+	bool read_stored_be32 (std::istream& in, std::string& stored, uint32_t& i)
+	{
+		unsigned char	buffer[4];
+		if (!read_stored(in, stored, buffer, sizeof(buffer))) {
+			return false;
+		}
+		i = load_be32(buffer);
+		return true;
+	}
+
+	// Derive len bytes of key material for the given purpose from the key's HMAC key,
+	// by HMACing the label, a counter and the context
+	void derive_key (const Key_file::Entry& key, const char* label, const std::string& context, unsigned char* out, size_t len)
+	{
+		for (uint32_t counter = 1; len > 0; ++counter) {
+			unsigned char	be_counter[4];
+			unsigned char	block[Hmac_sha1_state::LEN];
+			store_be32(be_counter, counter);
+
+			Hmac_sha1_state	hmac(key.hmac_key, HMAC_KEY_LEN);
+			hmac.add(reinterpret_cast<const unsigned char*>(label), std::strlen(label) + 1);
+			hmac.add(be_counter, sizeof(be_counter));
+			hmac.add(reinterpret_cast<const unsigned char*>(context.data()), context.size());
+			hmac.get(block);
+
+			const size_t	block_len = std::min(len, sizeof(block));
+			std::memcpy(out, block, block_len);
+			explicit_memset(block, 0, sizeof(block));
+			out += block_len;
+			len -= block_len;
+		}
+	}
+
+	Aead_cipher::Algorithm get_aead_algorithm (Chunked_header::Cipher cipher)
+	{
+		return cipher == Chunked_header::CIPHER_AES_256_GCM ? Aead_cipher::AES_256_GCM : Aead_cipher::CHACHA20_POLY1305;
+	}
+
+	// Call fn(begin, end) for consecutive ranges of [0, count), on the pool's threads if pool isn't null
+	void run_parallel (size_t count, Thread_pool* pool, const std::function<void(size_t, size_t)>& fn)
+	{
+		const size_t	threads = pool ? std::min<size_t>(pool->size(), count) : 1;
+		if (threads <= 1) {
+			fn(0, count);
+			return;
+		}
+
+		const size_t	range_len = (count + threads - 1) / threads;
+		try {
+			for (size_t i = 0; i < threads && i * range_len < count; ++i) {
+				const size_t	begin = i * range_len;
+				const size_t	end = std::min(begin + range_len, count);
+				pool->submit(std::bind(fn, begin, end));
+			}
+		} catch (...) {
+			// Don't return while the ranges already submitted are still using the buffers
+			try {
+				pool->wait();
+			} catch (...) {
+			}
+			throw;
+		}
+		pool->wait();
+	}
+}
+
+Chunked_header::Chunked_header ()
+: key_version(0), chunk_size(DEFAULT_CHUNK_SIZE), is_content_defined(false), min_chunk_size(0), avg_chunk_size(0), compression(COMPRESSION_NONE), cipher(CIPHER_AES_CTR_HMAC_SHA1)
+{
+	std::memset(siv, 0, sizeof(siv));
+}
+
+std::string	Chunked_header::load (std::istream& in)
+{
+	std::string	stored("\0GITCRYPT\2", MAGIC_LEN);
+	bool		has_siv = false;
+	while (true) {
+		uint32_t	field_id;
+		if (!read_stored_be32(in, stored, field_id)) {
+			throw Malformed();
+		}
+		if (field_id == HEADER_FIELD_END) {
+			break;
+		}
+		uint32_t	field_len;
+		if (!read_stored_be32(in, stored, field_len)) {
+			throw Malformed();
+		}
+
+		if (field_id == HEADER_FIELD_KEY_VERSION) {
+			if (field_len != 4) {
+				throw Malformed();
+			}
+			if (!read_stored_be32(in, stored, key_version)) {
+				throw Malformed();
+			}
+		} else if (field_id == HEADER_FIELD_CHUNK_SIZE) {
+			if (field_len != 4) {
+				throw Malformed();
+			}
+			if (!read_stored_be32(in, stored, chunk_size)) {
+				throw Malformed();
+			}
+			if (chunk_size == 0 || chunk_size > MAX_CHUNK_SIZE) {
+				throw Malformed();
+			}
+		} else if (field_id == HEADER_FIELD_SIV) {
+			if (field_len != sizeof(siv)) {
+				throw Malformed();
+			}
+			if (!read_stored(in, stored, siv, sizeof(siv))) {
+				throw Malformed();
+			}
+			has_siv = true;
+		} else if (field_id == HEADER_FIELD_CDC) {
+			if (field_len != 8) {
+				throw Malformed();
+			}
+			if (!read_stored_be32(in, stored, min_chunk_size) || !read_stored_be32(in, stored, avg_chunk_size)) {
+				throw Malformed();
+			}
+			is_content_defined = true;
+		} else if (field_id == HEADER_FIELD_COMPRESSION) {
+			if (field_len != 4) {
+				throw Malformed();
+			}
+			uint32_t	algorithm;
+			if (!read_stored_be32(in, stored, algorithm)) {
+				throw Malformed();
+			}
+			if (algorithm != COMPRESSION_ZLIB) {
+				throw Incompatible();
+			}
+			compression = static_cast<Compression>(algorithm);
+		} else if (field_id == HEADER_FIELD_CIPHER) {
+			if (field_len != 4) {
+				throw Malformed();
+			}
+			uint32_t	suite;
+			if (!read_stored_be32(in, stored, suite)) {
+				throw Malformed();
+			}
+			if (suite != CIPHER_AES_256_GCM && suite != CIPHER_CHACHA20_POLY1305) {
+				throw Incompatible();
+			}
+			cipher = static_cast<Cipher>(suite);
+		} else if (field_id & 1) { // unknown critical field
+			throw Incompatible();
+		} else {
+			// unknown non-critical field - safe to ignore (but it's still authenticated)
+			if (field_len > MAX_FIELD_LEN) {
+				throw Malformed();
+			}
+			std::vector<unsigned char>	value(field_len + 1);
+			if (!read_stored(in, stored, &value[0], field_len)) {
+				throw Malformed();
+			}
+		}
+	}
+	if (is_content_defined && cipher != CIPHER_AES_CTR_HMAC_SHA1) {
+		throw Incompatible(); // not supported (yet) with content-defined chunking
+	}
+	if (is_content_defined) {
+		// Cdc_chunker needs at least 64 bytes to fill its hash, and 2 bits to spare
+		if (has_siv || min_chunk_size < 64 || min_chunk_size > avg_chunk_size || avg_chunk_size > chunk_size) {
+			throw Malformed();
+		}
+		if ((avg_chunk_size & (avg_chunk_size - 1)) != 0) {
+			throw Malformed();
+		}
+	} else if (!has_siv) {
+		throw Malformed();
+	}
+	return stored;
+}
+
+void		Chunked_header::store (std::ostream& out) const
+{
+	out.write("\0GITCRYPT\2", MAGIC_LEN);
+	store_fields(out, true);
+}
+
+std::string	Chunked_header::store_to_string () const
+{
+	std::ostringstream	out;
+	store(out);
+	return out.str();
+}
+
+std::string	Chunked_header::get_parameters () const
+{
+	std::ostringstream	out;
+	store_fields(out, false);
+	return out.str();
+}
+
+void		Chunked_header::store_fields (std::ostream& out, bool with_siv) const
+{
+	write_be32(out, HEADER_FIELD_KEY_VERSION);
+	write_be32(out, 4);
+	write_be32(out, key_version);
+
+	write_be32(out, HEADER_FIELD_CHUNK_SIZE);
+	write_be32(out, 4);
+	write_be32(out, chunk_size);
+
+	if (is_content_defined) {
+		write_be32(out, HEADER_FIELD_CDC);
+		write_be32(out, 8);
+		write_be32(out, min_chunk_size);
+		write_be32(out, avg_chunk_size);
+	} else if (with_siv) {
+		write_be32(out, HEADER_FIELD_SIV);
+		write_be32(out, sizeof(siv));
+		out.write(reinterpret_cast<const char*>(siv), sizeof(siv));
+	}
+
+	if (compression != COMPRESSION_NONE) {
+		write_be32(out, HEADER_FIELD_COMPRESSION);
+		write_be32(out, 4);
+		write_be32(out, compression);
+	}
+
+	if (cipher != CIPHER_AES_CTR_HMAC_SHA1) {
+		write_be32(out, HEADER_FIELD_CIPHER);
+		write_be32(out, 4);
+		write_be32(out, cipher);
+	}
+
+	write_be32(out, HEADER_FIELD_END);
+}
+
+Chunk_siv_state::Chunk_siv_state (const Key_file::Entry& key, const Chunked_header& header)
+{
+	if (header.cipher == Chunked_header::CIPHER_AES_CTR_HMAC_SHA1) {
+		// As in the original format, the synthetic IV is an HMAC of the file
+		unsigned char	siv_key[Hmac_sha1_state::LEN];
+		Chunk_cipher::get_siv_key(key, header, siv_key);
+		hmac.reset(new Hmac_sha1_state(siv_key, sizeof(siv_key)));
+		explicit_memset(siv_key, 0, sizeof(siv_key));
+	} else {
+		// The keys depend on the header's parameters, as with get_siv_key()
+		const std::string	parameters(header.get_parameters());
+		unsigned char		hash_key[Aead_siv_state::KEY_LEN];
+		unsigned char		prf_key[Aead_siv_state::KEY_LEN];
+		derive_key(key, "git-crypt chunk SIV hash key", parameters, hash_key, sizeof(hash_key));
+		derive_key(key, "git-crypt chunk SIV PRF key", parameters, prf_key, sizeof(prf_key));
+		aead_siv.reset(new Aead_siv_state(get_aead_algorithm(header.cipher), hash_key, prf_key));
+		explicit_memset(hash_key, 0, sizeof(hash_key));
+		explicit_memset(prf_key, 0, sizeof(prf_key));
+	}
+}
+
+Chunk_siv_state::~Chunk_siv_state ()
+{
+}
+
+void		Chunk_siv_state::add (const unsigned char* buffer, size_t buffer_len)
+{
+	if (hmac) {
+		hmac->add(buffer, buffer_len);
+	} else {
+		aead_siv->add(buffer, buffer_len);
+	}
+}
+
+void		Chunk_siv_state::get (unsigned char* siv)
+{
+	unsigned char		digest[Hmac_sha1_state::LEN];
+	if (hmac) {
+		hmac->get(digest);
+	} else {
+		aead_siv->get(digest);
+	}
+	std::memcpy(siv, digest, sizeof(Chunked_header::siv));
+}
+
+Chunk_cipher::Chunk_cipher (const Key_file::Entry& key, const Chunked_header& arg_header, const std::string& stored_header)
+: header(stored_header), chunk_size(arg_header.chunk_size), cipher(arg_header.cipher)
+{
+	std::memcpy(aes_key, key.aes_key, AES_KEY_LEN);
+	std::memcpy(siv, arg_header.siv, sizeof(siv));
+
+	static const char	mac_key_label[] = "git-crypt chunk MAC key";
+	Hmac_sha1_state		hmac(key.hmac_key, HMAC_KEY_LEN);
+	hmac.add(reinterpret_cast<const unsigned char*>(mac_key_label), sizeof(mac_key_label));
+	hmac.get(mac_key);
+
+	if (cipher == Chunked_header::CIPHER_AES_CTR_HMAC_SHA1) {
+		std::memset(aead_key, 0, sizeof(aead_key));
+		mac_len = Hmac_sha1_state::LEN;
+	} else {
+		unsigned char	be_cipher[4];
+		store_be32(be_cipher, cipher);
+		derive_key(key, "git-crypt chunk AEAD key", std::string(reinterpret_cast<char*>(be_cipher), sizeof(be_cipher)), aead_key, sizeof(aead_key));
+		mac_len = Aead_cipher::TAG_LEN;
+	}
+}
+
+Chunk_cipher::~Chunk_cipher ()
+{
+	explicit_memset(aes_key, 0, sizeof(aes_key));
+	explicit_memset(mac_key, 0, sizeof(mac_key));
+	explicit_memset(aead_key, 0, sizeof(aead_key));
+}
+
+std::unique_ptr<Aead_cipher> Chunk_cipher::new_aead () const
+{
+	std::unique_ptr<Aead_cipher>	aead;
+	if (cipher != Chunked_header::CIPHER_AES_CTR_HMAC_SHA1) {
+		aead.reset(new Aead_cipher(get_aead_algorithm(cipher), aead_key));
+	}
+	return aead;
+}
+
+void		Chunk_cipher::get_nonce (uint64_t index, unsigned char* nonce) const
+{
+	std::memcpy(nonce, siv, sizeof(siv));
+	for (int i = 0; i < 8; ++i) {
+		nonce[sizeof(siv) - 1 - i] ^= static_cast<unsigned char>(index >> (i * 8));
+	}
+}
+
+void		Chunk_cipher::get_position (uint64_t index, bool is_last, unsigned char* position) const
+{
+	store_be32(position, index >> 32);
+	store_be32(position + 4, index & 0xffffffff);
+	position[8] = is_last;
+}
+
+void		Chunk_cipher::get_mac (uint64_t index, bool is_last, const unsigned char* ciphertext, size_t len, unsigned char* mac) const
+{
+	unsigned char		position[9];
+	get_position(index, is_last, position);
+
+	Hmac_sha1_state		hmac(mac_key, sizeof(mac_key));
+	hmac.add(reinterpret_cast<const unsigned char*>(header.data()), header.size());
+	hmac.add(position, sizeof(position));
+	hmac.add(ciphertext, len);
+	hmac.get(mac);
+}
+
+void		Chunk_cipher::encrypt_chunk (Aead_cipher* aead, uint64_t index, bool is_last, const unsigned char* in, size_t len, unsigned char* out) const
+{
+	unsigned char		nonce[Aes_ctr_encryptor::NONCE_LEN];
+	get_nonce(index, nonce);
+
+	if (aead) {
+		// The tag covers the same things as the MAC: the header and the chunk's position
+		std::string	ad(header);
+		unsigned char	position[9];
+		get_position(index, is_last, position);
+		ad.append(reinterpret_cast<char*>(position), sizeof(position));
+		aead->encrypt(nonce, reinterpret_cast<const unsigned char*>(ad.data()), ad.size(), in, len, out, out + len);
+		return;
+	}
+
+	Aes_ctr_encryptor	aes(aes_key, nonce);
+	aes.process(in, out, len);
+	get_mac(index, is_last, out, len, out + len);
+}
+
+bool		Chunk_cipher::decrypt_chunk (Aead_cipher* aead, uint64_t index, bool is_last, const unsigned char* in, size_t len, unsigned char* out) const
+{
+	unsigned char		nonce[Aes_ctr_encryptor::NONCE_LEN];
+	get_nonce(index, nonce);
+
+	if (aead) {
+		std::string	ad(header);
+		unsigned char	position[9];
+		get_position(index, is_last, position);
+		ad.append(reinterpret_cast<char*>(position), sizeof(position));
+		return aead->decrypt(nonce, reinterpret_cast<const unsigned char*>(ad.data()), ad.size(), in, len, out, in + len);
+	}
+
+	unsigned char		mac[Hmac_sha1_state::LEN];
+	get_mac(index, is_last, in, len, mac);
+	if (!leakless_equals(mac, in + len, mac_len)) {
+		return false;
+	}
+
+	Aes_ctr_decryptor	aes(aes_key, nonce);
+	aes.process(in, out, len);
+	return true;
+}
+
+void		Chunk_cipher::encrypt_chunks (uint64_t first_index, size_t nbr_chunks, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, size_t begin, size_t end) const
+{
+	// An AEAD's context is reused for each of this thread's chunks
+	const std::unique_ptr<Aead_cipher>	aead(new_aead());
+	for (size_t i = begin; i < end; ++i) {
+		const size_t	offset = i * chunk_size;
+		encrypt_chunk(aead.get(), first_index + i, ends_file && i == nbr_chunks - 1,
+		              in + offset, std::min(chunk_size, len - offset),
+		              out + offset + i * mac_len);
+	}
+}
+
+void		Chunk_cipher::decrypt_chunks (uint64_t first_index, size_t nbr_chunks, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, size_t begin, size_t end, char* is_authentic) const
+{
+	const std::unique_ptr<Aead_cipher>	aead(new_aead());
+	const size_t	record_len = chunk_size + mac_len;
+	for (size_t i = begin; i < end; ++i) {
+		const size_t	offset = i * record_len;
+		is_authentic[i] = decrypt_chunk(aead.get(), first_index + i, ends_file && i == nbr_chunks - 1,
+		                                in + offset, std::min(record_len, len - offset) - mac_len,
+		                                out + i * chunk_size);
+	}
+}
+
+void		Chunk_cipher::encrypt (uint64_t first_index, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, Thread_pool* pool) const
+{
+	size_t		nbr_chunks = (len + chunk_size - 1) / chunk_size;
+	if (ends_file && nbr_chunks == 0) {
+		nbr_chunks = 1; // an empty file still has one (empty) chunk
+	} else if (!ends_file && len % chunk_size != 0) {
+		throw Crypto_error("Chunk_cipher::encrypt", "Partial chunk before the end of the file");
+	}
+
+	using namespace std::placeholders;
+	run_parallel(nbr_chunks, pool, std::bind(&Chunk_cipher::encrypt_chunks, this, first_index, nbr_chunks, ends_file, in, len, out, _1, _2));
+}
+
+bool		Chunk_cipher::decrypt (uint64_t first_index, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, size_t& out_len, Thread_pool* pool) const
+{
+	const size_t	record_len = chunk_size + mac_len;
+	size_t		nbr_chunks = (len + record_len - 1) / record_len;
+	if (ends_file && (nbr_chunks == 0 || len - (nbr_chunks - 1) * record_len < mac_len)) {
+		return false; // the last chunk is missing or too short to have a MAC
+	} else if (!ends_file && len % record_len != 0) {
+		return false; // the file ended in the middle of a chunk
+	}
+
+	std::vector<char>	is_authentic(nbr_chunks);
+	using namespace std::placeholders;
+	run_parallel(nbr_chunks, pool, std::bind(&Chunk_cipher::decrypt_chunks, this, first_index, nbr_chunks, ends_file, in, len, out, _1, _2, &is_authentic[0]));
+	if (std::find(is_authentic.begin(), is_authentic.end(), false) != is_authentic.end()) {
+		return false;
+	}
+	out_len = len - nbr_chunks * mac_len;
+	return true;
+}
+
+size_t		Chunk_cipher::get_encrypted_len (size_t len, bool ends_file) const
+{
+	size_t		nbr_chunks = (len + chunk_size - 1) / chunk_size;
+	if (ends_file && nbr_chunks == 0) {
+		nbr_chunks = 1;
+	}
+	return len + nbr_chunks * mac_len;
+}
+
+void		Chunk_cipher::get_siv_key (const Key_file::Entry& key, const Chunked_header& header, unsigned char* siv_key)
+{
+	// The key depends on the header's parameters, so that a file encrypted with
+	// different parameters (e.g. chunk sizes) never reuses a nonce
+	static const char	siv_key_label[] = "git-crypt chunk SIV key";
+	const std::string	parameters(header.get_parameters());
+	Hmac_sha1_state		hmac(key.hmac_key, HMAC_KEY_LEN);
+	hmac.add(reinterpret_cast<const unsigned char*>(siv_key_label), sizeof(siv_key_label));
+	hmac.add(reinterpret_cast<const unsigned char*>(parameters.data()), parameters.size());
+	hmac.get(siv_key);
+}
+
+Cdc_chunker::Cdc_chunker (const Key_file::Entry& key, const Chunked_header& header)
+: min_size(header.min_chunk_size), avg_size(header.avg_chunk_size), max_size(header.chunk_size)
+{
+	// The gear table is AES-CTR keystream, under a nonce derived from the header's
+	// parameters like a synthetic IV
+	static const char	gear_label[] = "git-crypt CDC gear table";
+	const std::string	parameters(header.get_parameters());
+	unsigned char		nonce[Hmac_sha1_state::LEN];
+	Hmac_sha1_state		hmac(key.hmac_key, HMAC_KEY_LEN);
+	hmac.add(reinterpret_cast<const unsigned char*>(gear_label), sizeof(gear_label));
+	hmac.add(reinterpret_cast<const unsigned char*>(parameters.data()), parameters.size());
+	hmac.get(nonce);
+
+	unsigned char		keystream[sizeof(gear)] = { 0 };
+	Aes_ctr_encryptor	aes(key.aes_key, nonce);
+	aes.process(keystream, keystream, sizeof(keystream));
+	for (size_t i = 0; i < 256; ++i) {
+		gear[i] = static_cast<uint64_t>(load_be32(keystream + i * 8)) << 32 | load_be32(keystream + i * 8 + 4);
+	}
+	explicit_memset(keystream, 0, sizeof(keystream));
+
+	unsigned int		avg_bits = 0;
+	while ((static_cast<size_t>(1) << avg_bits) < avg_size) {
+		++avg_bits;
+	}
+	small_shift = 64 - (avg_bits + 2);
+	large_shift = 64 - (avg_bits - 2);
+}
+
+Cdc_chunker::~Cdc_chunker ()
+{
+	explicit_memset(gear, 0, sizeof(gear));
+}
+
+size_t		Cdc_chunker::find_boundary (const unsigned char* p, size_t len) const
+{
+	if (len <= min_size) {
+		return len;
+	}
+	len = std::min(len, max_size);
+
+	// The hash only depends on the last 64 bytes, so boundaries are found in the
+	// same places no matter where the chunk started (once it's min_size long)
+	uint64_t	hash = 0;
+	size_t		i = min_size;
+	for (const size_t normal_len = std::min(len, avg_size); i < normal_len; ++i) {
+		hash = (hash << 1) + gear[p[i]];
+		if ((hash >> small_shift) == 0) {
+			return i + 1;
+		}
+	}
+	for (; i < len; ++i) {
+		hash = (hash << 1) + gear[p[i]];
+		if ((hash >> large_shift) == 0) {
+			return i + 1;
+		}
+	}
+	return len;
+}
+
+Cdc_cipher::Cdc_cipher (const Key_file::Entry& key, const Chunked_header& header, const std::string& stored_header)
+{
+	std::memcpy(aes_key, key.aes_key, AES_KEY_LEN);
+	Chunk_cipher::get_siv_key(key, header, siv_key);
+
+	static const char	trailer_key_label[] = "git-crypt CDC trailer key";
+	unsigned char		trailer_key[Hmac_sha1_state::LEN];
+	Hmac_sha1_state		hmac(key.hmac_key, HMAC_KEY_LEN);
+	hmac.add(reinterpret_cast<const unsigned char*>(trailer_key_label), sizeof(trailer_key_label));
+	hmac.get(trailer_key);
+	trailer_hmac.reset(new Hmac_sha1_state(trailer_key, sizeof(trailer_key)));
+	explicit_memset(trailer_key, 0, sizeof(trailer_key));
+
+	trailer_hmac->add(reinterpret_cast<const unsigned char*>(stored_header.data()), stored_header.size());
+}
+
+Cdc_cipher::~Cdc_cipher ()
+{
+	explicit_memset(aes_key, 0, sizeof(aes_key));
+	explicit_memset(siv_key, 0, sizeof(siv_key));
+}
+
+void		Cdc_cipher::encrypt_chunk (const unsigned char* in, size_t len, unsigned char* out) const
+{
+	unsigned char* const	tag = out + 4;
+	Hmac_sha1_state		hmac(siv_key, sizeof(siv_key));
+	hmac.add(in, len);
+	hmac.get(tag);
+
+	store_be32(out, len);
+	Aes_ctr_encryptor	aes(aes_key, tag);
+	aes.process(in, out + CHUNK_HEADER_LEN, len);
+}
+
+bool		Cdc_cipher::decrypt_chunk (const unsigned char* in, size_t len, unsigned char* out) const
+{
+	const unsigned char*	tag = in + 4;
+	Aes_ctr_decryptor	aes(aes_key, tag);
+	aes.process(in + CHUNK_HEADER_LEN, out, len);
+
+	unsigned char		digest[Hmac_sha1_state::LEN];
+	Hmac_sha1_state		hmac(siv_key, sizeof(siv_key));
+	hmac.add(out, len);
+	hmac.get(digest);
+	return leakless_equals(digest, tag, TAG_LEN);
+}
+
+void		Cdc_cipher::encrypt_chunks (const std::vector<size_t>* in_offsets, const std::vector<size_t>* chunk_lens, const unsigned char* in, unsigned char* out, size_t begin, size_t end) const
+{
+	for (size_t i = begin; i < end; ++i) {
+		const size_t	in_offset = (*in_offsets)[i];
+		encrypt_chunk(in + in_offset, (*chunk_lens)[i], out + in_offset + i * CHUNK_HEADER_LEN);
+	}
+}
+
+void		Cdc_cipher::decrypt_chunks (const std::vector<size_t>* out_offsets, const std::vector<size_t>* chunk_lens, const unsigned char* in, unsigned char* out, size_t begin, size_t end, char* is_authentic) const
+{
+	for (size_t i = begin; i < end; ++i) {
+		const size_t	out_offset = (*out_offsets)[i];
+		is_authentic[i] = decrypt_chunk(in + out_offset + i * CHUNK_HEADER_LEN, (*chunk_lens)[i], out + out_offset);
+	}
+}
+
+void		Cdc_cipher::add_to_trailer (const unsigned char* chunks, const std::vector<size_t>& chunk_lens)
+{
+	for (std::vector<size_t>::const_iterator len(chunk_lens.begin()); len != chunk_lens.end(); ++len) {
+		trailer_hmac->add(chunks, CHUNK_HEADER_LEN);
+		chunks += CHUNK_HEADER_LEN + *len;
+	}
+}
+
+void		Cdc_cipher::encrypt (const unsigned char* in, const std::vector<size_t>& chunk_lens, unsigned char* out, Thread_pool* pool)
+{
+	std::vector<size_t>	offsets(get_offsets(chunk_lens));
+	using namespace std::placeholders;
+	run_parallel(chunk_lens.size(), pool, std::bind(&Cdc_cipher::encrypt_chunks, this, &offsets, &chunk_lens, in, out, _1, _2));
+	add_to_trailer(out, chunk_lens);
+}
+
+bool		Cdc_cipher::decrypt (const unsigned char* in, const std::vector<size_t>& chunk_lens, unsigned char* out, Thread_pool* pool)
+{
+	std::vector<size_t>	offsets(get_offsets(chunk_lens));
+	std::vector<char>	is_authentic(chunk_lens.size());
+	using namespace std::placeholders;
+	run_parallel(chunk_lens.size(), pool, std::bind(&Cdc_cipher::decrypt_chunks, this, &offsets, &chunk_lens, in, out, _1, _2, is_authentic.empty() ? 0 : &is_authentic[0]));
+	if (std::find(is_authentic.begin(), is_authentic.end(), false) != is_authentic.end()) {
+		return false;
+	}
+	add_to_trailer(in, chunk_lens);
+	return true;
+}
+
+std::vector<size_t>	Cdc_cipher::get_offsets (const std::vector<size_t>& chunk_lens)
+{
+	std::vector<size_t>	offsets;
+	size_t			offset = 0;
+	offsets.reserve(chunk_lens.size());
+	for (std::vector<size_t>::const_iterator len(chunk_lens.begin()); len != chunk_lens.end(); ++len) {
+		offsets.push_back(offset);
+		offset += *len;
+	}
+	return offsets;
+}
+
+size_t		Cdc_cipher::get_encrypted_len (const std::vector<size_t>& chunk_lens)
+{
+	size_t			len = 0;
+	for (std::vector<size_t>::const_iterator chunk_len(chunk_lens.begin()); chunk_len != chunk_lens.end(); ++chunk_len) {
+		len += CHUNK_HEADER_LEN + *chunk_len;
+	}
+	return len;
+}
+
+void		Cdc_cipher::get_trailer_mac (unsigned char* mac)
+{
+	trailer_hmac->get(mac);
+}
+
+bool		Cdc_cipher::check_trailer_mac (const unsigned char* mac)
+{
+	unsigned char		digest[MAC_LEN];
+	trailer_hmac->get(digest);
+	return leakless_equals(digest, mac, MAC_LEN);
+}
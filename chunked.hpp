@@ -0,0 +1,271 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_CHUNKED_HPP
+#define GIT_CRYPT_CHUNKED_HPP
+
+#include "crypto.hpp"
+#include "key.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <memory>
+
+// The chunked encrypted file format.  Unlike the original format, which encrypts
+// and authenticates a file as a whole, it splits the file into chunks which are
+// encrypted and authenticated separately, so they can be decrypted in parallel and
+// written out as soon as they've been verified.  An encrypted file consists of:
+//
+//	"\0GITCRYPT\2"		(the original format starts with "\0GITCRYPT\0")
+//	header fields		id, length and value of each field, ending with HEADER_FIELD_END
+//	chunks			chunk_size bytes of ciphertext (less for the last chunk, which is
+//				empty if the file is), each followed by its MAC (or AEAD tag)
+//
+// so chunk i is at a fixed offset.  Like the original format, encryption is
+// deterministic: chunk i is encrypted with AES-CTR using a synthetic IV (an HMAC of
+// the whole file) XORed with i as its nonce.  A chunk's MAC is an HMAC of the header,
+// the chunk's index, whether it's the last chunk, and its ciphertext, so chunks can't
+// be altered, reordered, moved between files or truncated without detection.
+//
+// With content-defined chunking (see Cdc_chunker and Cdc_cipher), chunks are instead
+// between min_chunk_size and chunk_size bytes long, and the chunks are followed by a
+// trailer.  The header then has no synthetic IV, since each chunk has its own.
+//
+// With compression, the file is compressed before being split into fixed-size chunks,
+// or each content-defined chunk is compressed separately, so the chunks (and the
+// synthetic IVs) are of compressed data.
+//
+// The header can select a faster cipher suite for fixed-size chunks, in which the
+// synthetic IV is computed with Aead_siv_state, and each chunk is encrypted with an
+// AEAD (AES-256-GCM or ChaCha20-Poly1305) whose tag takes the place of the MAC.
+struct Chunked_header {
+	enum {
+		MAGIC_LEN		= 10,
+		DEFAULT_CHUNK_SIZE	= 1048576,
+		MAX_CHUNK_SIZE		= 1<<26,
+		// defaults for content-defined chunking
+		DEFAULT_MIN_CHUNK_SIZE	= 65536,
+		DEFAULT_AVG_CHUNK_SIZE	= 262144
+	};
+	enum Compression {
+		COMPRESSION_NONE	= 0,
+		COMPRESSION_ZLIB	= 1
+	};
+	enum Cipher {
+		CIPHER_AES_CTR_HMAC_SHA1	= 0,	// the default
+		CIPHER_AES_256_GCM		= 1,
+		CIPHER_CHACHA20_POLY1305	= 2
+	};
+
+	uint32_t		key_version;
+	uint32_t		chunk_size;		// the maximum, with content-defined chunking
+	unsigned char		siv[Aes_ctr_encryptor::NONCE_LEN];
+	bool			is_content_defined;
+	uint32_t		min_chunk_size;		// only with content-defined chunking
+	uint32_t		avg_chunk_size;		// ditto; a power of 2
+	Compression		compression;
+	Cipher			cipher;
+
+	struct Malformed { }; // exception class
+	struct Incompatible { }; // exception class
+
+	Chunked_header ();
+
+	// load() reads the header fields, after the magic has already been read, and
+	// returns the header as it was stored (including the magic)
+	std::string		load (std::istream&);
+	void			store (std::ostream&) const;
+	std::string		store_to_string () const;
+
+	// The header fields, minus the synthetic IV, which determine how the file is encrypted
+	std::string		get_parameters () const;
+
+private:
+	void			store_fields (std::ostream&, bool with_siv) const;
+
+	enum {
+		HEADER_FIELD_END		= 0,
+		HEADER_FIELD_KEY_VERSION	= 1,
+		HEADER_FIELD_CHUNK_SIZE		= 3,
+		HEADER_FIELD_SIV		= 5,
+		HEADER_FIELD_CDC		= 7,	// min and average chunk size
+		HEADER_FIELD_COMPRESSION	= 9,
+		HEADER_FIELD_CIPHER		= 11
+	};
+	enum {
+		MAX_FIELD_LEN		= 1<<20
+	};
+};
+
+// Computes the synthetic IV of a file with fixed-size chunks, using the header's cipher suite
+class Chunk_siv_state {
+	std::unique_ptr<Hmac_sha1_state>	hmac;
+	std::unique_ptr<Aead_siv_state>		aead_siv;
+
+				Chunk_siv_state (const Chunk_siv_state&);	// Disallow copy
+	Chunk_siv_state&	operator= (const Chunk_siv_state&);	// Disallow assignment
+public:
+	Chunk_siv_state (const Key_file::Entry& key, const Chunked_header& header);
+	~Chunk_siv_state ();
+
+	void			add (const unsigned char* buffer, size_t buffer_len);
+	void			get (unsigned char* siv);	// writes sizeof(Chunked_header::siv) bytes
+};
+
+// Encrypts and decrypts the chunks of one file.  Each chunk is independent of
+// the others, so runs of chunks are split between a thread pool's threads.
+class Chunk_cipher {
+	unsigned char		aes_key[AES_KEY_LEN];
+	unsigned char		mac_key[Hmac_sha1_state::LEN];
+	unsigned char		aead_key[Aead_cipher::KEY_LEN];	// with an AEAD cipher suite
+	unsigned char		siv[Aes_ctr_encryptor::NONCE_LEN];
+	std::string		header;
+	size_t			chunk_size;
+	Chunked_header::Cipher	cipher;
+	size_t			mac_len;	// or tag length, with an AEAD
+
+	std::unique_ptr<Aead_cipher> new_aead () const;
+	void			get_nonce (uint64_t index, unsigned char* nonce) const;
+	void			get_position (uint64_t index, bool is_last, unsigned char* position) const;
+	void			get_mac (uint64_t index, bool is_last, const unsigned char* ciphertext, size_t len, unsigned char* mac) const;
+	void			encrypt_chunk (Aead_cipher* aead, uint64_t index, bool is_last, const unsigned char* in, size_t len, unsigned char* out) const;
+	bool			decrypt_chunk (Aead_cipher* aead, uint64_t index, bool is_last, const unsigned char* in, size_t len, unsigned char* out) const;
+	void			encrypt_chunks (uint64_t first_index, size_t nbr_chunks, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, size_t begin, size_t end) const;
+	void			decrypt_chunks (uint64_t first_index, size_t nbr_chunks, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, size_t begin, size_t end, char* is_authentic) const;
+
+				Chunk_cipher (const Chunk_cipher&);	// Disallow copy
+	Chunk_cipher&		operator= (const Chunk_cipher&);	// Disallow assignment
+public:
+	// stored_header is the header as stored in the file, which every chunk's MAC covers
+	Chunk_cipher (const Key_file::Entry& key, const Chunked_header& header, const std::string& stored_header);
+	~Chunk_cipher ();
+
+	// Encrypt len bytes of plaintext, which are the chunks of the file starting with
+	// chunk number first_index, and reach the end of the file if ends_file.  Every
+	// chunk but the last must be chunk_size long.  Writes get_encrypted_len(len, ends_file)
+	// bytes to out, which must not overlap in.  pool, if not null, is used to encrypt
+	// runs of chunks in parallel.
+	void			encrypt (uint64_t first_index, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, Thread_pool* pool) const;
+
+	// The reverse of encrypt(): verify and decrypt len bytes of encrypted chunks,
+	// writing their plaintext to out and its length to out_len.  Returns false if
+	// a chunk is malformed or has been tampered with, in which case out must not be used.
+	bool			decrypt (uint64_t first_index, bool ends_file, const unsigned char* in, size_t len, unsigned char* out, size_t& out_len, Thread_pool* pool) const;
+
+	size_t			get_encrypted_len (size_t len, bool ends_file) const;
+
+	// Get the key with which to HMAC a file's plaintext (or a chunk's, with content-defined
+	// chunking) to get its synthetic IV, with the default cipher suite
+	static void		get_siv_key (const Key_file::Entry& key, const Chunked_header& header, unsigned char* siv_key);
+};
+
+// Finds content-defined chunk boundaries using FastCDC's gear hash, with normalized
+// chunking, so that an edit to a file only changes the chunks around it.  The gear
+// table is derived from the key, so that the chunk lengths, which are visible in the
+// encrypted file, don't reveal the positions of known content.
+class Cdc_chunker {
+	uint64_t		gear[256];
+	size_t			min_size;
+	size_t			avg_size;
+	size_t			max_size;
+	unsigned int		small_shift;	// before avg_size, a boundary needs more zero bits...
+	unsigned int		large_shift;	// ...than after it
+
+				Cdc_chunker (const Cdc_chunker&);	// Disallow copy
+	Cdc_chunker&		operator= (const Cdc_chunker&);	// Disallow assignment
+public:
+	Cdc_chunker (const Key_file::Entry& key, const Chunked_header& header);
+	~Cdc_chunker ();
+
+	// Get the length of the chunk starting at p.  If len is less than the maximum
+	// chunk size, the data must reach the end of the file.
+	size_t			find_boundary (const unsigned char* p, size_t len) const;
+};
+
+// Encrypts and decrypts the chunks of a file with content-defined chunking.  Each
+// chunk is stored as its length (4 bytes), its TAG_LEN-byte tag and its ciphertext.
+// The tag is an HMAC of the chunk's plaintext, and the first bytes of the tag are
+// the nonce with which it's encrypted, so a chunk is encrypted the same way wherever
+// it appears, and unchanged parts of a file encrypt to the same ciphertext.  Since
+// the tags don't depend on the chunks' positions, the trailer, which is TRAILER_MARKER
+// (4 bytes) followed by an HMAC of the header and every chunk's length and tag, protects
+// the order and number of chunks.  Chunks are verified before being decrypted into
+// the output, but the trailer can only be checked after every chunk has been decrypted.
+class Cdc_cipher {
+public:
+	enum {
+		TAG_LEN		= Hmac_sha1_state::LEN,
+		MAC_LEN		= Hmac_sha1_state::LEN,
+		CHUNK_HEADER_LEN = 4 + TAG_LEN
+	};
+	static const uint32_t	TRAILER_MARKER = 0xffffffff;
+
+private:
+	unsigned char		aes_key[AES_KEY_LEN];
+	unsigned char		siv_key[Hmac_sha1_state::LEN];
+	std::unique_ptr<Hmac_sha1_state> trailer_hmac;
+
+	void			encrypt_chunk (const unsigned char* in, size_t len, unsigned char* out) const;
+	bool			decrypt_chunk (const unsigned char* in, size_t len, unsigned char* out) const;
+	void			encrypt_chunks (const std::vector<size_t>* in_offsets, const std::vector<size_t>* chunk_lens, const unsigned char* in, unsigned char* out, size_t begin, size_t end) const;
+	void			decrypt_chunks (const std::vector<size_t>* out_offsets, const std::vector<size_t>* chunk_lens, const unsigned char* in, unsigned char* out, size_t begin, size_t end, char* is_authentic) const;
+	void			add_to_trailer (const unsigned char* chunks, const std::vector<size_t>& chunk_lens);
+
+	// the offset of each chunk's plaintext
+	static std::vector<size_t> get_offsets (const std::vector<size_t>& chunk_lens);
+
+				Cdc_cipher (const Cdc_cipher&);	// Disallow copy
+	Cdc_cipher&		operator= (const Cdc_cipher&);	// Disallow assignment
+public:
+	Cdc_cipher (const Key_file::Entry& key, const Chunked_header& header, const std::string& stored_header);
+	~Cdc_cipher ();
+
+	// Encrypt consecutive chunks of plaintext, of the given lengths, writing them to out,
+	// which must not overlap in and have room for get_encrypted_len() bytes.  The chunks
+	// must be the file's next ones.  pool, if not null, is used to encrypt runs of chunks
+	// in parallel.
+	void			encrypt (const unsigned char* in, const std::vector<size_t>& chunk_lens, unsigned char* out, Thread_pool* pool);
+
+	// The reverse of encrypt(): verify and decrypt consecutive chunks as stored (with
+	// their lengths and tags), writing their plaintext to out.  Returns false if a
+	// chunk has been tampered with, in which case out must not be used.
+	bool			decrypt (const unsigned char* in, const std::vector<size_t>& chunk_lens, unsigned char* out, Thread_pool* pool);
+
+	static size_t		get_encrypted_len (const std::vector<size_t>& chunk_lens);
+
+	// Get the MAC_LEN-byte MAC which follows TRAILER_MARKER in the trailer, after encrypt()ing
+	// every chunk, or check it after decrypt()ing every chunk
+	void			get_trailer_mac (unsigned char* mac);
+	bool			check_trailer_mac (const unsigned char* mac);
+};
+
+#endif
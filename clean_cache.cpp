@@ -0,0 +1,125 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "clean_cache.hpp"
+#include "ls_files.hpp"
+#include <istream>
+#include <ostream>
+#include <cstdlib>
+
+// The cache is a sequence of NUL-terminated fields:
+//  "git-crypt clean cache 1"
+//  followed by <path> <size> <mtime> <ctime> <inode> <device> <key id> <nonce> for each entry
+static const char	CLEAN_CACHE_VERSION[] = "git-crypt clean cache 1";
+
+const Clean_cache::Entry*	Clean_cache::get (const std::string& path) const
+{
+	Map::const_iterator	it(entries.find(path));
+	return it != entries.end() ? &it->second : nullptr;
+}
+
+void		Clean_cache::set (const std::string& path, const Entry& entry)
+{
+	entries[path] = entry;
+	is_modified = true;
+}
+
+void		Clean_cache::remove (const std::string& path)
+{
+	if (entries.erase(path)) {
+		is_modified = true;
+	}
+}
+
+static bool	read_number (Nul_record_reader& reader, uint64_t& number)
+{
+	Byte_span		field;
+	if (!reader.next(field) || field.empty()) {
+		return false;
+	}
+	const std::string	str(field.str());
+	char*			end;
+	number = std::strtoull(str.c_str(), &end, 10);
+	return *end == '\0';
+}
+
+bool		Clean_cache::load (std::istream& in)
+{
+	Nul_record_reader	reader(in);
+	Byte_span		field;
+
+	if (!reader.next(field) || !field.equals(CLEAN_CACHE_VERSION)) {
+		return false;
+	}
+
+	entries.clear();
+	while (reader.next(field)) {
+		const std::string	path(field.str());
+		Entry			entry;
+		uint64_t		mtime_ns;
+		uint64_t		ctime_ns;
+		if (!read_number(reader, entry.stamp.size) ||
+				!read_number(reader, mtime_ns) ||
+				!read_number(reader, ctime_ns) ||
+				!read_number(reader, entry.stamp.inode) ||
+				!read_number(reader, entry.stamp.device)) {
+			return false;
+		}
+		entry.stamp.mtime_ns = mtime_ns;
+		entry.stamp.ctime_ns = ctime_ns;
+		if (!reader.next(field)) {
+			return false;
+		}
+		entry.key_id = field.str();
+		if (!reader.next(field)) {
+			return false;
+		}
+		entry.nonce = field.str();
+		entries[path] = entry;
+	}
+	is_modified = false;
+	return !in.bad();
+}
+
+void		Clean_cache::store (std::ostream& out) const
+{
+	out << CLEAN_CACHE_VERSION << '\0';
+	for (Map::const_iterator it(entries.begin()); it != entries.end(); ++it) {
+		const Entry&	entry = it->second;
+		out << it->first << '\0'
+		    << entry.stamp.size << '\0'
+		    << static_cast<uint64_t>(entry.stamp.mtime_ns) << '\0'
+		    << static_cast<uint64_t>(entry.stamp.ctime_ns) << '\0'
+		    << entry.stamp.inode << '\0'
+		    << entry.stamp.device << '\0'
+		    << entry.key_id << '\0'
+		    << entry.nonce << '\0';
+	}
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_CLEAN_CACHE_HPP
+#define GIT_CRYPT_CLEAN_CACHE_HPP
+
+#include "util.hpp"
+#include <string>
+#include <map>
+#include <iosfwd>
+
+// A record of the files which the filter process has encrypted, so that a file which
+// Git asks it to clean again (e.g. after a `touch` or checkout makes its stat information
+// look changed) needn't be read through HMAC and AES again.  Since the encryption is
+// deterministic, the nonce is enough to identify the encrypted file.
+//
+// An entry is only valid while the file's stamp is unchanged, and for the key it was
+// encrypted with.  The cache is stored under $GIT_DIR/git-crypt/clean-cache, where
+// only the current user can read it.
+class Clean_cache {
+public:
+	struct Entry {
+		File_stamp	stamp;		// of the file in the working tree when it was encrypted
+		std::string	key_id;		// identifies the key used
+		std::string	nonce;		// in hex
+	};
+
+private:
+	typedef std::map<std::string, Entry> Map;
+	Map			entries;	// by path, relative to the top of the working tree
+	bool			is_modified;
+
+public:
+	Clean_cache () : is_modified(false) { }
+
+	// Returns null if there's no entry for path
+	const Entry*		get (const std::string& path) const;
+	void			set (const std::string& path, const Entry&);
+	void			remove (const std::string& path);
+
+	// True if the cache has changed since it was loaded
+	bool			has_changed () const { return is_modified; }
+
+	// Returns false if the cache is malformed or in an unknown format
+	bool			load (std::istream&);
+	void			store (std::ostream&) const;
+};
+
+#endif
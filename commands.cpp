@@ -35,7 +35,20 @@
 #include "gpg.hpp"
 #include "parse_options.hpp"
 #include "coprocess.hpp"
+#include "cat_file.hpp"
+#include "pkt_line.hpp"
+#include "thread_pool.hpp"
+#include "multiplexer.hpp"
+#include "attributes.hpp"
+#include "ls_files.hpp"
+#include "manifest.hpp"
+#include "clean_cache.hpp"
+#include "plaintext_cache.hpp"
+#include "chunked.hpp"
+#include "check_attr.hpp"
+#include "compress.hpp"
 #include <unistd.h>
+#include <sys/stat.h>
 #include <stdint.h>
 #include <algorithm>
 #include <string>
@@ -50,11 +63,32 @@
 #include <errno.h>
 #include <exception>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <map>
+#include <set>
+#include <list>
+#include <deque>
+#include <cstdlib>
+#include <ctime>
+#include <limits>
 
 enum {
 	// # of arguments per git checkout call; must be large enough to be efficient but small
 	// enough to avoid operating system limits on argument length
-	GIT_CHECKOUT_BATCH_SIZE = 100
+	GIT_CHECKOUT_BATCH_SIZE = 100,
+
+	// Files at least this large are encrypted/decrypted using multiple threads
+	PARALLEL_CRYPT_MIN_BYTES = 8388608,
+	// # of bytes per thread to encrypt/decrypt at a time when using multiple threads
+	PARALLEL_CRYPT_CHUNK_SIZE = 4194304,
+	// ...but no more than this many bytes in total, however many threads there are
+	PARALLEL_CRYPT_MAX_BATCH_SIZE = 33554432,
+	// Upper limit on git-crypt.threads
+	MAX_CRYPT_THREADS = 64
 };
 
 static std::string attribute_name (const char* key_name)
@@ -96,13 +130,13 @@ static std::vector<int> parse_version (const std::string& str)
 	return version;
 }
 
-static const std::vector<int>& git_version ()
+const std::vector<int>& git_version ()
 {
 	static const std::vector<int> version(parse_version(git_version_string()));
 	return version;
 }
 
-static std::vector<int> make_version (int a, int b, int c)
+std::vector<int> make_version (int a, int b, int c)
 {
 	std::vector<int>	version;
 	version.push_back(a);
@@ -111,33 +145,82 @@ static std::vector<int> make_version (int a, int b, int c)
 	return version;
 }
 
-static void git_config (const std::string& name, const std::string& value)
+// Section and variable names are case-insensitive, but subsection names aren't
+// (if name_has_variable is false, name is just a section and optional subsection)
+static std::string normalize_git_config_name (const std::string& name, bool name_has_variable =true)
+{
+	std::string			normalized(name);
+	const std::string::size_type	section_end = std::min(name.find('.'), name.size());
+	const std::string::size_type	variable_pos = name_has_variable ? name.rfind('.') : std::string::npos;
+	for (std::string::size_type i = 0; i < normalized.size(); ++i) {
+		if (i < section_end || (variable_pos != std::string::npos && i > variable_pos)) {
+			normalized[i] = std::tolower(static_cast<unsigned char>(normalized[i]));
+		}
+	}
+	return normalized;
+}
+
+typedef std::map<std::string, std::vector<std::string> > Git_config_map;
+
+static Git_config_map read_git_config ()
 {
+	// git config --list -z
 	std::vector<std::string>	command;
 	command.push_back("git");
 	command.push_back("config");
-	command.push_back(name);
-	command.push_back(value);
+	command.push_back("--list");
+	command.push_back("-z");
 
-	if (!successful_exit(exec_command(command))) {
+	std::stringstream		output;
+	if (!successful_exit(exec_command(command, output))) {
 		throw Error("'git config' failed");
 	}
+
+	// Output looks like (w/o newlines, except the one following the name):
+	// filter.git-crypt.required\ntrue\0
+	// An entry has no newline if it has no value (e.g. "[section] name" with no "= value")
+	Git_config_map			config;
+	std::string			entry;
+	while (std::getline(output, entry, '\0')) {
+		const std::string::size_type	newline_pos = entry.find('\n');
+		if (newline_pos == std::string::npos) {
+			config[normalize_git_config_name(entry)].push_back("");
+		} else {
+			config[normalize_git_config_name(entry.substr(0, newline_pos))].push_back(entry.substr(newline_pos + 1));
+		}
+	}
+	return config;
 }
 
-static bool git_has_config (const std::string& name)
+// All of Git's configuration, read with a single `git config` process the first time it's
+// needed.  Changes made by git_config() and git_deconfig() are applied to it as well.
+static Git_config_map& git_config_snapshot ()
+{
+	static Git_config_map	config(read_git_config());
+	return config;
+}
+
+static void git_config (const std::string& name, const std::string& value)
 {
 	std::vector<std::string>	command;
 	command.push_back("git");
 	command.push_back("config");
-	command.push_back("--get-all");
 	command.push_back(name);
+	command.push_back(value);
 
-	std::stringstream		output;
-	switch (exit_status(exec_command(command, output))) {
-		case 0:  return true;
-		case 1:  return false;
-		default: throw Error("'git config' failed");
+	if (!successful_exit(exec_command(command))) {
+		throw Error("'git config' failed");
 	}
+
+	std::vector<std::string>&	values = git_config_snapshot()[normalize_git_config_name(name)];
+	values.clear();
+	values.push_back(value);
+}
+
+static bool git_has_config (const std::string& name)
+{
+	const Git_config_map&		config = git_config_snapshot();
+	return config.find(normalize_git_config_name(name)) != config.end();
 }
 
 static void git_deconfig (const std::string& name)
@@ -151,24 +234,50 @@ static void git_deconfig (const std::string& name)
 	if (!successful_exit(exec_command(command))) {
 		throw Error("'git config' failed");
 	}
+
+	// Remove section.subsection.variable, but not section.subsection.with.dots.variable
+	Git_config_map&			config = git_config_snapshot();
+	const std::string		prefix(normalize_git_config_name(name, false) + '.');
+	for (Git_config_map::iterator it(config.lower_bound(prefix)); it != config.end() && it->first.compare(0, prefix.size(), prefix) == 0; ) {
+		if (it->first.find('.', prefix.size()) == std::string::npos) {
+			config.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+// Git passes the file's path as %f, so clean can choose the file's format
+static std::string clean_filter_command (const char* key_name)
+{
+	std::string	command(escape_shell_arg(our_exe_path()) + " clean");
+	if (key_name) {
+		// Note: key_name contains only shell-safe characters so it need not be escaped.
+		command += std::string(" --key-name=") + key_name;
+	}
+	return command + " --path=%f";
 }
 
 static void configure_git_filters (const char* key_name)
 {
 	std::string	escaped_git_crypt_path(escape_shell_arg(our_exe_path()));
 
+	// Git 2.11 and higher use the long-running filter process if it's configured,
+	// and older versions use the smudge and clean commands.
 	if (key_name) {
 		// Note: key_name contains only shell-safe characters so it need not be escaped.
 		git_config(std::string("filter.git-crypt-") + key_name + ".smudge",
 		           escaped_git_crypt_path + " smudge --key-name=" + key_name);
-		git_config(std::string("filter.git-crypt-") + key_name + ".clean",
-		           escaped_git_crypt_path + " clean --key-name=" + key_name);
+		git_config(std::string("filter.git-crypt-") + key_name + ".clean", clean_filter_command(key_name));
+		git_config(std::string("filter.git-crypt-") + key_name + ".process",
+		           escaped_git_crypt_path + " filter-process --key-name=" + key_name);
 		git_config(std::string("filter.git-crypt-") + key_name + ".required", "true");
 		git_config(std::string("diff.git-crypt-") + key_name + ".textconv",
 		           escaped_git_crypt_path + " diff --key-name=" + key_name);
 	} else {
 		git_config("filter.git-crypt.smudge", escaped_git_crypt_path + " smudge");
-		git_config("filter.git-crypt.clean", escaped_git_crypt_path + " clean");
+		git_config("filter.git-crypt.clean", clean_filter_command(0));
+		git_config("filter.git-crypt.process", escaped_git_crypt_path + " filter-process");
 		git_config("filter.git-crypt.required", "true");
 		git_config("diff.git-crypt.textconv", escaped_git_crypt_path + " diff");
 	}
@@ -179,6 +288,7 @@ static void deconfigure_git_filters (const char* key_name)
 	// deconfigure the git-crypt filters
 	if (git_has_config("filter." + attribute_name(key_name) + ".smudge") ||
 			git_has_config("filter." + attribute_name(key_name) + ".clean") ||
+			git_has_config("filter." + attribute_name(key_name) + ".process") ||
 			git_has_config("filter." + attribute_name(key_name) + ".required")) {
 
 		git_deconfig("filter." + attribute_name(key_name));
@@ -214,6 +324,28 @@ static bool git_checkout_batch (std::vector<std::string>::const_iterator paths_b
 
 static bool git_checkout (const std::vector<std::string>& paths)
 {
+	if (paths.empty()) {
+		return true;
+	}
+
+	if (git_version() >= make_version(2, 25, 0)) {
+		// In Git 2.25 (released 13 Jan 2020) and higher, we pass all the paths to a single
+		// `git checkout` process on its stdin, instead of running `git checkout` once for
+		// every GIT_CHECKOUT_BATCH_SIZE paths (each of which has to load the index).
+		std::vector<std::string>	command;
+		command.push_back("git");
+		command.push_back("checkout");
+		command.push_back("--pathspec-from-file=-");
+		command.push_back("--pathspec-file-nul");
+
+		std::string			pathspecs;
+		for (std::vector<std::string>::const_iterator path(paths.begin()); path != paths.end(); ++path) {
+			pathspecs += *path;
+			pathspecs.push_back('\0');
+		}
+		return successful_exit(exec_command_with_input(command, pathspecs.data(), pathspecs.size()));
+	}
+
 	auto paths_begin(paths.begin());
 	while (paths.end() - paths_begin >= GIT_CHECKOUT_BATCH_SIZE) {
 		if (!git_checkout_batch(paths_begin, paths_begin + GIT_CHECKOUT_BATCH_SIZE)) {
@@ -237,25 +369,71 @@ static void validate_key_name_or_throw (const char* key_name)
 	}
 }
 
-static std::string get_internal_state_path ()
+// Facts about the repository which don't change while git-crypt runs
+struct Repo_context {
+	std::string	git_dir;	// `git rev-parse --git-dir`
+	std::string	git_common_dir;	// `git rev-parse --git-common-dir` (same as git_dir prior to Git 2.5)
+	std::string	toplevel;	// `git rev-parse --show-toplevel` (empty for a bare repo)
+	std::string	path_to_top;	// `git rev-parse --show-cdup`
+	std::string	prefix;		// `git rev-parse --show-prefix`
+};
+
+static bool read_repo_context (Repo_context& context, bool with_work_tree)
 {
-	// git rev-parse --git-dir
+	const bool			has_common_dir = git_version() >= make_version(2, 5, 0);
+
+	// git rev-parse --git-dir [--git-common-dir] [--show-toplevel --show-cdup --show-prefix]
 	std::vector<std::string>	command;
 	command.push_back("git");
 	command.push_back("rev-parse");
 	command.push_back("--git-dir");
+	if (has_common_dir) {
+		command.push_back("--git-common-dir");
+	}
+	if (with_work_tree) {
+		command.push_back("--show-toplevel");
+		command.push_back("--show-cdup");
+		command.push_back("--show-prefix");
+	}
 
 	std::stringstream		output;
-
 	if (!successful_exit(exec_command(command, output))) {
+		return false;
+	}
+
+	std::getline(output, context.git_dir);
+	if (has_common_dir) {
+		std::getline(output, context.git_common_dir);
+	} else {
+		context.git_common_dir = context.git_dir;
+	}
+	if (with_work_tree) {
+		std::getline(output, context.toplevel);
+		std::getline(output, context.path_to_top);
+		std::getline(output, context.prefix);
+	}
+	return true;
+}
+
+static Repo_context read_repo_context ()
+{
+	// Newer versions of Git fail --show-toplevel in a bare repo, so try again without it
+	Repo_context			context;
+	if (!read_repo_context(context, true) && !read_repo_context(context, false)) {
 		throw Error("'git rev-parse --git-dir' failed - is this a Git repository?");
 	}
+	return context;
+}
 
-	std::string			path;
-	std::getline(output, path);
-	path += "/git-crypt";
+static const Repo_context& repo_context ()
+{
+	static const Repo_context	context(read_repo_context());
+	return context;
+}
 
-	return path;
+static std::string get_internal_state_path ()
+{
+	return repo_context().git_dir + "/git-crypt";
 }
 
 static std::string get_internal_keys_path (const std::string& internal_state_path)
@@ -277,43 +455,45 @@ static std::string get_internal_key_path (const char* key_name)
 	return path;
 }
 
-std::string get_git_config (const std::string& name)
+// returns the # of threads to use for encrypting/decrypting large files
+static unsigned int get_crypt_threads ()
 {
-	// git config --get
-	std::vector<std::string>	command;
-	command.push_back("git");
-	command.push_back("config");
-	command.push_back("--get");
-	command.push_back(name);
-
-	std::stringstream	output;
+	static unsigned int	threads = 0;
 
-	if (!successful_exit(exec_command(command, output))) {
-		throw Error("'git config' missing value for key '" + name +"'");
+	if (threads == 0) {
+		try {
+			threads = std::max(std::atoi(get_git_config("git-crypt.threads").c_str()), 0);
+		} catch (const Error&) {
+			// git-crypt.threads not set
+		}
+		if (threads == 0) {
+			threads = std::max(std::thread::hardware_concurrency(), 1U);
+		}
+		threads = std::min<unsigned int>(threads, MAX_CRYPT_THREADS);
 	}
-
-	std::string		value;
-	std::getline(output, value);
-
-	return value;
+	return threads;
 }
 
-static std::string get_repo_state_path ()
+// returns the # of bytes to encrypt/decrypt at a time using the given # of threads
+static size_t get_crypt_batch_size (unsigned int threads)
 {
-	// git rev-parse --show-toplevel
-	std::vector<std::string>	command;
-	command.push_back("git");
-	command.push_back("rev-parse");
-	command.push_back("--show-toplevel");
-
-	std::stringstream		output;
+	return std::min<size_t>(threads * PARALLEL_CRYPT_CHUNK_SIZE, PARALLEL_CRYPT_MAX_BATCH_SIZE);
+}
 
-	if (!successful_exit(exec_command(command, output))) {
-		throw Error("'git rev-parse --show-toplevel' failed - is this a Git repository?");
+std::string get_git_config (const std::string& name)
+{
+	// like `git config --get`, which returns the last value if there are several
+	const Git_config_map&		config = git_config_snapshot();
+	const Git_config_map::const_iterator it(config.find(normalize_git_config_name(name)));
+	if (it == config.end() || it->second.empty()) {
+		throw Error("'git config' missing value for key '" + name +"'");
 	}
+	return it->second.back();
+}
 
-	std::string			path;
-	std::getline(output, path);
+static std::string get_repo_state_path ()
+{
+	std::string			path(repo_context().toplevel);
 
 	if (path.empty()) {
 		// could happen for a bare repo
@@ -347,276 +527,1006 @@ static std::string get_repo_keys_path ()
 
 static std::string get_path_to_top ()
 {
-	// git rev-parse --show-cdup
-	std::vector<std::string>	command;
-	command.push_back("git");
-	command.push_back("rev-parse");
-	command.push_back("--show-cdup");
+	return repo_context().path_to_top;
+}
 
-	std::stringstream		output;
+// Convert a path relative to the current directory, as output by `git ls-files`,
+// into one relative to the top of the working tree
+static std::string get_path_from_top (const std::string& path)
+{
+	std::string			path_from_top(repo_context().prefix);
+	std::string::size_type		pos = 0;
+	while (path.compare(pos, 3, "../") == 0 && !path_from_top.empty()) {
+		// "a/b/" -> "a/"
+		path_from_top.erase(path_from_top.rfind('/', path_from_top.size() - 2) + 1);
+		pos += 3;
+	}
+	path_from_top.append(path, pos, std::string::npos);
+	return path_from_top;
+}
 
-	if (!successful_exit(exec_command(command, output))) {
-		throw Error("'git rev-parse --show-cdup' failed - is this a Git repository?");
+// The inverse of get_path_from_top(): the path as `git ls-files` would print it
+static std::string get_path_from_cwd (const std::string& path_from_top)
+{
+	const std::string&		prefix(repo_context().prefix);
+	std::string::size_type		common_len = 0;
+	for (std::string::size_type i = 0; i < prefix.size() && i < path_from_top.size() && prefix[i] == path_from_top[i]; ++i) {
+		if (prefix[i] == '/') {
+			common_len = i + 1;
+		}
+	}
+
+	std::string			path;
+	for (std::string::size_type i = common_len; i < prefix.size(); ++i) {
+		if (prefix[i] == '/') {
+			path += "../";
+		}
 	}
+	path.append(path_from_top, common_len, std::string::npos);
+	return path;
+}
+
+// A file in the index, as listed by `git ls-files -s`
+struct Index_entry {
+	std::string	mode;
+	std::string	object_id;
+	std::string	stage;
+	std::string	path;
+};
 
-	std::string			path_to_top;
-	std::getline(output, path_to_top);
+typedef std::map<std::string, std::vector<Index_entry> > Files_by_attribute;
 
-	return path_to_top;
+static Index_entry make_index_entry (const Ls_files_record& record)
+{
+	Index_entry	entry;
+	entry.mode = record.mode.str();
+	entry.object_id = record.object_id.str();
+	entry.stage = record.stage.str();
+	entry.path = record.path.str();
+	return entry;
 }
 
-static void get_git_status (std::ostream& output)
+// Get the status of the encrypted files, as classified by get_encrypted_files()
+static void get_git_status (std::ostream& output, const Files_by_attribute& files_by_attribute)
 {
-	// git status -uno --porcelain
+	// git status -uno --porcelain [-- :(top,attr:filter=git-crypt) ...]
 	std::vector<std::string>	command;
 	command.push_back("git");
 	command.push_back("status");
 	command.push_back("-uno"); // don't show untracked files
 	command.push_back("--porcelain");
 
+	if (git_version() >= make_version(2, 13, 0)) {
+		// In Git 2.13 (released 9 May 2017) and higher, we limit `git status` to the files
+		// which have a git-crypt filter attribute, so it doesn't have to stat every file in
+		// the working tree.  (Neither `git status` nor `git diff-index` can read pathspecs
+		// from a file, so we can't just pass the list of encrypted files.)
+		if (files_by_attribute.empty()) {
+			return;
+		}
+		command.push_back("--");
+		for (Files_by_attribute::const_iterator it(files_by_attribute.begin()); it != files_by_attribute.end(); ++it) {
+			command.push_back(":(top,attr:filter=" + it->first + ")");
+		}
+	}
+
 	if (!successful_exit(exec_command(command, output))) {
 		throw Error("'git status' failed - is this a Git repository?");
 	}
 }
 
-// returns filter and diff attributes as a pair
-static std::pair<std::string, std::string> get_file_attributes (const std::string& filename)
+// `git check-attr` outputs these for attributes which aren't set to a value
+static std::string attribute_value (const std::string& value)
 {
-	// git check-attr filter diff -- filename
-	std::vector<std::string>	command;
-	command.push_back("git");
-	command.push_back("check-attr");
-	command.push_back("filter");
-	command.push_back("diff");
-	command.push_back("--");
-	command.push_back(filename);
+	if (value == "unspecified" || value == "unset" || value == "set") {
+		return "";
+	}
+	return value;
+}
 
-	std::stringstream		output;
-	if (!successful_exit(exec_command(command, output))) {
-		throw Error("'git check-attr' failed - is this a Git repository?");
-	}
-
-	std::string			filter_attr;
-	std::string			diff_attr;
-
-	std::string			line;
-	// Example output:
-	// filename: filter: git-crypt
-	// filename: diff: git-crypt
-	while (std::getline(output, line)) {
-		// filename might contain ": ", so parse line backwards
-		// filename: attr_name: attr_value
-		//         ^name_pos  ^value_pos
-		const std::string::size_type	value_pos(line.rfind(": "));
-		if (value_pos == std::string::npos || value_pos == 0) {
-			continue;
-		}
-		const std::string::size_type	name_pos(line.rfind(": ", value_pos - 1));
-		if (name_pos == std::string::npos) {
-			continue;
-		}
+static bool is_false (const std::string& value)
+{
+	// like git_parse_maybe_bool()
+	std::string			lower(value);
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	return lower.empty() || lower == "false" || lower == "no" || lower == "off" || lower == "0";
+}
 
-		const std::string		attr_name(line.substr(name_pos + 2, value_pos - (name_pos + 2)));
-		const std::string		attr_value(line.substr(value_pos + 2));
+enum Attributes_file_status {
+	ATTRIBUTES_FILE_MISSING,
+	ATTRIBUTES_FILE_READ,
+	ATTRIBUTES_FILE_UNSUPPORTED	// a symlink in the working tree (which Git ignores), or unreadable
+};
 
-		if (attr_value != "unspecified" && attr_value != "unset" && attr_value != "set") {
-			if (attr_name == "filter") {
-				filter_attr = attr_value;
-			} else if (attr_name == "diff") {
-				diff_attr = attr_value;
-			}
-		}
+static Attributes_file_status read_attributes_file (const std::string& path, bool is_in_tree, std::string& contents)
+{
+	struct stat			status;
+	if ((is_in_tree ? lstat(path.c_str(), &status) : stat(path.c_str(), &status)) == -1) {
+		return errno == ENOENT || errno == ENOTDIR ? ATTRIBUTES_FILE_MISSING : ATTRIBUTES_FILE_UNSUPPORTED;
+	}
+	if (!S_ISREG(status.st_mode)) {
+		return ATTRIBUTES_FILE_UNSUPPORTED;
 	}
 
-	return std::make_pair(filter_attr, diff_attr);
+	std::ifstream			in(path.c_str(), std::fstream::binary);
+	std::stringstream		buffer;
+	buffer << in.rdbuf();
+	if (!in) {
+		return ATTRIBUTES_FILE_UNSUPPORTED;
+	}
+	contents = buffer.str();
+	return ATTRIBUTES_FILE_READ;
 }
 
-// returns filter and diff attributes as a pair
-static std::pair<std::string, std::string> get_file_attributes (const std::string& filename, std::ostream& check_attr_stdin, std::istream& check_attr_stdout)
+// Appends an attributes file to digest_input: its name, then whether it was read (in which
+// case its contents follow), missing, or left to the index
+static void add_to_attributes_digest (std::string& digest_input, const std::string& name, char how, const std::string& contents)
 {
-	check_attr_stdin << filename << '\0' << std::flush;
-
-	std::string			filter_attr;
-	std::string			diff_attr;
-
-	// Example output:
-	// filename\0filter\0git-crypt\0filename\0diff\0git-crypt\0
-	for (int i = 0; i < 2; ++i) {
-		std::string		filename;
-		std::string		attr_name;
-		std::string		attr_value;
-		std::getline(check_attr_stdout, filename, '\0');
-		std::getline(check_attr_stdout, attr_name, '\0');
-		std::getline(check_attr_stdout, attr_value, '\0');
+	std::ostringstream		header;
+	header << name << '\0' << how << contents.size() << '\0';
+	digest_input += header.str();
+	digest_input += contents;
+}
 
-		if (attr_value != "unspecified" && attr_value != "unset" && attr_value != "set") {
-			if (attr_name == "filter") {
-				filter_attr = attr_value;
-			} else if (attr_name == "diff") {
-				diff_attr = attr_value;
-			}
-		}
+// Adds an attributes file from outside the working tree to matcher (which may be null)
+// and digest_input, if it exists.  Returns false if matcher can't handle it.
+// The file is identified in the digest by name, which unlike path mustn't depend on
+// the current directory.
+static bool add_attributes_file (Attribute_matcher* matcher, std::string& digest_input, Attribute_matcher::Level level, const std::string& path, const std::string& name)
+{
+	std::string			contents;
+	switch (read_attributes_file(path, false, contents)) {
+	case ATTRIBUTES_FILE_MISSING:
+		add_to_attributes_digest(digest_input, name, 'M', contents);
+		return true;
+	case ATTRIBUTES_FILE_READ:
+		add_to_attributes_digest(digest_input, name, 'F', contents);
+		return !matcher || matcher->add_file(level, "", contents);
+	default:
+		return false;
 	}
+}
 
-	return std::make_pair(filter_attr, diff_attr);
+// Reads the given path from the index, using stage 2 ("ours") during a conflicted merge
+static bool read_attributes_blob (Cat_file_batch& cat_file, const std::string& path, std::string& contents)
+{
+	if (!cat_file.open(":0:" + path) && !cat_file.open(":2:" + path)) {
+		return false;
+	}
+	contents.clear();
+	char				buffer[8192];
+	size_t				len;
+	while ((len = cat_file.read(buffer, sizeof(buffer))) > 0) {
+		contents.append(buffer, len);
+	}
+	return true;
 }
 
-static bool check_if_blob_is_encrypted (const std::string& object_id)
+// Returns the system-wide attributes file, or an empty string if there's no way to tell
+static std::string get_system_attributes_path ()
 {
-	// git cat-file blob object_id
+	if (git_version() >= make_version(2, 42, 0)) {
+		// git var GIT_ATTR_SYSTEM
+		std::vector<std::string>	command;
+		command.push_back("git");
+		command.push_back("var");
+		command.push_back("GIT_ATTR_SYSTEM");
+
+		std::stringstream		output;
+		std::string			path;
+		if (successful_exit(exec_command(command, output))) {
+			std::getline(output, path);
+		}
+		return path;
+	}
 
+	// Older versions don't say, but a Git installed under /usr uses /etc/gitattributes
 	std::vector<std::string>	command;
 	command.push_back("git");
-	command.push_back("cat-file");
-	command.push_back("blob");
-	command.push_back(object_id);
+	command.push_back("--exec-path");
 
-	// TODO: do this more efficiently - don't read entire command output into buffer, only read what we need
 	std::stringstream		output;
-	if (!successful_exit(exec_command(command, output))) {
-		throw Error("'git cat-file' failed - is this a Git repository?");
+	std::string			exec_path;
+	if (successful_exit(exec_command(command, output))) {
+		std::getline(output, exec_path);
 	}
-
-	char				header[10];
-	output.read(header, sizeof(header));
-	return output.gcount() == sizeof(header) && std::memcmp(header, "\0GITCRYPT\0", 10) == 0;
+	if (exec_path == "/usr/lib/git-core" || exec_path == "/usr/libexec/git-core") {
+		return "/etc/gitattributes";
+	}
+	return "";
 }
 
-static bool check_if_file_is_encrypted (const std::string& filename)
+// Returns the per-user attributes file, or an empty string if there isn't one
+// or it's specified in a way we don't understand (in which case is_supported is set to false)
+static std::string get_global_attributes_path (bool& is_supported)
 {
-	// git ls-files -sz filename
-	std::vector<std::string>	command;
-	command.push_back("git");
-	command.push_back("ls-files");
-	command.push_back("-sz");
-	command.push_back("--");
-	command.push_back(filename);
+	is_supported = true;
+	const char*			home = std::getenv("HOME");
 
-	std::stringstream		output;
-	if (!successful_exit(exec_command(command, output))) {
-		throw Error("'git ls-files' failed - is this a Git repository?");
+	if (git_has_config("core.attributesFile")) {
+		const std::string	path(get_git_config("core.attributesFile"));
+		if (path.compare(0, 2, "~/") == 0 && home) {
+			return home + path.substr(1);
+		}
+		if (path.empty() || path[0] != '/') {
+			// ~user/, %(prefix)/, or relative
+			is_supported = false;
+		}
+		return path;
 	}
 
-	if (output.peek() == -1) {
-		return false;
+	const char*			xdg_config_home = std::getenv("XDG_CONFIG_HOME");
+	if (xdg_config_home && *xdg_config_home) {
+		return std::string(xdg_config_home) + "/git/attributes";
 	}
+	if (home) {
+		return std::string(home) + "/.config/git/attributes";
+	}
+	return "";
+}
 
-	std::string			mode;
-	std::string			object_id;
-	output >> mode >> object_id;
-
-	return check_if_blob_is_encrypted(object_id);
+// Every directory containing one of the given paths (relative to the top of the working
+// tree), and their parents.  These are the directories whose .gitattributes apply.
+static std::set<std::string> get_attributes_dirs (const std::vector<std::string>& paths_from_top)
+{
+	std::set<std::string>		dirs;
+	dirs.insert("");
+	for (std::vector<std::string>::const_iterator path(paths_from_top.begin()); path != paths_from_top.end(); ++path) {
+		std::string::size_type	slash = path->rfind('/');
+		while (slash != std::string::npos && slash != 0 && dirs.insert(path->substr(0, slash)).second) {
+			slash = path->rfind('/', slash - 1);
+		}
+	}
+	return dirs;
 }
 
-static bool is_git_file_mode (const std::string& mode)
+// Loads the attributes files which Git would consult into matcher, one directory at a time,
+// so that a path can be matched as soon as the directories containing it have been loaded.
+// Methods return false if matcher can't evaluate the files exactly like Git would, in which
+// case `git check-attr` must be used instead.
+//
+// The loader also computes a digest of the attributes files, for telling whether a Manifest
+// is still current.  Files which come from the index aren't read into the digest, since they
+// can't change without the index checksum changing too, so matcher may be null to compute
+// just the digest without running `git cat-file`.
+class Attributes_loader {
+	Attribute_matcher*			matcher;
+	std::string				path_to_top;
+	std::unique_ptr<Cat_file_batch>		cat_file;		// started when first needed
+	std::string				global_digest_input;	// system-wide and per-user files
+	std::map<std::string, std::string>	dir_digest_inputs;	// by directory, once loaded
+	std::string				info_digest_input;
+
+				Attributes_loader (const Attributes_loader&);	// Disallow copy
+	Attributes_loader&	operator= (const Attributes_loader&);	// Disallow assignment
+public:
+	explicit		Attributes_loader (Attribute_matcher* matcher);
+
+	// Loads the system-wide, per-user and $GIT_DIR/info/attributes files
+	bool			load_global ();
+
+	// Loads the .gitattributes of dir (relative to the top of the working tree, "" for the top),
+	// unless it's already loaded
+	bool			load_dir (const std::string& dir);
+
+	// Loads the .gitattributes of every directory containing path_from_top (see get_attributes_dirs())
+	bool			load_dirs_of (const std::string& path_from_top);
+
+	// Gets the directories loaded so far, and the digest of their attributes files along with
+	// the global ones.  Directories are digested in sorted order, whatever order they were loaded in.
+	void			get_dirs (std::vector<std::string>& dirs) const;
+	std::string		get_digest () const;
+
+	void			close ();
+};
+
+Attributes_loader::Attributes_loader (Attribute_matcher* arg_matcher)
+: matcher(arg_matcher), path_to_top(get_path_to_top())
 {
-	return (std::strtoul(mode.c_str(), nullptr, 8) & 0170000) == 0100000;
 }
 
-static void get_encrypted_files (std::vector<std::string>& files, const char* key_name)
+bool			Attributes_loader::load_global ()
 {
-	// git ls-files -cz -- path_to_top
-	std::vector<std::string>	ls_files_command;
-	ls_files_command.push_back("git");
-	ls_files_command.push_back("ls-files");
-	ls_files_command.push_back("-csz");
-	ls_files_command.push_back("--");
-	const std::string		path_to_top(get_path_to_top());
-	if (!path_to_top.empty()) {
-		ls_files_command.push_back(path_to_top);
+	if (std::getenv("GIT_ATTR_SOURCE") || git_has_config("attr.tree")) {
+		return false;
+	}
+	if (git_has_config("core.ignoreCase") && !is_false(get_git_config("core.ignoreCase"))) {
+		return false;
 	}
 
-	Coprocess			ls_files;
-	std::istream*			ls_files_stdout = ls_files.stdout_pipe();
-	ls_files.spawn(ls_files_command);
-
-	Coprocess			check_attr;
-	std::ostream*			check_attr_stdin = nullptr;
-	std::istream*			check_attr_stdout = nullptr;
-	if (git_version() >= make_version(1, 8, 5)) {
-		// In Git 1.8.5 (released 27 Nov 2013) and higher, we use a single `git check-attr` process
-		// to get the attributes of all files at once.  In prior versions, we have to fork and exec
-		// a separate `git check-attr` process for each file, since -z and --stdin aren't supported.
-		// In a repository with thousands of files, this results in an almost 100x speedup.
-		std::vector<std::string>	check_attr_command;
-		check_attr_command.push_back("git");
-		check_attr_command.push_back("check-attr");
-		check_attr_command.push_back("--stdin");
-		check_attr_command.push_back("-z");
-		check_attr_command.push_back("filter");
-		check_attr_command.push_back("diff");
-
-		check_attr_stdin = check_attr.stdin_pipe();
-		check_attr_stdout = check_attr.stdout_pipe();
-		check_attr.spawn(check_attr_command);
-	}
-
-	while (ls_files_stdout->peek() != -1) {
-		std::string		mode;
-		std::string		object_id;
-		std::string		stage;
-		std::string		filename;
-		*ls_files_stdout >> mode >> object_id >> stage >> std::ws;
-		std::getline(*ls_files_stdout, filename, '\0');
-
-		if (is_git_file_mode(mode)) {
-			std::string	filter_attribute;
-
-			if (check_attr_stdin) {
-				filter_attribute = get_file_attributes(filename, *check_attr_stdin, *check_attr_stdout).first;
-			} else {
-				filter_attribute = get_file_attributes(filename).first;
-			}
-
-			if (filter_attribute == attribute_name(key_name)) {
-				files.push_back(filename);
-			}
+	const char*			no_system = std::getenv("GIT_ATTR_NOSYSTEM");
+	if (!no_system || is_false(no_system)) {
+		const std::string	system_path(get_system_attributes_path());
+		if (system_path.empty()) {
+			return false;
+		}
+		if (!add_attributes_file(matcher, global_digest_input, Attribute_matcher::GLOBAL, system_path, system_path)) {
+			return false;
 		}
 	}
 
-	if (!successful_exit(ls_files.wait())) {
-		throw Error("'git ls-files' failed - is this a Git repository?");
+	bool				global_path_is_supported;
+	const std::string		global_path(get_global_attributes_path(global_path_is_supported));
+	if (!global_path_is_supported) {
+		return false;
 	}
-
-	if (check_attr_stdin) {
-		check_attr.close_stdin();
-		if (!successful_exit(check_attr.wait())) {
-			throw Error("'git check-attr' failed - is this a Git repository?");
+	if (!global_path.empty()) {
+		if (!add_attributes_file(matcher, global_digest_input, Attribute_matcher::GLOBAL, global_path, global_path)) {
+			return false;
 		}
 	}
+
+	// The matcher applies INFO rules last however early they're added
+	return add_attributes_file(matcher, info_digest_input, Attribute_matcher::INFO, repo_context().git_common_dir + "/info/attributes", "info/attributes");
 }
 
-static void load_key (Key_file& key_file, const char* key_name, const char* key_path =0, const char* legacy_path =0)
+bool			Attributes_loader::load_dir (const std::string& dir)
 {
-	if (legacy_path) {
-		std::ifstream		key_file_in(legacy_path, std::fstream::binary);
-		if (!key_file_in) {
-			throw Error(std::string("Unable to open key file: ") + legacy_path);
+	if (dir_digest_inputs.count(dir)) {
+		return true;
+	}
+	std::string&			digest_input = dir_digest_inputs[dir];
+
+	// Like `git check-attr`, prefer the working tree's .gitattributes, and fall back to the index's
+	const std::string		path_from_top(dir.empty() ? ".gitattributes" : dir + "/.gitattributes");
+	std::string			contents;
+	switch (read_attributes_file(path_to_top + path_from_top, true, contents)) {
+	case ATTRIBUTES_FILE_MISSING:
+		if (path_from_top.find('\n') != std::string::npos) {
+			return false;
 		}
-		key_file.load_legacy(key_file_in);
-	} else if (key_path) {
-		std::ifstream		key_file_in(key_path, std::fstream::binary);
-		if (!key_file_in) {
-			throw Error(std::string("Unable to open key file: ") + key_path);
+		add_to_attributes_digest(digest_input, path_from_top, 'I', std::string());
+		if (!matcher) {
+			return true;
 		}
-		key_file.load(key_file_in);
-	} else {
-		std::ifstream		key_file_in(get_internal_key_path(key_name).c_str(), std::fstream::binary);
-		if (!key_file_in) {
-			// TODO: include key name in error message
-			throw Error("Unable to open key file - have you unlocked/initialized this repository yet?");
+		if (!cat_file) {
+			cat_file.reset(new Cat_file_batch);
 		}
-		key_file.load(key_file_in);
+		if (!read_attributes_blob(*cat_file, path_from_top, contents)) {
+			return true;
+		}
+		break;
+	case ATTRIBUTES_FILE_READ:
+		add_to_attributes_digest(digest_input, path_from_top, 'F', contents);
+		break;
+	case ATTRIBUTES_FILE_UNSUPPORTED:
+		return false;
 	}
+	return !matcher || matcher->add_file(Attribute_matcher::DIRECTORY, dir, contents);
 }
 
-static bool decrypt_repo_key (Key_file& key_file, const char* key_name, uint32_t key_version, const std::vector<std::string>& secret_keys, const std::string& keys_path)
+bool			Attributes_loader::load_dirs_of (const std::string& path_from_top)
 {
-	std::exception_ptr gpg_error;
-
-	for (std::vector<std::string>::const_iterator seckey(secret_keys.begin()); seckey != secret_keys.end(); ++seckey) {
-		std::ostringstream		path_builder;
-		path_builder << keys_path << '/' << (key_name ? key_name : "default") << '/' << key_version << '/' << *seckey << ".gpg";
+	if (!load_dir("")) {
+		return false;
+	}
+	// Once a directory is loaded, so are its parents
+	std::string::size_type		slash = path_from_top.rfind('/');
+	while (slash != std::string::npos && slash != 0) {
+		const std::string	dir(path_from_top, 0, slash);
+		if (dir_digest_inputs.count(dir)) {
+			break;
+		}
+		if (!load_dir(dir)) {
+			return false;
+		}
+		slash = path_from_top.rfind('/', slash - 1);
+	}
+	return true;
+}
+
+void			Attributes_loader::get_dirs (std::vector<std::string>& dirs) const
+{
+	dirs.clear();
+	for (std::map<std::string, std::string>::const_iterator dir(dir_digest_inputs.begin()); dir != dir_digest_inputs.end(); ++dir) {
+		dirs.push_back(dir->first);
+	}
+}
+
+std::string		Attributes_loader::get_digest () const
+{
+	static const char		digest_key[] = "git-crypt attributes digest";
+	Hmac_sha1_state			digest_state(reinterpret_cast<const unsigned char*>(digest_key), sizeof(digest_key) - 1);
+	digest_state.add(reinterpret_cast<const unsigned char*>(global_digest_input.data()), global_digest_input.size());
+	for (std::map<std::string, std::string>::const_iterator dir(dir_digest_inputs.begin()); dir != dir_digest_inputs.end(); ++dir) {
+		digest_state.add(reinterpret_cast<const unsigned char*>(dir->second.data()), dir->second.size());
+	}
+	digest_state.add(reinterpret_cast<const unsigned char*>(info_digest_input.data()), info_digest_input.size());
+
+	unsigned char			digest_bytes[Hmac_sha1_state::LEN];
+	digest_state.get(digest_bytes);
+	return hex_encode(digest_bytes, sizeof(digest_bytes));
+}
+
+void			Attributes_loader::close ()
+{
+	if (cat_file) {
+		cat_file->close();
+		cat_file.reset();
+	}
+}
+
+// Loads every attributes file which Git would consult for paths in the given directories
+// (see get_attributes_dirs()) into matcher.  Returns false if matcher can't evaluate them
+// exactly like Git would.  If digest is non-null, it's set to the Attributes_loader digest.
+static bool load_attribute_matcher (Attribute_matcher* matcher, const std::set<std::string>& dirs, std::string* digest =0)
+{
+	Attributes_loader		loader(matcher);
+	if (!loader.load_global()) {
+		return false;
+	}
+	for (std::set<std::string>::const_iterator dir(dirs.begin()); dir != dirs.end(); ++dir) {
+		if (!loader.load_dir(*dir)) {
+			return false;
+		}
+	}
+	loader.close();
+
+	if (digest) {
+		*digest = loader.get_digest();
+	}
+	return true;
+}
+
+// Returns the checksum at the end of the index, which changes whenever the index does,
+// or an empty string if there's no checksum to go by
+static std::string get_index_checksum ()
+{
+	if (std::getenv("GIT_INDEX_FILE")) {
+		// A temporary index (e.g. during `git commit -a`) isn't worth caching
+		return "";
+	}
+
+	// The checksum is the last 20 or 32 bytes, depending on the hash algorithm.  Rather than
+	// asking which it is, take 32 bytes, which covers both.  With index.skipHash, it's zero.
+	unsigned char			trailer[32];
+	std::ifstream			in((repo_context().git_dir + "/index").c_str(), std::fstream::binary);
+	in.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end);
+	in.read(reinterpret_cast<char*>(trailer), sizeof(trailer));
+	if (!in) {
+		return "";
+	}
+
+	static const unsigned char	zeros[20] = { 0 };
+	if (std::memcmp(trailer + sizeof(trailer) - sizeof(zeros), zeros, sizeof(zeros)) == 0) {
+		return "";
+	}
+	return hex_encode(trailer, sizeof(trailer));
+}
+
+static std::string get_manifest_path ()
+{
+	return get_internal_state_path() + "/manifest";
+}
+
+static bool load_manifest (Manifest& manifest)
+{
+	std::ifstream			in(get_manifest_path().c_str(), std::fstream::binary);
+	return in && manifest.load(in);
+}
+
+// The manifest is only a cache, so failing to save it isn't an error
+static void save_manifest (const Manifest& manifest)
+{
+	if (access(get_internal_state_path().c_str(), F_OK) != 0) {
+		// Don't create $GIT_DIR/git-crypt in a repository that isn't using git-crypt
+		return;
+	}
+
+	std::ostringstream		out;
+	manifest.store(out);
+	const std::string		data(out.str());
+	try {
+		replace_file(get_manifest_path(), data.data(), data.size(), false);
+	} catch (const System_error&) {
+	}
+}
+
+// Returns true if the manifest's classification of the index is still current
+static bool is_manifest_current (const Manifest& manifest, const std::string& index_checksum)
+{
+	if (index_checksum.empty() || manifest.index_checksum != index_checksum) {
+		return false;
+	}
+	const std::set<std::string>	dirs(manifest.attributes_dirs.begin(), manifest.attributes_dirs.end());
+	std::string			attributes_digest;
+	return load_attribute_matcher(nullptr, dirs, &attributes_digest) && attributes_digest == manifest.attributes_digest;
+}
+
+static Manifest::Entry make_manifest_entry (const std::string& attribute, const std::string& mode, const std::string& object_id, const std::string& stage, const std::string& path_from_top)
+{
+	Manifest::Entry	entry;
+	entry.attribute = attribute;
+	entry.mode = mode;
+	entry.object_id = object_id;
+	entry.stage = stage;
+	entry.path = path_from_top;
+	entry.blob_status = Manifest::BLOB_UNCHECKED;
+	return entry;
+}
+
+static Index_entry make_index_entry (const Manifest::Entry& manifest_entry)
+{
+	Index_entry	entry;
+	entry.mode = manifest_entry.mode;
+	entry.object_id = manifest_entry.object_id;
+	entry.stage = manifest_entry.stage;
+	entry.path = get_path_from_cwd(manifest_entry.path);
+	return entry;
+}
+
+// Whether blobs are encrypted, by object ID, as already checked by `git-crypt status`
+typedef std::map<std::string, Manifest::Blob_status> Blob_statuses;
+
+static Blob_statuses get_blob_statuses (const Manifest& manifest)
+{
+	Blob_statuses			blob_statuses;
+	for (std::vector<Manifest::Entry>::const_iterator entry(manifest.entries.begin()); entry != manifest.entries.end(); ++entry) {
+		if (entry->blob_status != Manifest::BLOB_UNCHECKED) {
+			blob_statuses[entry->object_id] = entry->blob_status;
+		}
+	}
+	return blob_statuses;
+}
+
+static void copy_blob_statuses (Manifest& manifest, const Blob_statuses& blob_statuses)
+{
+	for (std::vector<Manifest::Entry>::iterator entry(manifest.entries.begin()); entry != manifest.entries.end(); ++entry) {
+		Blob_statuses::const_iterator	status(blob_statuses.find(entry->object_id));
+		if (status != blob_statuses.end()) {
+			entry->blob_status = status->second;
+		}
+	}
+}
+
+// Lists files with `git ls-files -cotsz` (or -csz) along with their filter and diff attributes.
+//
+// Usually the attributes are evaluated in-process by Attribute_matcher, loading each
+// directory's .gitattributes the first time a file under it is listed, so each file is
+// returned as soon as ls-files outputs it.  If the matcher can't handle an attributes file,
+// `git check-attr` is used for that file and every later one instead.  (The files listed
+// before then were matched correctly, since every attributes file applying to them had
+// been loaded.)
+//
+// Check_attr_batch uses a single `git check-attr` process for all the files in Git 1.8.5
+// (released 27 Nov 2013) and higher, which in a repository with thousands of files is
+// almost 100x faster than forking and execing one for each file like prior versions need.
+class Attributed_file_lister {
+public:
+	struct File {
+		std::string	tag;		// only with -t
+		std::string	mode;		// empty for untracked files
+		std::string	object_id;	// empty for untracked files
+		std::string	stage;		// empty for untracked files
+		std::string	path;
+		std::string	filter_attr;
+		std::string	diff_attr;
+	};
+
+private:
+	bool				has_tags;
+	Coprocess			ls_files;
+	Nul_record_reader		ls_files_output;
+	bool				is_listed;		// ls-files has finished
+	Attribute_matcher		matcher;
+	Attributes_loader		attributes_loader;
+	bool				is_using_matcher;	// false once matcher has given up
+	std::unique_ptr<Check_attr_batch> check_attr;		// started when matcher gives up
+
+	void		get_check_attr_attributes (File&);
+
+			Attributed_file_lister (const Attributed_file_lister&);	// Disallow copy
+	Attributed_file_lister& operator= (const Attributed_file_lister&);	// Disallow assignment
+public:
+	// ls_files_command must use -z and -s, and -t if has_tags is true
+	Attributed_file_lister (const std::vector<std::string>& ls_files_command, bool has_tags);
+
+	// Returns false once every file has been listed
+	bool		next (File&);
+
+	// Throws an Error if check-attr failed
+	void		close ();
+
+	// If every file's attributes were evaluated in-process, gets the directories and digest
+	// of the attributes files which were used (as needed for a Manifest) and returns true.
+	// Only meaningful once every file has been listed.
+	bool		get_attributes_digest (std::vector<std::string>& dirs, std::string& digest) const;
+};
+
+Attributed_file_lister::Attributed_file_lister (const std::vector<std::string>& ls_files_command, bool arg_has_tags)
+: has_tags(arg_has_tags), ls_files_output(*ls_files.stdout_pipe()), is_listed(false), attributes_loader(&matcher), is_using_matcher(false)
+{
+	ls_files.spawn(ls_files_command);
+
+	// The top-level .gitattributes is part of the digest even if no files are listed
+	is_using_matcher = attributes_loader.load_global() && attributes_loader.load_dir("");
+}
+
+bool		Attributed_file_lister::next (File& file)
+{
+	// Output looks like (w/o newlines):
+	// ? .gitignore\0
+	// H 100644 06ec22e5ed0de9280731ef000a10f9c3fbc26338 0     afile\0
+	Byte_span			record;
+	Ls_files_record			fields;
+	do {
+		if (is_listed) {
+			return false;
+		}
+		if (!ls_files_output.next(record)) {
+			is_listed = true;
+			if (!successful_exit(ls_files.wait())) {
+				throw Error("'git ls-files' failed - is this a Git repository?");
+			}
+			return false;
+		}
+		if (!parse_ls_files_record(record, has_tags, fields)) {
+			throw Error("Malformed output from 'git ls-files'");
+		}
+	} while (!fields.mode.empty() && !is_regular_file_mode(fields.mode));
+
+	file.tag = fields.tag.str();
+	file.mode = fields.mode.str();
+	file.object_id = fields.object_id.str();
+	file.stage = fields.stage.str();
+	file.path = fields.path.str();
+
+	if (is_using_matcher) {
+		const std::string	path_from_top(get_path_from_top(file.path));
+		if (attributes_loader.load_dirs_of(path_from_top)) {
+			std::string	filter_attr;
+			std::string	diff_attr;
+			matcher.get(path_from_top, filter_attr, diff_attr);
+			file.filter_attr = attribute_value(filter_attr);
+			file.diff_attr = attribute_value(diff_attr);
+			return true;
+		}
+		is_using_matcher = false;
+	}
+	get_check_attr_attributes(file);
+	return true;
+}
+
+void		Attributed_file_lister::get_check_attr_attributes (File& file)
+{
+	if (!check_attr) {
+		std::vector<std::string>	attributes;
+		attributes.push_back("filter");
+		attributes.push_back("diff");
+		check_attr.reset(new Check_attr_batch(attributes));
+	}
+	std::vector<std::string>	values;
+	check_attr->get(file.path, values);
+	file.filter_attr = attribute_value(values[0]);
+	file.diff_attr = attribute_value(values[1]);
+}
+
+void		Attributed_file_lister::close ()
+{
+	attributes_loader.close();
+	if (check_attr) {
+		check_attr->close();
+	}
+}
+
+bool		Attributed_file_lister::get_attributes_digest (std::vector<std::string>& dirs, std::string& digest) const
+{
+	if (!is_using_matcher || !is_listed) {
+		return false;
+	}
+	attributes_loader.get_dirs(dirs);
+	digest = attributes_loader.get_digest();
+	return true;
+}
+
+// Does a file starting with these 10 bytes look encrypted, in either the original or the chunked format?
+static bool is_encrypted_header (const char* header)
+{
+	return std::memcmp(header, "\0GITCRYPT\0", 10) == 0 || std::memcmp(header, "\0GITCRYPT\2", 10) == 0;
+}
+
+static bool check_if_blob_is_encrypted (Cat_file_batch& cat_file, const std::string& object_id)
+{
+	if (!cat_file.open(object_id)) {
+		throw Error("'git cat-file' failed - is this a Git repository?");
+	}
+
+	char				header[10];
+	return cat_file.read(header, sizeof(header)) == sizeof(header) && is_encrypted_header(header);
+}
+
+// Like check_if_blob_is_encrypted() above, but consults and updates blob_statuses,
+// and only starts `git cat-file` if the blob hasn't been checked already
+static bool check_if_blob_is_encrypted (std::unique_ptr<Cat_file_batch>& cat_file, Blob_statuses& blob_statuses, const std::string& object_id)
+{
+	Blob_statuses::const_iterator	status(blob_statuses.find(object_id));
+	if (status != blob_statuses.end()) {
+		return status->second == Manifest::BLOB_ENCRYPTED;
+	}
+
+	if (!cat_file) {
+		cat_file.reset(new Cat_file_batch);
+	}
+	const bool			is_encrypted = check_if_blob_is_encrypted(*cat_file, object_id);
+	blob_statuses[object_id] = is_encrypted ? Manifest::BLOB_ENCRYPTED : Manifest::BLOB_UNENCRYPTED;
+	return is_encrypted;
+}
+
+static bool check_if_file_is_encrypted (Cat_file_batch& cat_file, const std::string& filename)
+{
+	// git ls-files -sz filename
+	std::vector<std::string>	command;
+	command.push_back("git");
+	command.push_back("ls-files");
+	command.push_back("-sz");
+	command.push_back("--");
+	command.push_back(filename);
+
+	std::stringstream		output;
+	if (!successful_exit(exec_command(command, output))) {
+		throw Error("'git ls-files' failed - is this a Git repository?");
+	}
+
+	if (output.peek() == -1) {
+		return false;
+	}
+
+	std::string			mode;
+	std::string			object_id;
+	output >> mode >> object_id;
+
+	return check_if_blob_is_encrypted(cat_file, object_id);
+}
+
+static bool is_git_crypt_attribute (const std::string& filter_attribute)
+{
+	return filter_attribute == "git-crypt" || std::strncmp(filter_attribute.c_str(), "git-crypt-", 10) == 0;
+}
+
+#ifndef _WIN32
+// Feeds the output of `git ls-files -sz` straight into `git check-attr --stdin -z filter`
+// and matches up check-attr's answers with the index entries, so that both processes
+// run concurrently instead of taking turns.  Driven by a Coprocess_multiplexer.
+class Index_classifier {
+	Files_by_attribute&		files_by_attribute;
+	Coprocess_multiplexer&		multiplexer;
+	size_t				check_attr_input;
+
+	std::string			ls_files_buffer;	// partial record from ls-files
+	std::deque<Index_entry>		pending;		// entries sent to check-attr, awaiting their attribute
+	Check_attr_output_parser	check_attr_output;
+
+			Index_classifier (const Index_classifier&);	// Disallow copy
+	Index_classifier& operator= (const Index_classifier&);	// Disallow assignment
+public:
+	Index_classifier (Files_by_attribute& arg_files_by_attribute, Coprocess_multiplexer& arg_multiplexer, size_t arg_check_attr_input)
+	: files_by_attribute(arg_files_by_attribute), multiplexer(arg_multiplexer), check_attr_input(arg_check_attr_input) { }
+
+	void		on_ls_files_data (const char* p, size_t len);
+	void		on_check_attr_data (const char* p, size_t len);
+	bool		is_finished () const { return pending.empty() && ls_files_buffer.empty() && check_attr_output.is_empty(); }
+};
+
+void		Index_classifier::on_ls_files_data (const char* p, size_t len)
+{
+	if (len == 0) {
+		multiplexer.close_input(check_attr_input);
+		return;
+	}
+	ls_files_buffer.append(p, len);
+
+	const char*			record_start = ls_files_buffer.data();
+	const char* const		buffer_end = record_start + ls_files_buffer.size();
+	const char*			record_end;
+	while ((record_end = static_cast<const char*>(std::memchr(record_start, '\0', buffer_end - record_start))) != nullptr) {
+		Ls_files_record		fields;
+		if (!parse_ls_files_record(Byte_span(record_start, record_end - record_start), false, fields)) {
+			throw Error("Malformed output from 'git ls-files'");
+		}
+		if (is_regular_file_mode(fields.mode)) {
+			// (the path is followed by its NUL terminator in the buffer)
+			multiplexer.write(check_attr_input, fields.path.p, fields.path.len + 1);
+			pending.push_back(make_index_entry(fields));
+		}
+		record_start = record_end + 1;
+	}
+	ls_files_buffer.erase(0, record_start - ls_files_buffer.data());
+}
+
+void		Index_classifier::on_check_attr_data (const char* p, size_t len)
+{
+	check_attr_output.add(p, len);
+
+	// Each record is "<path> NUL filter NUL <value> NUL", in the order the paths were written
+	std::string			path;
+	std::string			attr_name;
+	std::string			attr_value;
+	while (check_attr_output.next(path, attr_name, attr_value)) {
+		if (pending.empty()) {
+			throw Error("Unexpected output from 'git check-attr'");
+		}
+		if (is_git_crypt_attribute(attr_value)) {
+			files_by_attribute[attr_value].push_back(pending.front());
+		}
+		pending.pop_front();
+	}
+}
+#endif
+
+// Classify the files listed by ls_files_command using Attribute_matcher instead of `git check-attr`,
+// also recording the encrypted files in manifest.  Returns false, having classified nothing,
+// if Attribute_matcher can't handle the repository.
+static bool get_encrypted_files_in_process (Files_by_attribute& files_by_attribute, Manifest& manifest, const std::vector<std::string>& ls_files_command)
+{
+	Coprocess			ls_files;
+	Nul_record_reader		ls_files_output(*ls_files.stdout_pipe());
+	ls_files.spawn(ls_files_command);
+
+	std::vector<Index_entry>	entries;
+	std::vector<std::string>	paths_from_top;
+	Byte_span			record;
+	while (ls_files_output.next(record)) {
+		Ls_files_record		fields;
+		if (!parse_ls_files_record(record, false, fields)) {
+			throw Error("Malformed output from 'git ls-files'");
+		}
+		if (is_regular_file_mode(fields.mode)) {
+			entries.push_back(make_index_entry(fields));
+			paths_from_top.push_back(get_path_from_top(entries.back().path));
+		}
+	}
+
+	if (!successful_exit(ls_files.wait())) {
+		throw Error("'git ls-files' failed - is this a Git repository?");
+	}
+
+	const std::set<std::string>	attributes_dirs(get_attributes_dirs(paths_from_top));
+	Attribute_matcher		matcher;
+	if (!load_attribute_matcher(&matcher, attributes_dirs, &manifest.attributes_digest)) {
+		return false;
+	}
+	manifest.attributes_dirs.assign(attributes_dirs.begin(), attributes_dirs.end());
+
+	std::string			filter_attribute;
+	std::string			diff_attribute;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		matcher.get(paths_from_top[i], filter_attribute, diff_attribute);
+		if (is_git_crypt_attribute(filter_attribute)) {
+			files_by_attribute[filter_attribute].push_back(entries[i]);
+			manifest.entries.push_back(make_manifest_entry(filter_attribute, entries[i].mode, entries[i].object_id, entries[i].stage, paths_from_top[i]));
+		}
+	}
+	return true;
+}
+
+// Classify every file in the repository by its git-crypt filter attribute (see attribute_name()),
+// so that the files of several keys can be found with a single pass over the index
+static void get_encrypted_files (Files_by_attribute& files_by_attribute)
+{
+	// If neither the index nor the attributes files have changed since the manifest
+	// was saved, it already has the answer
+	const std::string		index_checksum(get_index_checksum());
+	Manifest			old_manifest;
+	const bool			has_old_manifest = load_manifest(old_manifest);
+	if (has_old_manifest && is_manifest_current(old_manifest, index_checksum)) {
+		for (std::vector<Manifest::Entry>::const_iterator entry(old_manifest.entries.begin()); entry != old_manifest.entries.end(); ++entry) {
+			files_by_attribute[entry->attribute].push_back(make_index_entry(*entry));
+		}
+		return;
+	}
+
+	// git ls-files -cz -- path_to_top
+	std::vector<std::string>	ls_files_command;
+	ls_files_command.push_back("git");
+	ls_files_command.push_back("ls-files");
+	ls_files_command.push_back("-csz");
+	ls_files_command.push_back("--");
+	const std::string		path_to_top(get_path_to_top());
+	if (!path_to_top.empty()) {
+		ls_files_command.push_back(path_to_top);
+	}
+
+	Manifest			manifest;
+	if (get_encrypted_files_in_process(files_by_attribute, manifest, ls_files_command)) {
+		if (!index_checksum.empty()) {
+			manifest.index_checksum = index_checksum;
+			if (has_old_manifest) {
+				copy_blob_statuses(manifest, get_blob_statuses(old_manifest));
+			}
+			save_manifest(manifest);
+		}
+		return;
+	}
+
+	Coprocess			ls_files;
+	std::istream*			ls_files_stdout = ls_files.stdout_pipe();
+	ls_files.spawn(ls_files_command);
+
+	std::vector<std::string>	attributes;
+	attributes.push_back("filter");
+	Check_attr_batch		check_attr(attributes);
+
+#ifndef _WIN32
+	if (check_attr.has_coprocess()) {
+		Coprocess_multiplexer		multiplexer;
+		Index_classifier		classifier(files_by_attribute, multiplexer, multiplexer.add_input(check_attr.coprocess()));
+		multiplexer.add_output(ls_files, std::bind(&Index_classifier::on_ls_files_data, &classifier, std::placeholders::_1, std::placeholders::_2));
+		multiplexer.add_output(check_attr.coprocess(), std::bind(&Index_classifier::on_check_attr_data, &classifier, std::placeholders::_1, std::placeholders::_2));
+		multiplexer.run();
+
+		if (!successful_exit(ls_files.wait())) {
+			throw Error("'git ls-files' failed - is this a Git repository?");
+		}
+		check_attr.close();
+		if (!classifier.is_finished()) {
+			throw Error("'git check-attr' failed - is this a Git repository?");
+		}
+		return;
+	}
+#endif
+
+	Nul_record_reader		ls_files_output(*ls_files_stdout);
+	Byte_span			record;
+	std::vector<std::string>	values;
+	while (ls_files_output.next(record)) {
+		Ls_files_record		fields;
+		if (!parse_ls_files_record(record, false, fields)) {
+			throw Error("Malformed output from 'git ls-files'");
+		}
+
+		if (is_regular_file_mode(fields.mode)) {
+			const Index_entry	entry(make_index_entry(fields));
+			check_attr.get(entry.path, values);
+
+			if (is_git_crypt_attribute(values[0])) {
+				files_by_attribute[values[0]].push_back(entry);
+			}
+		}
+	}
+
+	if (!successful_exit(ls_files.wait())) {
+		throw Error("'git ls-files' failed - is this a Git repository?");
+	}
+	check_attr.close();
+}
+
+// Return the files which are encrypted with the given key, as classified by get_encrypted_files() above
+static const std::vector<Index_entry>& get_encrypted_files (Files_by_attribute& files_by_attribute, const char* key_name)
+{
+	return files_by_attribute[attribute_name(key_name)];
+}
+
+static void load_key (Key_file& key_file, const char* key_name, const char* key_path =0, const char* legacy_path =0)
+{
+	if (legacy_path) {
+		std::ifstream		key_file_in(legacy_path, std::fstream::binary);
+		if (!key_file_in) {
+			throw Error(std::string("Unable to open key file: ") + legacy_path);
+		}
+		key_file.load_legacy(key_file_in);
+	} else if (key_path) {
+		std::ifstream		key_file_in(key_path, std::fstream::binary);
+		if (!key_file_in) {
+			throw Error(std::string("Unable to open key file: ") + key_path);
+		}
+		key_file.load(key_file_in);
+	} else {
+		std::ifstream		key_file_in(get_internal_key_path(key_name).c_str(), std::fstream::binary);
+		if (!key_file_in) {
+			// TODO: include key name in error message
+			throw Error("Unable to open key file - have you unlocked/initialized this repository yet?");
+		}
+		key_file.load(key_file_in);
+	}
+}
+
+static bool decrypt_repo_key (Key_file& key_file, const char* key_name, uint32_t key_version, const std::vector<std::string>& secret_keys, const std::string& keys_path)
+{
+	std::exception_ptr gpg_error;
+
+	for (std::vector<std::string>::const_iterator seckey(secret_keys.begin()); seckey != secret_keys.end(); ++seckey) {
+		std::ostringstream		path_builder;
+		path_builder << keys_path << '/' << (key_name ? key_name : "default") << '/' << key_version << '/' << *seckey << ".gpg";
 		std::string			path(path_builder.str());
 		if (access(path.c_str(), F_OK) == 0) {
 			std::stringstream	decrypted_contents;
@@ -626,323 +1536,1795 @@ static bool decrypt_repo_key (Key_file& key_file, const char* key_name, uint32_t
 				gpg_error = std::current_exception();
 				continue;
 			}
-			Key_file		this_version_key_file;
-			this_version_key_file.load(decrypted_contents);
-			const Key_file::Entry*	this_version_entry = this_version_key_file.get(key_version);
-			if (!this_version_entry) {
-				throw Error("GPG-encrypted keyfile is malformed because it does not contain expected key version");
+			Key_file		this_version_key_file;
+			this_version_key_file.load(decrypted_contents);
+			const Key_file::Entry*	this_version_entry = this_version_key_file.get(key_version);
+			if (!this_version_entry) {
+				throw Error("GPG-encrypted keyfile is malformed because it does not contain expected key version");
+			}
+			if (!same_key_name(key_name, this_version_key_file.get_key_name())) {
+				throw Error("GPG-encrypted keyfile is malformed because it does not contain expected key name");
+			}
+			key_file.set_key_name(key_name);
+			key_file.add(*this_version_entry);
+			return true;
+		}
+	}
+
+	if (gpg_error) {
+		std::rethrow_exception(gpg_error);
+	}
+
+	return false;
+}
+
+static bool decrypt_repo_keys (std::vector<Key_file>& key_files, uint32_t key_version, const std::vector<std::string>& secret_keys, const std::string& keys_path)
+{
+	bool				successful = false;
+	std::vector<std::string>	dirents;
+
+	if (access(keys_path.c_str(), F_OK) == 0) {
+		dirents = get_directory_contents(keys_path.c_str());
+	}
+
+	for (std::vector<std::string>::const_iterator dirent(dirents.begin()); dirent != dirents.end(); ++dirent) {
+		const char*		key_name = 0;
+		if (*dirent != "default") {
+			if (!validate_key_name(dirent->c_str())) {
+				continue;
+			}
+			key_name = dirent->c_str();
+		}
+
+		Key_file	key_file;
+		if (decrypt_repo_key(key_file, key_name, key_version, secret_keys, keys_path)) {
+			key_files.push_back(key_file);
+			successful = true;
+		}
+	}
+	return successful;
+}
+
+static void encrypt_repo_key (const char* key_name, const Key_file::Entry& key, const std::vector<std::pair<std::string, bool> >& collab_keys, const std::string& keys_path, std::vector<std::string>* new_files)
+{
+	std::string	key_file_data;
+	{
+		Key_file this_version_key_file;
+		this_version_key_file.set_key_name(key_name);
+		this_version_key_file.add(key);
+		key_file_data = this_version_key_file.store_to_string();
+	}
+
+	for (std::vector<std::pair<std::string, bool> >::const_iterator collab(collab_keys.begin()); collab != collab_keys.end(); ++collab) {
+		const std::string&	fingerprint(collab->first);
+		const bool		key_is_trusted(collab->second);
+		std::ostringstream	path_builder;
+		path_builder << keys_path << '/' << (key_name ? key_name : "default") << '/' << key.version << '/' << fingerprint << ".gpg";
+		std::string		path(path_builder.str());
+
+		if (access(path.c_str(), F_OK) == 0) {
+			continue;
+		}
+
+		mkdir_parent(path);
+		gpg_encrypt_to_file(path, fingerprint, key_is_trusted, key_file_data.data(), key_file_data.size());
+		new_files->push_back(path);
+	}
+}
+
+static int parse_plumbing_options (const char** key_name, const char** key_file, int argc, const char** argv)
+{
+	Options_list	options;
+	options.push_back(Option_def("-k", key_name));
+	options.push_back(Option_def("--key-name", key_name));
+	options.push_back(Option_def("--key-file", key_file));
+
+	return parse_options(options, argc, argv);
+}
+
+// Read all of in, keeping the first 8MB or so in memory and spilling the rest into a temporary
+// file, and adding it to hmac (if non-null) as we go.  Returns the length of the file.
+// (hmac can be anything with an add() method, such as a Chunk_siv_state.)
+template<class Hmac =Hmac_sha1_state>
+static uint64_t spool_file (std::istream& in, std::string& file_contents, temp_fstream& temp_file, Hmac* hmac =0)
+{
+	temp_file.exceptions(std::fstream::badbit);
+
+	uint64_t		file_size = 0;
+	char			buffer[1024];
+	while (in) {
+		in.read(buffer, sizeof(buffer));
+		if (hmac) {
+			hmac->add(reinterpret_cast<unsigned char*>(buffer), in.gcount());
+		}
+		file_size += in.gcount();
+		if (temp_file.is_open()) {
+			temp_file.write(buffer, in.gcount());
+		} else if (file_contents.size() + in.gcount() <= 8388608) {
+			file_contents.append(buffer, in.gcount());
+		} else {
+			temp_file.open(std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::app);
+			temp_file.write(file_contents.data(), file_contents.size());
+			temp_file.write(buffer, in.gcount());
+			file_contents.clear();
+		}
+	}
+	if (temp_file.is_open()) {
+		temp_file.seekg(0);
+	}
+	return file_size;
+}
+
+// Add a file read by spool_file() to hmac
+static void hmac_spooled_file (Hmac_sha1_state& hmac, const std::string& file_contents, temp_fstream& temp_file)
+{
+	hmac.add(reinterpret_cast<const unsigned char*>(file_contents.data()), file_contents.size());
+	if (temp_file.is_open()) {
+		temp_file.seekg(0);
+		char		buffer[8192];
+		while (temp_file.peek() != -1) {
+			temp_file.read(buffer, sizeof(buffer));
+			hmac.add(reinterpret_cast<unsigned char*>(buffer), temp_file.gcount());
+		}
+		temp_file.clear();
+	}
+}
+
+// Write the encrypted version of a file read by spool_file() to out, given its HMAC
+static void write_encrypted_file (const Key_file::Entry& key, const unsigned char* digest, uint64_t file_size, const std::string& file_contents, temp_fstream& temp_file, std::ostream& out)
+{
+	// We use an HMAC of the file as the encryption nonce (IV) for CTR mode.
+	// By using a hash of the file we ensure that the encryption is
+	// deterministic so git doesn't think the file has changed when it really
+	// hasn't.  CTR mode with a synthetic IV is provably semantically secure
+	// under deterministic CPA as long as the synthetic IV is derived from a
+	// secure PRF applied to the message.  Since HMAC-SHA1 is a secure PRF, this
+	// encryption scheme is semantically secure under deterministic CPA.
+	// 
+	// Informally, consider that if a file changes just a tiny bit, the IV will
+	// be completely different, resulting in a completely different ciphertext
+	// that leaks no information about the similarities of the plaintexts.  Also,
+	// since we're using the output from a secure hash function plus a counter
+	// as the input to our block cipher, we should never have a situation where
+	// two different plaintext blocks get encrypted with the same CTR value.  A
+	// nonce will be reused only if the entire file is the same, which leaks no
+	// information except that the files are the same.
+	//
+	// To prevent an attacker from building a dictionary of hash values and then
+	// looking up the nonce (which must be stored in the clear to allow for
+	// decryption), we use an HMAC as opposed to a straight hash.
+
+	// Note: Hmac_sha1_state::LEN >= Aes_ctr_encryptor::NONCE_LEN
+
+	// Write a header that...
+	out.write("\0GITCRYPT\0", 10); // ...identifies this as an encrypted file
+	out.write(reinterpret_cast<const char*>(digest), Aes_ctr_encryptor::NONCE_LEN); // ...includes the nonce
+
+	// Now encrypt the file and write to out
+	Aes_ctr_encryptor	aes(key.aes_key, digest);
+	const unsigned int	threads = file_size >= PARALLEL_CRYPT_MIN_BYTES ? get_crypt_threads() : 1;
+	std::vector<char>	crypt_buffer(threads > 1 ? std::min<uint64_t>(get_crypt_batch_size(threads), file_size) : 1024);
+	std::unique_ptr<Thread_pool> pool(threads > 1 ? new Thread_pool(threads) : nullptr); // must be destroyed before crypt_buffer
+
+	// First read from the in-memory copy
+	const unsigned char*	file_data = reinterpret_cast<const unsigned char*>(file_contents.data());
+	size_t			file_data_len = file_contents.size();
+	while (file_data_len > 0) {
+		const size_t	buffer_len = std::min(crypt_buffer.size(), file_data_len);
+		aes.process_parallel(file_data, reinterpret_cast<unsigned char*>(&crypt_buffer[0]), buffer_len, pool.get());
+		out.write(&crypt_buffer[0], buffer_len);
+		file_data += buffer_len;
+		file_data_len -= buffer_len;
+	}
+
+	// Then read from the temporary file if applicable
+	if (temp_file.is_open()) {
+		temp_file.seekg(0);
+		while (temp_file.peek() != -1) {
+			temp_file.read(&crypt_buffer[0], crypt_buffer.size());
+
+			const size_t	buffer_len = temp_file.gcount();
+
+			aes.process_parallel(reinterpret_cast<unsigned char*>(&crypt_buffer[0]),
+			                     reinterpret_cast<unsigned char*>(&crypt_buffer[0]),
+			                     buffer_len, pool.get());
+			out.write(&crypt_buffer[0], buffer_len);
+		}
+	}
+}
+
+// Encrypt contents of in and write to out
+static int encrypt_file (const Key_file& key_file, std::istream& in, std::ostream& out)
+{
+	const Key_file::Entry*	key = key_file.get_latest();
+	if (!key) {
+		std::clog << "git-crypt: error: key file is empty" << std::endl;
+		return 1;
+	}
+
+	// Read the entire file
+
+	Hmac_sha1_state	hmac(key->hmac_key, HMAC_KEY_LEN); // Calculate the file's SHA1 HMAC as we go
+	std::string		file_contents;	// First 8MB or so of the file go here
+	temp_fstream		temp_file;	// Or the whole file, if it's larger, goes into a temporary file on disk
+	const uint64_t		file_size = spool_file(in, file_contents, temp_file, &hmac);
+
+	// Make sure the file isn't so large we'll overflow the counter value (which would doom security)
+	if (file_size >= Aes_ctr_encryptor::MAX_CRYPT_BYTES) {
+		std::clog << "git-crypt: error: file too long to encrypt securely" << std::endl;
+		return 1;
+	}
+
+	unsigned char		digest[Hmac_sha1_state::LEN];
+	hmac.get(digest);
+	write_encrypted_file(*key, digest, file_size, file_contents, temp_file, out);
+
+	return 0;
+}
+
+// Write the chunked encryption of a file read by spool_file() to out, given its header
+static void write_chunked_file (const Key_file::Entry& key, const Chunked_header& header, uint64_t file_size, const std::string& file_contents, temp_fstream& temp_file, std::ostream& out)
+{
+	const std::string	stored_header(header.store_to_string());
+	out.write(stored_header.data(), stored_header.size());
+
+	// Encrypt a whole number of chunks at a time
+	const Chunk_cipher	cipher(key, header, stored_header);
+	const unsigned int	threads = file_size >= PARALLEL_CRYPT_MIN_BYTES ? get_crypt_threads() : 1;
+	const size_t		batch_len = std::max<size_t>(std::min<uint64_t>(get_crypt_batch_size(threads), file_size) / header.chunk_size, 1) * header.chunk_size;
+	std::vector<unsigned char> crypt_buffer(cipher.get_encrypted_len(batch_len, false));
+	std::vector<unsigned char> file_buffer(temp_file.is_open() ? batch_len : 0);
+	std::unique_ptr<Thread_pool> pool(threads > 1 ? new Thread_pool(threads) : nullptr); // must be destroyed before the buffers
+	if (temp_file.is_open()) {
+		temp_file.seekg(0);
+	}
+
+	uint64_t		index = 0;
+	uint64_t		offset = 0;
+	do {
+		const size_t		len = std::min<uint64_t>(batch_len, file_size - offset);
+		const bool		ends_file = offset + len == file_size;
+		const unsigned char*	file_data;
+		if (temp_file.is_open()) {
+			temp_file.read(reinterpret_cast<char*>(&file_buffer[0]), len);
+			if (temp_file.gcount() != static_cast<std::streamsize>(len)) {
+				throw Error("Unexpected end of temporary file");
+			}
+			file_data = &file_buffer[0];
+		} else {
+			file_data = reinterpret_cast<const unsigned char*>(file_contents.data()) + offset;
+		}
+
+		cipher.encrypt(index, ends_file, file_data, len, &crypt_buffer[0], pool.get());
+		out.write(reinterpret_cast<char*>(&crypt_buffer[0]), cipher.get_encrypted_len(len, ends_file));
+		index += len / header.chunk_size;
+		offset += len;
+	} while (offset < file_size);
+}
+
+// Write the encryption of a file read by spool_file() to out, in the chunked format
+// with content-defined chunking.  With compression, chunks are found in the plaintext
+// and then compressed separately, so an edit still only changes the chunks around it.
+static void write_cdc_file (const Key_file::Entry& key, const Chunked_header& header, uint64_t file_size, const std::string& file_contents, temp_fstream& temp_file, std::ostream& out)
+{
+	const std::string	stored_header(header.store_to_string());
+	out.write(stored_header.data(), stored_header.size());
+
+	const Cdc_chunker	chunker(key, header);
+	Cdc_cipher		cipher(key, header, stored_header);
+	const unsigned int	threads = file_size >= PARALLEL_CRYPT_MIN_BYTES ? get_crypt_threads() : 1;
+	// Chunks are found in a buffer which always holds at least one maximum-size chunk
+	// (or the rest of the file), so they don't depend on where the buffer was filled
+	std::vector<unsigned char> file_buffer(temp_file.is_open() ? std::min<uint64_t>(std::max<size_t>(get_crypt_batch_size(threads), header.chunk_size * 2), file_size) : 0);
+	std::vector<unsigned char> crypt_buffer;
+	std::vector<size_t>	chunk_lens;
+	std::vector<unsigned char> compressed;
+	std::vector<size_t>	compressed_lens;
+	std::unique_ptr<Thread_pool> pool(threads > 1 ? new Thread_pool(threads) : nullptr); // must be destroyed before the buffers
+	if (temp_file.is_open()) {
+		temp_file.seekg(0);
+	}
+
+	uint64_t		bytes_read = 0;
+	size_t			bytes_left = 0;	// carried over from the last pass
+	do {
+		const unsigned char*	file_data;
+		size_t			file_data_len;
+		if (temp_file.is_open()) {
+			const size_t	len = std::min<uint64_t>(file_buffer.size() - bytes_left, file_size - bytes_read);
+			temp_file.read(reinterpret_cast<char*>(&file_buffer[bytes_left]), len);
+			if (temp_file.gcount() != static_cast<std::streamsize>(len)) {
+				throw Error("Unexpected end of temporary file");
+			}
+			bytes_read += len;
+			file_data = &file_buffer[0];
+			file_data_len = bytes_left + len;
+		} else {
+			bytes_read = file_size;
+			file_data = reinterpret_cast<const unsigned char*>(file_contents.data());
+			file_data_len = file_contents.size();
+		}
+		const bool		ends_file = bytes_read == file_size;
+
+		size_t			offset = 0;
+		chunk_lens.clear();
+		while (offset < file_data_len && (ends_file || file_data_len - offset >= header.chunk_size)) {
+			chunk_lens.push_back(chunker.find_boundary(file_data + offset, file_data_len - offset));
+			offset += chunk_lens.back();
+		}
+		if (!chunk_lens.empty() && header.compression == Chunked_header::COMPRESSION_ZLIB) {
+			compressed.clear();
+			compressed_lens.clear();
+			const unsigned char*	chunk = file_data;
+			for (std::vector<size_t>::const_iterator len(chunk_lens.begin()); len != chunk_lens.end(); ++len) {
+				const size_t	compressed_start = compressed.size();
+				zlib_compress(chunk, *len, compressed);
+				compressed_lens.push_back(compressed.size() - compressed_start);
+				chunk += *len;
+			}
+			crypt_buffer.resize(Cdc_cipher::get_encrypted_len(compressed_lens));
+			cipher.encrypt(&compressed[0], compressed_lens, &crypt_buffer[0], pool.get());
+			out.write(reinterpret_cast<char*>(&crypt_buffer[0]), crypt_buffer.size());
+		} else if (!chunk_lens.empty()) {
+			crypt_buffer.resize(Cdc_cipher::get_encrypted_len(chunk_lens));
+			cipher.encrypt(file_data, chunk_lens, &crypt_buffer[0], pool.get());
+			out.write(reinterpret_cast<char*>(&crypt_buffer[0]), crypt_buffer.size());
+		}
+
+		bytes_left = file_data_len - offset;
+		if (bytes_left > 0) {
+			std::memmove(&file_buffer[0], file_data + offset, bytes_left);
+		}
+	} while (bytes_read < file_size || bytes_left > 0);
+
+	unsigned char		trailer_mac[Cdc_cipher::MAC_LEN];
+	cipher.get_trailer_mac(trailer_mac);
+	write_be32(out, Cdc_cipher::TRAILER_MARKER);
+	out.write(reinterpret_cast<char*>(trailer_mac), sizeof(trailer_mac));
+}
+
+// Encrypt contents of in in the chunked format, with content-defined chunking if
+// is_content_defined and the compression and cipher suite of parameters, and write to out
+static int encrypt_chunked_file (const Key_file& key_file, bool is_content_defined, const Chunked_header& parameters, std::istream& in, std::ostream& out)
+{
+	const Key_file::Entry*	key = key_file.get_latest();
+	if (!key) {
+		std::clog << "git-crypt: error: key file is empty" << std::endl;
+		return 1;
+	}
+
+	Chunked_header		header(parameters);
+	header.key_version = key->version;
+
+	if (is_content_defined) {
+		header.is_content_defined = true;
+		header.min_chunk_size = Chunked_header::DEFAULT_MIN_CHUNK_SIZE;
+		header.avg_chunk_size = Chunked_header::DEFAULT_AVG_CHUNK_SIZE;
+
+		std::string		file_contents;
+		temp_fstream		temp_file;
+		const uint64_t		file_size = spool_file(in, file_contents, temp_file);
+		write_cdc_file(*key, header, file_size, file_contents, temp_file, out);
+		return 0;
+	}
+
+	Chunk_siv_state		siv(*key, header);
+
+	// With compression, the chunks (and so the synthetic IV) are of the compressed file
+	std::string		file_contents;
+	temp_fstream		temp_file;
+	uint64_t		file_size;
+	if (header.compression == Chunked_header::COMPRESSION_ZLIB) {
+		Zlib_compress_istream	compressed_in(in);
+		file_size = spool_file(compressed_in, file_contents, temp_file, &siv);
+		if (compressed_in.bad()) {
+			std::clog << "git-crypt: error: unable to compress file" << std::endl;
+			return 1;
+		}
+	} else {
+		file_size = spool_file(in, file_contents, temp_file, &siv);
+	}
+
+	siv.get(header.siv);
+	write_chunked_file(*key, header, file_size, file_contents, temp_file, out);
+
+	return 0;
+}
+
+// The formats in which a file can be encrypted, chosen by its git-crypt-format attribute
+// (and its git-crypt-compress and git-crypt-cipher attributes, since only the chunked
+// format can be compressed or use another cipher suite)
+enum File_format {
+	FORMAT_ORIGINAL,	// git-crypt-format unspecified or unset
+	FORMAT_CHUNKED,		// git-crypt-format=chunked (see chunked.hpp)
+	FORMAT_CDC		// git-crypt-format=cdc, chunked with content-defined chunking
+};
+
+// Get the format, compression and cipher suite with which to encrypt path, starting
+// check_attr if it hasn't been started yet.  Returns false if the file's git-crypt-format,
+// git-crypt-compress or git-crypt-cipher isn't known, or the combination isn't supported.
+static bool get_file_format (std::unique_ptr<Check_attr_batch>& check_attr, const std::string& path, File_format& format, Chunked_header& parameters)
+{
+	if (!check_attr) {
+		std::vector<std::string>	attributes;
+		attributes.push_back("git-crypt-format");
+		attributes.push_back("git-crypt-compress");
+		attributes.push_back("git-crypt-cipher");
+		check_attr.reset(new Check_attr_batch(attributes));
+	}
+	std::vector<std::string>	values;
+	check_attr->get(path, values);
+
+	if (values[1] == "unspecified" || values[1] == "unset") {
+		parameters.compression = Chunked_header::COMPRESSION_NONE;
+	} else if (values[1] == "set" || values[1] == "zlib") {
+		parameters.compression = Chunked_header::COMPRESSION_ZLIB;
+	} else {
+		return false;
+	}
+
+	if (values[2] == "unspecified" || values[2] == "unset") {
+		parameters.cipher = Chunked_header::CIPHER_AES_CTR_HMAC_SHA1;
+	} else if (values[2] == "aes-gcm") {
+		parameters.cipher = Chunked_header::CIPHER_AES_256_GCM;
+	} else if (values[2] == "chacha20") {
+		parameters.cipher = Chunked_header::CIPHER_CHACHA20_POLY1305;
+	} else {
+		return false;
+	}
+
+	if (values[0] == "unspecified" || values[0] == "unset") {
+		format = FORMAT_ORIGINAL;
+	} else if (values[0] == "chunked") {
+		format = FORMAT_CHUNKED;
+	} else if (values[0] == "cdc") {
+		format = FORMAT_CDC;
+	} else {
+		return false;
+	}
+	if (format == FORMAT_ORIGINAL && (parameters.compression != Chunked_header::COMPRESSION_NONE || parameters.cipher != Chunked_header::CIPHER_AES_CTR_HMAC_SHA1)) {
+		format = FORMAT_CHUNKED;
+	}
+	if (format == FORMAT_CDC && parameters.cipher != Chunked_header::CIPHER_AES_CTR_HMAC_SHA1) {
+		return false; // content-defined chunking only supports the default cipher suite
+	}
+	return true;
+}
+
+// Encrypt contents of stdin and write to stdout, in the format chosen by the attributes of
+// the file at --path (which the filter configuration passes as %f)
+int clean (int argc, const char** argv)
+{
+	const char*		key_name = 0;
+	const char*		key_path = 0;
+	const char*		legacy_key_path = 0;
+	const char*		path = 0;
+
+	Options_list		options;
+	options.push_back(Option_def("-k", &key_name));
+	options.push_back(Option_def("--key-name", &key_name));
+	options.push_back(Option_def("--key-file", &key_path));
+	options.push_back(Option_def("--path", &path));
+
+	int			argi = parse_options(options, argc, argv);
+	if (argc - argi == 0) {
+	} else if (!key_name && !key_path && argc - argi == 1) { // Deprecated - for compatibility with pre-0.4
+		legacy_key_path = argv[argi];
+	} else {
+		std::clog << "Usage: git-crypt clean [--key-name=NAME] [--key-file=PATH] [--path=FILE]" << std::endl;
+		return 2;
+	}
+	Key_file		key_file;
+	load_key(key_file, key_name, key_path, legacy_key_path);
+
+	// Filter configurations written by older versions of git-crypt don't pass the path,
+	// and without it there's no telling which format the file is meant to be in
+	if (!path) {
+		std::clog << "git-crypt: error: unable to choose the format to encrypt in, because Git didn't pass the file's path to 'git-crypt clean'" << std::endl;
+		if (!legacy_key_path && !key_path) {
+			std::clog << "Your filter configuration is from an older version of git-crypt.  To update it, run:" << std::endl;
+			std::clog << "  git config filter." << attribute_name(key_name) << ".clean " << escape_shell_arg(clean_filter_command(key_name)) << std::endl;
+		}
+		return 1;
+	}
+
+	File_format		format = FORMAT_ORIGINAL;
+	Chunked_header		parameters;
+	{
+		std::unique_ptr<Check_attr_batch> check_attr;
+		if (!get_file_format(check_attr, path, format, parameters)) {
+			std::clog << "git-crypt: error: " << path << ": unknown or unsupported git-crypt-format, git-crypt-compress or git-crypt-cipher attribute" << std::endl;
+			return 1;
+		}
+	}
+
+	if (format == FORMAT_CHUNKED || format == FORMAT_CDC) {
+		return encrypt_chunked_file(key_file, format == FORMAT_CDC, parameters, std::cin, std::cout);
+	}
+	return encrypt_file(key_file, std::cin, std::cout);
+}
+
+static int decrypt_file (const Key_file& key_file, const unsigned char* header, std::istream& in, std::ostream& out, std::ostream& log =std::clog)
+{
+	const unsigned char*	nonce = header + 10;
+	uint32_t		key_version = 0; // TODO: get the version from the file header
+
+	const Key_file::Entry*	key = key_file.get(key_version);
+	if (!key) {
+		log << "git-crypt: error: key version " << key_version << " not available - please unlock with the latest version of the key." << std::endl;
+		return 1;
+	}
+
+	Aes_ctr_decryptor	aes(key->aes_key, nonce);
+	Hmac_sha1_state		hmac(key->hmac_key, HMAC_KEY_LEN);
+	unsigned int		threads = 1;
+	uint64_t		file_size = 0;
+	std::vector<unsigned char> buffer(1024);
+	std::unique_ptr<Thread_pool> pool;	// must be destroyed before buffer
+	while (in) {
+		in.read(reinterpret_cast<char*>(&buffer[0]), buffer.size());
+		aes.process_parallel(&buffer[0], &buffer[0], in.gcount(), pool.get());
+		hmac.add(&buffer[0], in.gcount());
+		out.write(reinterpret_cast<char*>(&buffer[0]), in.gcount());
+
+		// We don't know the file size in advance, so switch to multiple
+		// threads once we've seen enough data to make it worthwhile
+		file_size += in.gcount();
+		if (threads == 1 && file_size >= PARALLEL_CRYPT_MIN_BYTES) {
+			threads = get_crypt_threads();
+			buffer.resize(get_crypt_batch_size(threads));
+			if (threads > 1) {
+				pool.reset(new Thread_pool(threads));
+			}
+		}
+	}
+
+	unsigned char		digest[Hmac_sha1_state::LEN];
+	hmac.get(digest);
+	if (!leakless_equals(digest, nonce, Aes_ctr_decryptor::NONCE_LEN)) {
+		log << "git-crypt: error: encrypted file has been tampered with!" << std::endl;
+		// Although we've already written the tampered file to out, exiting
+		// with a non-zero status will tell git the file has not been filtered,
+		// so git will not replace it.
+		return 1;
+	}
+
+	return 0;
+}
+
+// Decrypt (and decompress, if need be) the chunks and trailer of a file with
+// content-defined chunking, whose header has already been read from in
+static int decrypt_cdc_file (const Key_file::Entry& key, const Chunked_header& header, const std::string& stored_header, std::istream& in, std::ostream& out, std::ostream& log)
+{
+	Cdc_cipher		cipher(key, header, stored_header);
+	unsigned int		threads = 1;
+	size_t			batch_len = PARALLEL_CRYPT_CHUNK_SIZE;
+	std::vector<unsigned char> chunks;
+	std::vector<unsigned char> plaintext;
+	std::vector<unsigned char> decompressed;
+	std::vector<size_t>	chunk_lens;
+	const bool		is_compressed = header.compression == Chunked_header::COMPRESSION_ZLIB;
+	const size_t		max_chunk_len = is_compressed ? zlib_compress_bound(header.chunk_size) : header.chunk_size;
+	std::unique_ptr<Thread_pool> pool;	// must be destroyed before the buffers
+	uint64_t		file_size = 0;
+	while (true) {
+		// Read chunks until there's a batch of them, or we reach the trailer
+		bool		is_at_trailer = false;
+		size_t		plaintext_len = 0;
+		chunks.clear();
+		chunk_lens.clear();
+		while (chunks.size() < batch_len) {
+			uint32_t	chunk_len;
+			if (!read_be32(in, chunk_len)) {
+				log << "git-crypt: error: encrypted file has been truncated" << std::endl;
+				return 1;
+			}
+			if (chunk_len == Cdc_cipher::TRAILER_MARKER) {
+				is_at_trailer = true;
+				break;
+			}
+			if (chunk_len > max_chunk_len) {
+				log << "git-crypt: error: encrypted file has been tampered with!" << std::endl;
+				return 1;
+			}
+
+			const size_t	offset = chunks.size();
+			chunks.resize(offset + Cdc_cipher::CHUNK_HEADER_LEN + chunk_len);
+			store_be32(&chunks[offset], chunk_len);
+			in.read(reinterpret_cast<char*>(&chunks[offset + 4]), Cdc_cipher::TAG_LEN + chunk_len);
+			if (in.gcount() != static_cast<std::streamsize>(Cdc_cipher::TAG_LEN + chunk_len)) {
+				log << "git-crypt: error: encrypted file has been truncated" << std::endl;
+				return 1;
+			}
+			chunk_lens.push_back(chunk_len);
+			plaintext_len += chunk_len;
+		}
+
+		if (!chunk_lens.empty()) {
+			plaintext.resize(std::max<size_t>(plaintext_len, 1));
+			if (!cipher.decrypt(&chunks[0], chunk_lens, &plaintext[0], pool.get())) {
+				log << "git-crypt: error: encrypted file has been tampered with!" << std::endl;
+				return 1;
+			}
+			if (is_compressed) {
+				// The chunks are authentic, so they can only be malformed if whoever
+				// encrypted them had the key
+				const unsigned char*	chunk = &plaintext[0];
+				decompressed.clear();
+				for (std::vector<size_t>::const_iterator len(chunk_lens.begin()); len != chunk_lens.end(); ++len) {
+					if (!zlib_decompress(chunk, *len, decompressed, header.chunk_size)) {
+						log << "git-crypt: error: encrypted file has malformed compressed data" << std::endl;
+						return 1;
+					}
+					chunk += *len;
+				}
+				out.write(reinterpret_cast<char*>(decompressed.data()), decompressed.size());
+			} else {
+				out.write(reinterpret_cast<char*>(&plaintext[0]), plaintext_len);
+			}
+		}
+
+		if (is_at_trailer) {
+			unsigned char	trailer_mac[Cdc_cipher::MAC_LEN];
+			in.read(reinterpret_cast<char*>(trailer_mac), sizeof(trailer_mac));
+			if (in.gcount() != sizeof(trailer_mac) || in.peek() != -1 || !cipher.check_trailer_mac(trailer_mac)) {
+				// Although we've already written the chunks to out, exiting with a
+				// non-zero status will tell git the file has not been filtered
+				log << "git-crypt: error: encrypted file has been tampered with!" << std::endl;
+				return 1;
+			}
+			return 0;
+		}
+
+		// As in decrypt_file, switch to multiple threads once we've seen enough data
+		file_size += plaintext_len;
+		if (threads == 1 && file_size >= PARALLEL_CRYPT_MIN_BYTES) {
+			threads = get_crypt_threads();
+			batch_len = get_crypt_batch_size(threads);
+			if (threads > 1) {
+				pool.reset(new Thread_pool(threads));
+			}
+		}
+	}
+}
+
+// Decrypt a file in the chunked format, whose magic has already been read from in.
+// Chunks are verified before they're written to out, so out never receives tampered
+// data, although it may receive the chunks before a tampered one.  Compressed files
+// are decompressed as they're decrypted.
+static int decrypt_chunked_file (const Key_file& key_file, std::istream& in, std::ostream& out, std::ostream& log =std::clog)
+{
+	Chunked_header		header;
+	std::string		stored_header;
+	try {
+		stored_header = header.load(in);
+	} catch (const Chunked_header::Malformed&) {
+		log << "git-crypt: error: encrypted file has a malformed header" << std::endl;
+		return 1;
+	} catch (const Chunked_header::Incompatible&) {
+		log << "git-crypt: error: encrypted file is in a format not supported by this version of git-crypt - please upgrade git-crypt" << std::endl;
+		return 1;
+	}
+
+	const Key_file::Entry*	key = key_file.get(header.key_version);
+	if (!key) {
+		log << "git-crypt: error: key version " << header.key_version << " not available - please unlock with the latest version of the key." << std::endl;
+		return 1;
+	}
+	if (header.is_content_defined) {
+		return decrypt_cdc_file(*key, header, stored_header, in, out, log);
+	}
+
+	std::unique_ptr<Zlib_decompress_ostream> decompressed_out;
+	if (header.compression == Chunked_header::COMPRESSION_ZLIB) {
+		decompressed_out.reset(new Zlib_decompress_ostream(out));
+	}
+	std::ostream&		plaintext_out = decompressed_out ? *decompressed_out : out;
+
+	const Chunk_cipher	cipher(*key, header, stored_header);
+	unsigned int		threads = 1;
+	size_t			batch_chunks = std::max<size_t>(PARALLEL_CRYPT_CHUNK_SIZE / header.chunk_size, 1);
+	std::vector<unsigned char> in_buffer(cipher.get_encrypted_len(batch_chunks * header.chunk_size, false));
+	std::vector<unsigned char> out_buffer(batch_chunks * header.chunk_size);
+	std::unique_ptr<Thread_pool> pool;	// must be destroyed before the buffers
+	uint64_t		index = 0;
+	uint64_t		file_size = 0;
+	while (true) {
+		in.read(reinterpret_cast<char*>(&in_buffer[0]), in_buffer.size());
+		const size_t	len = in.gcount();
+		const bool	ends_file = len < in_buffer.size() || in.peek() == -1;
+		size_t		out_len;
+		if (!cipher.decrypt(index, ends_file, &in_buffer[0], len, &out_buffer[0], out_len, pool.get())) {
+			log << "git-crypt: error: encrypted file has been tampered with!" << std::endl;
+			return 1;
+		}
+		plaintext_out.write(reinterpret_cast<char*>(&out_buffer[0]), out_len);
+		if (ends_file) {
+			break;
+		}
+		index += batch_chunks;
+
+		// As in decrypt_file, switch to multiple threads once we've seen enough data
+		file_size += out_len;
+		if (threads == 1 && file_size >= PARALLEL_CRYPT_MIN_BYTES) {
+			threads = get_crypt_threads();
+			batch_chunks = std::max<size_t>(get_crypt_batch_size(threads) / header.chunk_size, 1);
+			in_buffer.resize(cipher.get_encrypted_len(batch_chunks * header.chunk_size, false));
+			out_buffer.resize(batch_chunks * header.chunk_size);
+			if (threads > 1) {
+				pool.reset(new Thread_pool(threads));
+			}
+		}
+	}
+
+	if (decompressed_out && !decompressed_out->finish()) {
+		// As with decrypt_cdc_file, the data is authentic, so this shouldn't happen
+		log << "git-crypt: error: encrypted file has malformed compressed data" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+// Decrypt contents of in and write to out
+static int decrypt_file (const Key_file& key_file, std::istream& in, std::ostream& out, std::ostream& log =std::clog)
+{
+	// Read the header to get the format and nonce, and make sure it's actually encrypted
+	unsigned char		header[10 + Aes_ctr_decryptor::NONCE_LEN];
+	in.read(reinterpret_cast<char*>(header), 10);
+	size_t			header_len = in.gcount();
+	if (header_len == 10 && std::memcmp(header, "\0GITCRYPT\2", 10) == 0) {
+		return decrypt_chunked_file(key_file, in, out, log);
+	}
+	if (header_len == 10) {
+		in.read(reinterpret_cast<char*>(header) + 10, Aes_ctr_decryptor::NONCE_LEN);
+		header_len += in.gcount();
+	}
+	if (header_len != sizeof(header) || std::memcmp(header, "\0GITCRYPT\0", 10) != 0) {
+		// File not encrypted - just copy it out
+		log << "git-crypt: Warning: file not encrypted" << std::endl;
+		log << "git-crypt: Run 'git-crypt status' to make sure all files are properly encrypted." << std::endl;
+		log << "git-crypt: If 'git-crypt status' reports no problems, then an older version of" << std::endl;
+		log << "git-crypt: this file may be unencrypted in the repository's history.  If this" << std::endl;
+		log << "git-crypt: file contains sensitive information, you can use 'git filter-branch'" << std::endl;
+		log << "git-crypt: to remove its old versions from the history." << std::endl;
+		out.write(reinterpret_cast<char*>(header), header_len); // include the bytes which we already read
+		if (in.peek() != -1) {
+			out << in.rdbuf();
+		}
+		return 0;
+	}
+
+	return decrypt_file(key_file, header, in, out, log);
+}
+
+// Decrypt contents of stdin and write to stdout
+int smudge (int argc, const char** argv)
+{
+	const char*		key_name = 0;
+	const char*		key_path = 0;
+	const char*		legacy_key_path = 0;
+
+	int			argi = parse_plumbing_options(&key_name, &key_path, argc, argv);
+	if (argc - argi == 0) {
+	} else if (!key_name && !key_path && argc - argi == 1) { // Deprecated - for compatibility with pre-0.4
+		legacy_key_path = argv[argi];
+	} else {
+		std::clog << "Usage: git-crypt smudge [--key-name=NAME] [--key-file=PATH]" << std::endl;
+		return 2;
+	}
+	Key_file		key_file;
+	load_key(key_file, key_name, key_path, legacy_key_path);
+
+	return decrypt_file(key_file, std::cin, std::cout);
+}
+
+int diff (int argc, const char** argv)
+{
+	const char*		key_name = 0;
+	const char*		key_path = 0;
+	const char*		filename = 0;
+	const char*		legacy_key_path = 0;
+
+	int			argi = parse_plumbing_options(&key_name, &key_path, argc, argv);
+	if (argc - argi == 1) {
+		filename = argv[argi];
+	} else if (!key_name && !key_path && argc - argi == 2) { // Deprecated - for compatibility with pre-0.4
+		legacy_key_path = argv[argi];
+		filename = argv[argi + 1];
+	} else {
+		std::clog << "Usage: git-crypt diff [--key-name=NAME] [--key-file=PATH] FILENAME" << std::endl;
+		return 2;
+	}
+	Key_file		key_file;
+	load_key(key_file, key_name, key_path, legacy_key_path);
+
+	// Open the file
+	std::ifstream		in(filename, std::fstream::binary);
+	if (!in) {
+		std::clog << "git-crypt: " << filename << ": unable to open for reading" << std::endl;
+		return 1;
+	}
+	in.exceptions(std::fstream::badbit);
+
+	// Read the header to get the format and nonce, and determine if it's actually encrypted
+	unsigned char		header[10 + Aes_ctr_decryptor::NONCE_LEN];
+	in.read(reinterpret_cast<char*>(header), 10);
+	size_t			header_len = in.gcount();
+	if (header_len == 10 && std::memcmp(header, "\0GITCRYPT\2", 10) == 0) {
+		return decrypt_chunked_file(key_file, in, std::cout);
+	}
+	if (header_len == 10) {
+		in.read(reinterpret_cast<char*>(header) + 10, Aes_ctr_decryptor::NONCE_LEN);
+		header_len += in.gcount();
+	}
+	if (header_len != sizeof(header) || std::memcmp(header, "\0GITCRYPT\0", 10) != 0) {
+		// File not encrypted - just copy it out to stdout
+		std::cout.write(reinterpret_cast<char*>(header), header_len); // include the bytes which we already read
+		std::cout << in.rdbuf();
+		return 0;
+	}
+
+	// Go ahead and decrypt it
+	return decrypt_file(key_file, header, in, std::cout);
+}
+
+// Collects what's written to it in a string, refusing any write which would take
+// it past max_len bytes
+class Bounded_string_buf : public std::streambuf {
+	std::string&		str;
+	size_t			max_len;
+	bool			is_overflowed;
+
+protected:
+	virtual int_type	overflow (int_type ch =traits_type::eof())
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof())) {
+			return traits_type::not_eof(ch);
+		}
+		const char	c = traits_type::to_char_type(ch);
+		return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+	}
+
+	virtual std::streamsize	xsputn (const char* s, std::streamsize n)
+	{
+		if (static_cast<size_t>(n) > max_len - str.size()) {
+			is_overflowed = true;
+			return 0;
+		}
+		str.append(s, n);
+		return n;
+	}
+
+public:
+	Bounded_string_buf (std::string& arg_str, size_t arg_max_len) : str(arg_str), max_len(arg_max_len), is_overflowed(false) { }
+
+	bool			overflowed () const { return is_overflowed; }
+};
+
+// Smudge requests which Git has let us delay (see the "delay" capability in
+// gitattributes(5)).  They are decrypted in the background by a pool of
+// worker threads, so a checkout of many small files uses every CPU.
+//
+// Decrypted files are held in memory until Git asks for them, so a file which
+// decrypts (or decompresses) to more than MAX_DECRYPTED_BYTES is left encrypted,
+// to be decrypted straight into Git's pipe when it's asked for.
+class Delayed_smudges {
+	struct Entry {
+		std::string	content;	// the encrypted file, and then the decrypted file (if is_decrypted)
+		std::string	log;		// error messages from decrypting the file
+		int		status;
+		bool		is_decrypted;
+		bool		is_done;
+		bool		is_listed;
+
+		Entry () : status(0), is_decrypted(false), is_done(false), is_listed(false) { }
+	};
+
+	enum {
+		MAX_BYTES = 268435456,		// # of bytes of file contents we're willing to hold in memory
+		MAX_DECRYPTED_BYTES = 16777216	// # of bytes of a single decrypted file
+	};
+
+	const Key_file&			key_file;
+	std::map<std::string, Entry>	entries;
+	size_t				total_bytes;
+	std::mutex			mutex;
+	std::condition_variable		entry_done;
+	std::unique_ptr<Thread_pool>	pool;	// must be destroyed before entries
+
+	void				decrypt (Entry*);
+
+public:
+	explicit Delayed_smudges (const Key_file& k) : key_file(k), total_bytes(0) { }
+
+	// Returns false if the file should be decrypted right away instead
+	bool				add (const std::string& pathname, std::string& file_contents);
+
+	bool				has (const std::string& pathname);
+
+	// Wait until at least one delayed file has been decrypted, and return the paths
+	// of the files which have been decrypted since the last call
+	std::vector<std::string>	wait_for_available ();
+
+	// Wait until the given file has been decrypted, and remove it.  If it was too large to
+	// hold in memory, file_contents is still encrypted and is_decrypted is set to false.
+	int				take (const std::string& pathname, std::string& file_contents, std::string& log, bool& is_decrypted);
+};
+
+void Delayed_smudges::decrypt (Entry* entry)
+{
+	std::istringstream	in(entry->content);
+	std::string		plaintext;
+	Bounded_string_buf	out_buf(plaintext, MAX_DECRYPTED_BYTES);
+	std::ostream		out(&out_buf);
+	std::ostringstream	log;
+	int			status = 1;
+	// Whatever happens, the entry must be marked done, or take() would wait forever
+	try {
+		status = decrypt_file(key_file, in, out, log);
+	} catch (const Error& e) {
+		log << "git-crypt: error: " << e.message << std::endl;
+	} catch (const System_error& e) {
+		log << "git-crypt: error: " << e.message() << std::endl;
+	} catch (const Crypto_error& e) {
+		log << "git-crypt: error: " << e.where << ": " << e.message << std::endl;
+	} catch (const Compression_error& e) {
+		log << "git-crypt: error: " << e.message << std::endl;
+	} catch (const std::exception& e) {
+		log << "git-crypt: error: " << e.what() << std::endl;
+	} catch (...) {
+		log << "git-crypt: error: unexpected error while decrypting" << std::endl;
+	}
+
+	std::lock_guard<std::mutex>	lock(mutex);
+	if (!out_buf.overflowed()) {
+		total_bytes += plaintext.size();
+		total_bytes -= std::min(total_bytes, entry->content.size());
+		entry->content.swap(plaintext);
+		entry->log = log.str();
+		entry->status = status;
+		entry->is_decrypted = true;
+	}
+	entry->is_done = true;
+	entry_done.notify_all();
+}
+
+bool Delayed_smudges::add (const std::string& pathname, std::string& file_contents)
+{
+	std::lock_guard<std::mutex>	lock(mutex);
+	if (entries.count(pathname) || total_bytes + file_contents.size() > MAX_BYTES) {
+		return false;
+	}
+	if (!pool) {
+		pool.reset(new Thread_pool(get_crypt_threads()));
+	}
+
+	Entry*				entry = &entries[pathname];
+	entry->content.swap(file_contents);
+	total_bytes += entry->content.size();
+	pool->submit(std::bind(&Delayed_smudges::decrypt, this, entry));
+	return true;
+}
+
+bool Delayed_smudges::has (const std::string& pathname)
+{
+	std::lock_guard<std::mutex>	lock(mutex);
+	return entries.count(pathname) != 0;
+}
+
+std::vector<std::string> Delayed_smudges::wait_for_available ()
+{
+	std::unique_lock<std::mutex>	lock(mutex);
+	std::vector<std::string>	pathnames;
+	while (true) {
+		bool			is_pending = false;
+		for (std::map<std::string, Entry>::iterator it(entries.begin()); it != entries.end(); ++it) {
+			if (!it->second.is_done) {
+				is_pending = true;
+			} else if (!it->second.is_listed) {
+				it->second.is_listed = true;
+				pathnames.push_back(it->first);
 			}
-			if (!same_key_name(key_name, this_version_key_file.get_key_name())) {
-				throw Error("GPG-encrypted keyfile is malformed because it does not contain expected key name");
+		}
+		if (!pathnames.empty() || !is_pending) {
+			return pathnames;
+		}
+		entry_done.wait(lock);
+	}
+}
+
+int Delayed_smudges::take (const std::string& pathname, std::string& file_contents, std::string& log, bool& is_decrypted)
+{
+	std::unique_lock<std::mutex>	lock(mutex);
+	Entry&				entry = entries[pathname];
+	while (!entry.is_done) {
+		entry_done.wait(lock);
+	}
+	const int			status = entry.status;
+	is_decrypted = entry.is_decrypted;
+	file_contents.swap(entry.content);
+	log.swap(entry.log);
+	total_bytes -= std::min(total_bytes, file_contents.size());
+	entries.erase(pathname);
+	return status;
+}
+
+// Respond to one clean or smudge request from Git, whose content is read from in
+// Like `git config --type=bool`, with a missing setting being false
+static bool get_git_config_bool (const std::string& name)
+{
+	if (!git_has_config(name)) {
+		return false;
+	}
+	try {
+		return !is_false(get_git_config(name));
+	} catch (const Error&) {
+		// a bare setting with no value means true
+		return true;
+	}
+}
+
+static std::string get_plaintext_cache_path (const char* key_name)
+{
+	return get_internal_state_path() + "/cache/" + (key_name ? key_name : "default");
+}
+
+// returns the size budget of the plaintext cache (git-crypt.plaintextCacheSize), which
+// like Git's sizes may have a k, m, or g suffix
+static uint64_t get_plaintext_cache_size ()
+{
+	uint64_t	size = uint64_t(2) << 30;
+	try {
+		const std::string	value(get_git_config("git-crypt.plaintextCacheSize"));
+		char*			end;
+		uint64_t		parsed_size = std::strtoull(value.c_str(), &end, 10);
+		switch (std::tolower(*end)) {
+		case 'k':	parsed_size <<= 10; ++end; break;
+		case 'm':	parsed_size <<= 20; ++end; break;
+		case 'g':	parsed_size <<= 30; ++end; break;
+		}
+		if (end != value.c_str() && *end == '\0') {
+			size = parsed_size;
+		}
+	} catch (const Error&) {
+		// git-crypt.plaintextCacheSize not set
+	}
+	return size;
+}
+
+// Like Git's "racily clean" check: a file modified within a couple of seconds of now
+// could be modified again without its (possibly coarse) timestamps changing
+static bool is_racy (const File_stamp& stamp)
+{
+	const int64_t		cutoff_ns = (static_cast<int64_t>(std::time(nullptr)) - 2) * 1000000000;
+	return stamp.mtime_ns >= cutoff_ns || stamp.ctime_ns >= cutoff_ns;
+}
+
+// Cleans files for the filter process with the help of a Clean_cache.  The cached nonce
+// is only used if the file's stamp is unchanged since it was cached and the contents Git
+// gave us are the same as the file in the working tree.  Then, if the index's blob for
+// the file is the encrypted file with that nonce, it's copied out of `git cat-file`;
+// otherwise the file is encrypted with the nonce, without computing its HMAC.
+class Cached_cleaner {
+	const Key_file&			key_file;
+	std::string			key_id;
+	std::string			cache_path;
+	Clean_cache			cache;
+	std::unique_ptr<Cat_file_batch>	cat_file;
+	bool				can_read_index;
+
+	bool		is_file_unchanged (const std::string& path, const File_stamp& stamp, const std::string& file_contents, temp_fstream& temp_file);
+	bool		copy_index_blob (const std::string& path, const std::string& nonce, uint64_t file_size, std::ostream& out);
+
+			Cached_cleaner (const Cached_cleaner&);	// Disallow copy
+	Cached_cleaner&	operator= (const Cached_cleaner&);	// Disallow assignment
+public:
+	Cached_cleaner (const Key_file& key_file, const char* key_name);
+
+	// Like encrypt_file(), for the file at path (relative to the top of the working tree)
+	int		clean (const std::string& path, std::istream& in, std::ostream& out);
+
+	// Saves the cache if it has changed, ignoring errors
+	void		save ();
+};
+
+Cached_cleaner::Cached_cleaner (const Key_file& arg_key_file, const char* key_name)
+: key_file(arg_key_file),
+  cache_path(get_internal_state_path() + "/clean-cache/" + (key_name ? key_name : "default")),
+  can_read_index(std::getenv("GIT_INDEX_FILE") == nullptr) // a temporary index may be half-written
+{
+	if (const Key_file::Entry* key = key_file.get_latest()) {
+		static const char	label[] = "git-crypt clean cache";
+		unsigned char		digest[Hmac_sha1_state::LEN];
+		Hmac_sha1_state		hmac(key->hmac_key, HMAC_KEY_LEN);
+		hmac.add(reinterpret_cast<const unsigned char*>(label), sizeof(label) - 1);
+		hmac.get(digest);
+
+		std::ostringstream	id;
+		id << key_file.latest() << ':' << hex_encode(digest, sizeof(digest));
+		key_id = id.str();
+	}
+
+	std::ifstream			in(cache_path.c_str(), std::fstream::binary);
+	if (in && !cache.load(in)) {
+		cache = Clean_cache();
+	}
+}
+
+bool		Cached_cleaner::is_file_unchanged (const std::string& path, const File_stamp& stamp, const std::string& file_contents, temp_fstream& temp_file)
+{
+	std::ifstream			file_in(path.c_str(), std::fstream::binary);
+	std::vector<char>		file_buffer(65536);
+	std::vector<char>		contents_buffer(65536);
+
+	const char*			contents = file_contents.data();
+	size_t				contents_len = file_contents.size();
+	while (contents_len > 0) {
+		file_in.read(&file_buffer[0], std::min(contents_len, file_buffer.size()));
+		const size_t		len = file_in.gcount();
+		if (len == 0 || std::memcmp(&file_buffer[0], contents, len) != 0) {
+			return false;
+		}
+		contents += len;
+		contents_len -= len;
+	}
+	if (temp_file.is_open()) {
+		temp_file.clear();
+		temp_file.seekg(0);
+		while (temp_file.peek() != -1) {
+			temp_file.read(&contents_buffer[0], contents_buffer.size());
+			const size_t		len = temp_file.gcount();
+			file_in.read(&file_buffer[0], len);
+			if (static_cast<size_t>(file_in.gcount()) != len || std::memcmp(&file_buffer[0], &contents_buffer[0], len) != 0) {
+				temp_file.clear();
+				return false;
 			}
-			key_file.set_key_name(key_name);
-			key_file.add(*this_version_entry);
-			return true;
 		}
+		temp_file.clear();
+	}
+	if (!file_in || file_in.peek() != -1) {
+		return false;
 	}
 
-	if (gpg_error) {
-		std::rethrow_exception(gpg_error);
+	// Make sure the file didn't change while we were reading it
+	File_stamp			new_stamp;
+	return get_file_stamp(path, new_stamp) && new_stamp == stamp;
+}
+
+bool		Cached_cleaner::copy_index_blob (const std::string& path, const std::string& nonce, uint64_t file_size, std::ostream& out)
+{
+	if (!can_read_index || path.find('\n') != std::string::npos) {
+		return false;
 	}
 
-	return false;
+	unsigned char			header[10 + Aes_ctr_encryptor::NONCE_LEN];
+	try {
+		if (!cat_file) {
+			cat_file.reset(new Cat_file_batch);
+		}
+		std::string		type;
+		uint64_t		size;
+		if (!cat_file->open(":0:" + path, &type, &size) || type != "blob" || size != sizeof(header) + file_size) {
+			return false;
+		}
+		if (cat_file->read(reinterpret_cast<char*>(header), sizeof(header)) != sizeof(header)) {
+			return false;
+		}
+	} catch (const Error&) {
+		// Don't try again, in case the index is being rewritten
+		can_read_index = false;
+		return false;
+	}
+	if (std::memcmp(header, "\0GITCRYPT\0", 10) != 0 || hex_encode(header + 10, Aes_ctr_encryptor::NONCE_LEN) != nonce) {
+		return false;
+	}
+
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	char				buffer[65536];
+	size_t				len;
+	while ((len = cat_file->read(buffer, sizeof(buffer))) > 0) {
+		out.write(buffer, len);
+	}
+	return true;
 }
 
-static bool decrypt_repo_keys (std::vector<Key_file>& key_files, uint32_t key_version, const std::vector<std::string>& secret_keys, const std::string& keys_path)
+int		Cached_cleaner::clean (const std::string& path, std::istream& in, std::ostream& out)
 {
-	bool				successful = false;
-	std::vector<std::string>	dirents;
+	const Key_file::Entry*		key = key_file.get_latest();
+	if (!key) {
+		std::clog << "git-crypt: error: key file is empty" << std::endl;
+		return 1;
+	}
 
-	if (access(keys_path.c_str(), F_OK) == 0) {
-		dirents = get_directory_contents(keys_path.c_str());
+	// If the file looks unchanged since it was cached, don't bother computing its HMAC yet
+	const Clean_cache::Entry*	entry = cache.get(path);
+	File_stamp			stamp;
+	const bool			may_be_cached = entry && entry->key_id == key_id && get_file_stamp(path, stamp) && stamp == entry->stamp;
+
+	Hmac_sha1_state			hmac(key->hmac_key, HMAC_KEY_LEN);
+	std::string			file_contents;
+	temp_fstream			temp_file;
+	const uint64_t			file_size = spool_file(in, file_contents, temp_file, may_be_cached ? nullptr : &hmac);
+	if (file_size >= Aes_ctr_encryptor::MAX_CRYPT_BYTES) {
+		std::clog << "git-crypt: error: file too long to encrypt securely" << std::endl;
+		return 1;
 	}
 
-	for (std::vector<std::string>::const_iterator dirent(dirents.begin()); dirent != dirents.end(); ++dirent) {
-		const char*		key_name = 0;
-		if (*dirent != "default") {
-			if (!validate_key_name(dirent->c_str())) {
-				continue;
+	if (may_be_cached && is_file_unchanged(path, stamp, file_contents, temp_file)) {
+		// The cached nonce is still good, so the file needn't go through HMAC, and if
+		// the index already has the encrypted file, it needn't go through AES either
+		unsigned char		nonce[Aes_ctr_encryptor::NONCE_LEN];
+		if (hex_decode(entry->nonce, nonce, sizeof(nonce))) {
+			if (!copy_index_blob(path, entry->nonce, file_size, out)) {
+				write_encrypted_file(*key, nonce, file_size, file_contents, temp_file, out);
 			}
-			key_name = dirent->c_str();
+			return 0;
 		}
+	}
+	if (may_be_cached) {
+		hmac_spooled_file(hmac, file_contents, temp_file);
+	}
 
-		Key_file	key_file;
-		if (decrypt_repo_key(key_file, key_name, key_version, secret_keys, keys_path)) {
-			key_files.push_back(key_file);
-			successful = true;
+	unsigned char			digest[Hmac_sha1_state::LEN];
+	hmac.get(digest);
+	write_encrypted_file(*key, digest, file_size, file_contents, temp_file, out);
+
+	// Remember the result, unless the file in the working tree isn't what Git gave us
+	// (e.g. `git hash-object --stdin --path`), or it's racy
+	if (get_file_stamp(path, stamp) && !is_racy(stamp) && is_file_unchanged(path, stamp, file_contents, temp_file)) {
+		Clean_cache::Entry	new_entry;
+		new_entry.stamp = stamp;
+		new_entry.key_id = key_id;
+		new_entry.nonce = hex_encode(digest, Aes_ctr_encryptor::NONCE_LEN);
+		if (!entry || entry->stamp != new_entry.stamp || entry->key_id != new_entry.key_id || entry->nonce != new_entry.nonce) {
+			cache.set(path, new_entry);
 		}
+	} else {
+		cache.remove(path);
 	}
-	return successful;
+	return 0;
 }
 
-static void encrypt_repo_key (const char* key_name, const Key_file::Entry& key, const std::vector<std::pair<std::string, bool> >& collab_keys, const std::string& keys_path, std::vector<std::string>* new_files)
+void		Cached_cleaner::save ()
 {
-	std::string	key_file_data;
-	{
-		Key_file this_version_key_file;
-		this_version_key_file.set_key_name(key_name);
-		this_version_key_file.add(key);
-		key_file_data = this_version_key_file.store_to_string();
+	if (cat_file) {
+		try {
+			cat_file->close();
+		} catch (const Error&) {
+		}
+	}
+	if (!cache.has_changed()) {
+		return;
+	}
+
+	std::ostringstream		out;
+	cache.store(out);
+	const std::string		data(out.str());
+	try {
+		mkdir_parent(cache_path);
+		replace_protected_file(cache_path, data.data(), data.size());
+	} catch (const System_error&) {
+		// It's only a cache
+	}
+}
+
+// Decrypt a file read by spool_file(), adding it to plaintext_cache as the given blob
+static int decrypt_file_to_cache (const Key_file& key_file, Plaintext_cache& plaintext_cache, const std::string& object_id, temp_fstream& temp_file, std::ostream& out)
+{
+	// Only cache files which are actually encrypted
+	char				header[10];
+	temp_file.read(header, sizeof(header));
+	const bool			is_encrypted = temp_file.gcount() == sizeof(header) && is_encrypted_header(header);
+	temp_file.clear();
+	temp_file.seekg(0);
+
+	std::string			temp_path;
+	std::ofstream			plaintext_out;
+	if (!is_encrypted || !plaintext_cache.start_add(object_id, temp_path, plaintext_out)) {
+		return decrypt_file(key_file, temp_file, out);
+	}
+
+	std::ostringstream		log;
+	const int			status = decrypt_file(key_file, temp_file, plaintext_out, log);
+	plaintext_out.close();
+	std::ifstream			plaintext_in(temp_path.c_str(), std::fstream::binary);
+	if (status != 0 || !plaintext_out || !plaintext_in) {
+		// Do it again without the cache, to write the file and any errors to the right place
+		remove_file(temp_path);
+		temp_file.clear();
+		temp_file.seekg(0);
+		return decrypt_file(key_file, temp_file, out);
+	}
+
+	out << plaintext_in.rdbuf();
+	plaintext_in.close();
+	plaintext_cache.finish_add(object_id, temp_path);
+	return 0;
+}
+
+static void filter_process_request (const Key_file& key_file, Delayed_smudges* delayed, Cached_cleaner* cleaner, Plaintext_cache* plaintext_cache, std::unique_ptr<Check_attr_batch>& check_attr, const std::string& command, const std::string& pathname, const std::string& blob_id, bool can_delay, std::istream& in)
+{
+	File_format		format = FORMAT_ORIGINAL;
+	Chunked_header		parameters;
+	if (command == "clean" && !get_file_format(check_attr, pathname, format, parameters)) {
+		std::clog << "git-crypt: error: " << pathname << ": unknown or unsupported git-crypt-format, git-crypt-compress or git-crypt-cipher attribute" << std::endl;
+		write_pkt_text(std::cout, "status=error");
+		write_flush_pkt(std::cout);
+		return;
+	}
+
+	if (command != "clean" && command != "smudge") {
+		write_pkt_text(std::cout, "status=error");
+		write_flush_pkt(std::cout);
+		return;
+	}
+
+	// Git doesn't read our response until it has written the entire request,
+	// so read all of the input before writing anything to avoid deadlocking
+	// with Git.  (encrypt_file and Cached_cleaner do this themselves.)
+	std::string		file_contents;
+	temp_fstream		temp_file;
+	std::string		delayed_log;
+	int			delayed_status = 0;
+	bool			is_delayed_result = false;
+	std::ifstream		cached_plaintext;
+	if (command == "smudge" && plaintext_cache && !blob_id.empty() && !(delayed && delayed->has(pathname)) && plaintext_cache->open(blob_id, cached_plaintext)) {
+		// We've decrypted this blob before, so its contents aren't needed
+		in.ignore(std::numeric_limits<std::streamsize>::max());
+	} else if (command == "smudge") {
+		spool_file(in, file_contents, temp_file);
+
+		if (delayed && delayed->has(pathname)) {
+			// Git is asking for a file we delayed earlier (with empty content)
+			delayed_status = delayed->take(pathname, file_contents, delayed_log, is_delayed_result);
+		} else if (delayed && can_delay && !temp_file.is_open() && delayed->add(pathname, file_contents)) {
+			write_pkt_text(std::cout, "status=delayed");
+			write_flush_pkt(std::cout);
+			return;
+		}
 	}
 
-	for (std::vector<std::pair<std::string, bool> >::const_iterator collab(collab_keys.begin()); collab != collab_keys.end(); ++collab) {
-		const std::string&	fingerprint(collab->first);
-		const bool		key_is_trusted(collab->second);
-		std::ostringstream	path_builder;
-		path_builder << keys_path << '/' << (key_name ? key_name : "default") << '/' << key.version << '/' << fingerprint << ".gpg";
-		std::string		path(path_builder.str());
+	write_pkt_text(std::cout, "status=success");
+	write_flush_pkt(std::cout);
 
-		if (access(path.c_str(), F_OK) == 0) {
-			continue;
+	int			status;
+	{
+		Pkt_line_writer	out(std::cout);
+		if (command == "clean" && (format == FORMAT_CHUNKED || format == FORMAT_CDC)) {
+			status = encrypt_chunked_file(key_file, format == FORMAT_CDC, parameters, in, out.content());
+		} else if (command == "clean" && cleaner) {
+			status = cleaner->clean(pathname, in, out.content());
+		} else if (command == "clean") {
+			status = encrypt_file(key_file, in, out.content());
+		} else if (cached_plaintext.is_open()) {
+			out.content() << cached_plaintext.rdbuf();
+			status = 0;
+		} else if (is_delayed_result) {
+			std::clog << delayed_log;
+			out.content().write(file_contents.data(), file_contents.size());
+			status = delayed_status;
+		} else if (temp_file.is_open() && plaintext_cache && !blob_id.empty()) {
+			// (only large files, which are spooled into temp_file, are worth caching)
+			status = decrypt_file_to_cache(key_file, *plaintext_cache, blob_id, temp_file, out.content());
+		} else if (temp_file.is_open()) {
+			status = decrypt_file(key_file, temp_file, out.content());
+		} else {
+			std::istringstream	file_in(file_contents);
+			status = decrypt_file(key_file, file_in, out.content());
 		}
+		out.content().flush();
+	}
+	write_flush_pkt(std::cout);
 
-		mkdir_parent(path);
-		gpg_encrypt_to_file(path, fingerprint, key_is_trusted, key_file_data.data(), key_file_data.size());
-		new_files->push_back(path);
+	// The status sent before the content stands unless we send a new one after it
+	if (status != 0) {
+		write_pkt_text(std::cout, "status=error");
 	}
+	write_flush_pkt(std::cout);
 }
 
-static int parse_plumbing_options (const char** key_name, const char** key_file, int argc, const char** argv)
+// Respond to a list_available_blobs request from Git
+static void filter_process_list_available_blobs (Delayed_smudges* delayed)
 {
-	Options_list	options;
-	options.push_back(Option_def("-k", key_name));
-	options.push_back(Option_def("--key-name", key_name));
-	options.push_back(Option_def("--key-file", key_file));
-
-	return parse_options(options, argc, argv);
+	if (delayed) {
+		const std::vector<std::string>	pathnames(delayed->wait_for_available());
+		for (std::vector<std::string>::const_iterator pathname(pathnames.begin()); pathname != pathnames.end(); ++pathname) {
+			write_pkt_text(std::cout, "pathname=" + *pathname);
+		}
+	}
+	write_flush_pkt(std::cout);
+	write_pkt_text(std::cout, "status=success");
+	write_flush_pkt(std::cout);
 }
 
-// Encrypt contents of stdin and write to stdout
-int clean (int argc, const char** argv)
+// Filter files for Git using the long-running filter process protocol, which
+// lets a single git-crypt process handle every file in a checkout or commit
+// (see gitattributes(5))
+int filter_process (int argc, const char** argv)
 {
 	const char*		key_name = 0;
 	const char*		key_path = 0;
-	const char*		legacy_key_path = 0;
 
 	int			argi = parse_plumbing_options(&key_name, &key_path, argc, argv);
-	if (argc - argi == 0) {
-	} else if (!key_name && !key_path && argc - argi == 1) { // Deprecated - for compatibility with pre-0.4
-		legacy_key_path = argv[argi];
-	} else {
-		std::clog << "Usage: git-crypt clean [--key-name=NAME] [--key-file=PATH]" << std::endl;
+	if (argc - argi != 0) {
+		std::clog << "Usage: git-crypt filter-process [--key-name=NAME] [--key-file=PATH]" << std::endl;
 		return 2;
 	}
 	Key_file		key_file;
-	load_key(key_file, key_name, key_path, legacy_key_path);
+	load_key(key_file, key_name, key_path);
 
-	const Key_file::Entry*	key = key_file.get_latest();
-	if (!key) {
-		std::clog << "git-crypt: error: key file is empty" << std::endl;
-		return 1;
+	// 1. Handshake
+	std::string		line;
+	if (!read_pkt_text(std::cin, line) || line != "git-filter-client") {
+		throw Error("Unexpected welcome message from Git filter process client");
 	}
+	bool			supports_version_2 = false;
+	while (read_pkt_text(std::cin, line)) {
+		if (line == "version=2") {
+			supports_version_2 = true;
+		}
+	}
+	if (!supports_version_2) {
+		throw Error("Git filter process client does not support protocol version 2");
+	}
+	write_pkt_text(std::cout, "git-filter-server");
+	write_pkt_text(std::cout, "version=2");
+	write_flush_pkt(std::cout);
+	std::cout.flush();
+
+	// 2. Capabilities
+	std::vector<std::string>	capabilities;
+	std::unique_ptr<Delayed_smudges> delayed;
+	while (read_pkt_text(std::cin, line)) {
+		if (line == "capability=clean" || line == "capability=smudge") {
+			capabilities.push_back(line);
+		} else if (line == "capability=delay") {
+			capabilities.push_back(line);
+			delayed.reset(new Delayed_smudges(key_file));
+		}
+	}
+	for (std::vector<std::string>::const_iterator capability(capabilities.begin()); capability != capabilities.end(); ++capability) {
+		write_pkt_text(std::cout, *capability);
+	}
+	write_flush_pkt(std::cout);
+	std::cout.flush();
 
-	// Read the entire file
-
-	Hmac_sha1_state	hmac(key->hmac_key, HMAC_KEY_LEN); // Calculate the file's SHA1 HMAC as we go
-	uint64_t		file_size = 0;	// Keep track of the length, make sure it doesn't get too big
-	std::string		file_contents;	// First 8MB or so of the file go here
-	temp_fstream		temp_file;	// The rest of the file spills into a temporary file on disk
-	temp_file.exceptions(std::fstream::badbit);
-
-	char			buffer[1024];
-
-	while (std::cin && file_size < Aes_ctr_encryptor::MAX_CRYPT_BYTES) {
-		std::cin.read(buffer, sizeof(buffer));
-
-		const size_t	bytes_read = std::cin.gcount();
-
-		hmac.add(reinterpret_cast<unsigned char*>(buffer), bytes_read);
-		file_size += bytes_read;
-
-		if (file_size <= 8388608) {
-			file_contents.append(buffer, bytes_read);
+	std::unique_ptr<Cached_cleaner>	cleaner;
+	if (get_git_config_bool("git-crypt.cleanCache")) {
+		if (can_protect_files()) {
+			cleaner.reset(new Cached_cleaner(key_file, key_name));
 		} else {
-			if (!temp_file.is_open()) {
-				temp_file.open(std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::app);
+			// The cache records the HMAC of each file's plaintext, so it mustn't be readable
+			// by others.  (This is always the case on Windows, where the cache is unsupported.)
+			std::clog << "git-crypt: warning: git-crypt.cleanCache is not supported on this platform, because its cache can't be protected from other users; ignoring it" << std::endl;
+		}
+	}
+	std::unique_ptr<Plaintext_cache> plaintext_cache;
+	if (get_git_config_bool("git-crypt.plaintextCache")) {
+		if (can_protect_files()) {
+			plaintext_cache.reset(new Plaintext_cache(get_plaintext_cache_path(key_name), get_plaintext_cache_size()));
+		} else {
+			// The cache holds decrypted files, so the same goes for it as for the clean cache
+			std::clog << "git-crypt: warning: git-crypt.plaintextCache is not supported on this platform, because its decrypted files can't be protected from other users; ignoring it" << std::endl;
+		}
+	}
+	std::unique_ptr<Check_attr_batch> check_attr;	// started by the first clean request
+
+	// 3. Requests, until Git closes our stdin
+	while (std::cin.peek() != -1) {
+		std::string		command;
+		std::string		pathname;
+		std::string		blob_id;	// sent by Git 2.27 and higher
+		bool			can_delay = false;
+		while (read_pkt_text(std::cin, line)) {
+			if (line.compare(0, 8, "command=") == 0) {
+				command = line.substr(8);
+			} else if (line.compare(0, 9, "pathname=") == 0) {
+				pathname = line.substr(9);
+			} else if (line.compare(0, 5, "blob=") == 0) {
+				blob_id = line.substr(5);
+			} else if (line == "can-delay=1") {
+				can_delay = true;
 			}
-			temp_file.write(buffer, bytes_read);
 		}
+
+		if (command == "list_available_blobs") {
+			// this command has no content
+			filter_process_list_available_blobs(delayed.get());
+		} else {
+			Pkt_line_reader	in(std::cin);
+			filter_process_request(key_file, delayed.get(), cleaner.get(), plaintext_cache.get(), check_attr, command, pathname, blob_id, can_delay, in.content());
+			in.skip_rest();
+		}
+		std::cout.flush();
 	}
 
-	// Make sure the file isn't so large we'll overflow the counter value (which would doom security)
-	if (file_size >= Aes_ctr_encryptor::MAX_CRYPT_BYTES) {
-		std::clog << "git-crypt: error: file too long to encrypt securely" << std::endl;
-		return 1;
+	if (cleaner) {
+		cleaner->save();
+	}
+	if (plaintext_cache) {
+		plaintext_cache->evict();
+	}
+	if (check_attr) {
+		check_attr->close();
 	}
 
-	// We use an HMAC of the file as the encryption nonce (IV) for CTR mode.
-	// By using a hash of the file we ensure that the encryption is
-	// deterministic so git doesn't think the file has changed when it really
-	// hasn't.  CTR mode with a synthetic IV is provably semantically secure
-	// under deterministic CPA as long as the synthetic IV is derived from a
-	// secure PRF applied to the message.  Since HMAC-SHA1 is a secure PRF, this
-	// encryption scheme is semantically secure under deterministic CPA.
-	// 
-	// Informally, consider that if a file changes just a tiny bit, the IV will
-	// be completely different, resulting in a completely different ciphertext
-	// that leaks no information about the similarities of the plaintexts.  Also,
-	// since we're using the output from a secure hash function plus a counter
-	// as the input to our block cipher, we should never have a situation where
-	// two different plaintext blocks get encrypted with the same CTR value.  A
-	// nonce will be reused only if the entire file is the same, which leaks no
-	// information except that the files are the same.
-	//
-	// To prevent an attacker from building a dictionary of hash values and then
-	// looking up the nonce (which must be stored in the clear to allow for
-	// decryption), we use an HMAC as opposed to a straight hash.
+	return 0;
+}
 
-	// Note: Hmac_sha1_state::LEN >= Aes_ctr_encryptor::NONCE_LEN
+// Writes the files of a repository which is being unlocked (or locked) straight
+// into the working tree, instead of making `git checkout` run git-crypt for every
+// file.  The blobs are read by a single `git cat-file` process and decrypted by a
+// pool of worker threads.  Files which can't be written this way are left to
+// `git checkout`.
+class Worktree_materializer {
+	enum {
+		MAX_FILE_SIZE = 8388608,	// larger files are left to `git checkout`, which streams them
+		MAX_PENDING_BYTES = 268435456	// # of bytes of file contents we're willing to hold in memory
+	};
+
+	struct Job {
+		const Key_file*	key_file;	// null to write the blob as-is
+		Index_entry	entry;
+		std::string	contents;
+		size_t		size;
+		bool		is_written;
+	};
+
+	std::unique_ptr<Cat_file_batch>	cat_file;
+	std::unique_ptr<Check_attr_batch> check_attr;
+	std::list<Job>			jobs;
+	std::vector<std::string>	checkout_paths;	// files left to `git checkout`
+	std::set<std::string>		flagged_paths;	// files marked assume-unchanged
+	std::set<std::string>		skipped_paths;	// files marked skip-worktree, which Git leaves alone
+	size_t				pending_bytes;
+	std::mutex			mutex;
+	std::condition_variable		job_done;
+	std::unique_ptr<Thread_pool>	pool;	// must be destroyed before jobs
+
+	void				start ();
+	void				load_flagged_paths ();
+	bool				needs_conversion (const std::string& path);
+	bool				can_write (const Index_entry& entry, uint64_t* size);
+	void				write (Job*);
+
+			Worktree_materializer (const Worktree_materializer&);	// Disallow copy
+	Worktree_materializer& operator= (const Worktree_materializer&);	// Disallow assignment
+public:
+			Worktree_materializer ();
+
+	// Write the given files, decrypted with key_file, or as-is if key_file is null
+	void		add (const Key_file* key_file, const std::vector<Index_entry>& files);
+
+	// Wait for the files to be written and refresh the index's stat information,
+	// then check out the remaining files with `git checkout`.  Returns false if that fails.
+	bool		finish ();
+};
 
-	unsigned char		digest[Hmac_sha1_state::LEN];
-	hmac.get(digest);
+Worktree_materializer::Worktree_materializer ()
+: pending_bytes(0)
+{
+}
 
-	// Write a header that...
-	std::cout.write("\0GITCRYPT\0", 10); // ...identifies this as an encrypted file
-	std::cout.write(reinterpret_cast<char*>(digest), Aes_ctr_encryptor::NONCE_LEN); // ...includes the nonce
+void		Worktree_materializer::start ()
+{
+	load_flagged_paths();
+	cat_file.reset(new Cat_file_batch);
 
-	// Now encrypt the file and write to stdout
-	Aes_ctr_encryptor	aes(key->aes_key, digest);
+	std::vector<std::string>	attributes;
+	attributes.push_back("text");
+	attributes.push_back("eol");
+	attributes.push_back("ident");
+	attributes.push_back("working-tree-encoding");
+	check_attr.reset(new Check_attr_batch(attributes));
 
-	// First read from the in-memory copy
-	const unsigned char*	file_data = reinterpret_cast<const unsigned char*>(file_contents.data());
-	size_t			file_data_len = file_contents.size();
-	while (file_data_len > 0) {
-		const size_t	buffer_len = std::min(sizeof(buffer), file_data_len);
-		aes.process(file_data, reinterpret_cast<unsigned char*>(buffer), buffer_len);
-		std::cout.write(buffer, buffer_len);
-		file_data += buffer_len;
-		file_data_len -= buffer_len;
+	pool.reset(new Thread_pool(get_crypt_threads()));
+}
+
+// Files marked assume-unchanged are left to `git checkout`, since re-adding their index
+// entries in finish() would clear the mark.  Files marked skip-worktree aren't written at
+// all, like `git checkout` (which refuses to check them out).
+void		Worktree_materializer::load_flagged_paths ()
+{
+	// git ls-files -vz -- path_to_top
+	std::vector<std::string>	command;
+	command.push_back("git");
+	command.push_back("ls-files");
+	command.push_back("-vz");
+	command.push_back("--");
+	const std::string		path_to_top(get_path_to_top());
+	if (!path_to_top.empty()) {
+		command.push_back(path_to_top);
 	}
 
-	// Then read from the temporary file if applicable
-	if (temp_file.is_open()) {
-		temp_file.seekg(0);
-		while (temp_file.peek() != -1) {
-			temp_file.read(buffer, sizeof(buffer));
+	Coprocess			ls_files;
+	std::istream*			ls_files_stdout = ls_files.stdout_pipe();
+	ls_files.spawn(command);
+
+	// Each record is a tag, a space and the path.  The tag is lowercase if the file
+	// is marked assume-unchanged, and S if it's marked skip-worktree.
+	Nul_record_reader		ls_files_output(*ls_files_stdout);
+	Byte_span			record;
+	while (ls_files_output.next(record)) {
+		if (record.len < 3 || record.p[1] != ' ') {
+			throw Error("Malformed output from 'git ls-files'");
+		}
+		if (record.p[0] == 'S' || record.p[0] == 's') {
+			skipped_paths.insert(std::string(record.p + 2, record.len - 2));
+		} else if (std::islower(static_cast<unsigned char>(record.p[0]))) {
+			flagged_paths.insert(std::string(record.p + 2, record.len - 2));
+		}
+	}
+	if (!successful_exit(ls_files.wait())) {
+		throw Error("'git ls-files' failed - is this a Git repository?");
+	}
+}
 
-			const size_t	buffer_len = temp_file.gcount();
+// Returns true if Git might convert the file when checking it out (e.g. its line endings).
+// Git converts the blob before passing it to the smudge filter, and encrypted blobs always
+// look binary, so this only happens if it's explicitly asked for by an attribute.
+bool		Worktree_materializer::needs_conversion (const std::string& path)
+{
+	std::vector<std::string>	values;
+	check_attr->get(path, values);
 
-			aes.process(reinterpret_cast<unsigned char*>(buffer),
-			            reinterpret_cast<unsigned char*>(buffer),
-			            buffer_len);
-			std::cout.write(buffer, buffer_len);
+	for (std::vector<std::string>::const_iterator value(values.begin()); value != values.end(); ++value) {
+		if (*value != "unspecified" && *value != "unset") {
+			return true;
 		}
 	}
-
-	return 0;
+	return false;
 }
 
-static int decrypt_file_to_stdout (const Key_file& key_file, const unsigned char* header, std::istream& in)
+bool		Worktree_materializer::can_write (const Index_entry& entry, uint64_t* size)
 {
-	const unsigned char*	nonce = header + 10;
-	uint32_t		key_version = 0; // TODO: get the version from the file header
-
-	const Key_file::Entry*	key = key_file.get(key_version);
-	if (!key) {
-		std::clog << "git-crypt: error: key version " << key_version << " not available - please unlock with the latest version of the key." << std::endl;
-		return 1;
+	if (entry.stage != "0" || (entry.mode != "100644" && entry.mode != "100755")) {
+		return false;
+	}
+	if (flagged_paths.count(entry.path)) {
+		return false;
 	}
 
-	Aes_ctr_decryptor	aes(key->aes_key, nonce);
-	Hmac_sha1_state		hmac(key->hmac_key, HMAC_KEY_LEN);
-	while (in) {
-		unsigned char	buffer[1024];
-		in.read(reinterpret_cast<char*>(buffer), sizeof(buffer));
-		aes.process(buffer, buffer, in.gcount());
-		hmac.add(buffer, in.gcount());
-		std::cout.write(reinterpret_cast<char*>(buffer), in.gcount());
+	// Don't create files which aren't there (e.g. because of a sparse checkout)
+	struct stat			status;
+	if (stat(entry.path.c_str(), &status) != 0 || !S_ISREG(status.st_mode)) {
+		return false;
 	}
 
-	unsigned char		digest[Hmac_sha1_state::LEN];
-	hmac.get(digest);
-	if (!leakless_equals(digest, nonce, Aes_ctr_decryptor::NONCE_LEN)) {
-		std::clog << "git-crypt: error: encrypted file has been tampered with!" << std::endl;
-		// Although we've already written the tampered file to stdout, exiting
-		// with a non-zero status will tell git the file has not been filtered,
-		// so git will not replace it.
-		return 1;
+	if (needs_conversion(entry.path)) {
+		return false;
 	}
 
-	return 0;
+	std::string			type;
+	return cat_file->open(entry.object_id, &type, size) && type == "blob" && *size <= MAX_FILE_SIZE;
 }
 
-// Decrypt contents of stdin and write to stdout
-int smudge (int argc, const char** argv)
+void		Worktree_materializer::write (Job* job)
 {
-	const char*		key_name = 0;
-	const char*		key_path = 0;
-	const char*		legacy_key_path = 0;
-
-	int			argi = parse_plumbing_options(&key_name, &key_path, argc, argv);
-	if (argc - argi == 0) {
-	} else if (!key_name && !key_path && argc - argi == 1) { // Deprecated - for compatibility with pre-0.4
-		legacy_key_path = argv[argi];
-	} else {
-		std::clog << "Usage: git-crypt smudge [--key-name=NAME] [--key-file=PATH]" << std::endl;
-		return 2;
-	}
-	Key_file		key_file;
-	load_key(key_file, key_name, key_path, legacy_key_path);
-
-	// Read the header to get the nonce and make sure it's actually encrypted
-	unsigned char		header[10 + Aes_ctr_decryptor::NONCE_LEN];
-	std::cin.read(reinterpret_cast<char*>(header), sizeof(header));
-	if (std::cin.gcount() != sizeof(header) || std::memcmp(header, "\0GITCRYPT\0", 10) != 0) {
-		// File not encrypted - just copy it out to stdout
-		std::clog << "git-crypt: Warning: file not encrypted" << std::endl;
-		std::clog << "git-crypt: Run 'git-crypt status' to make sure all files are properly encrypted." << std::endl;
-		std::clog << "git-crypt: If 'git-crypt status' reports no problems, then an older version of" << std::endl;
-		std::clog << "git-crypt: this file may be unencrypted in the repository's history.  If this" << std::endl;
-		std::clog << "git-crypt: file contains sensitive information, you can use 'git filter-branch'" << std::endl;
-		std::clog << "git-crypt: to remove its old versions from the history." << std::endl;
-		std::cout.write(reinterpret_cast<char*>(header), std::cin.gcount()); // include the bytes which we already read
-		std::cout << std::cin.rdbuf();
-		return 0;
+	bool				is_written = false;
+	try {
+		if (job->key_file) {
+			std::istringstream	in(job->contents);
+			std::ostringstream	out;
+			std::ostringstream	log;
+			// Leave files with problems (including warnings) to `git checkout`, which will report them
+			if (decrypt_file(*job->key_file, in, out, log) == 0 && log.str().empty()) {
+				const std::string	plaintext(out.str());
+				replace_file(job->entry.path, plaintext.data(), plaintext.size(), job->entry.mode == "100755");
+				is_written = true;
+			}
+		} else {
+			replace_file(job->entry.path, job->contents.data(), job->contents.size(), job->entry.mode == "100755");
+			is_written = true;
+		}
+	} catch (...) {
+		// Leave it to `git checkout`, which will report any error
 	}
 
-	return decrypt_file_to_stdout(key_file, header, std::cin);
+	std::lock_guard<std::mutex>	lock(mutex);
+	std::string().swap(job->contents);
+	job->is_written = is_written;
+	pending_bytes -= job->size;
+	job_done.notify_all();
 }
 
-int diff (int argc, const char** argv)
+void		Worktree_materializer::add (const Key_file* key_file, const std::vector<Index_entry>& files)
 {
-	const char*		key_name = 0;
-	const char*		key_path = 0;
-	const char*		filename = 0;
-	const char*		legacy_key_path = 0;
+#ifdef _WIN32
+	// replace_file() is unix-only for now, so leave every file to `git checkout`
+	for (std::vector<Index_entry>::const_iterator entry(files.begin()); entry != files.end(); ++entry) {
+		checkout_paths.push_back(entry->path);
+	}
+	return;
+#endif
+	for (std::vector<Index_entry>::const_iterator entry(files.begin()); entry != files.end(); ++entry) {
+		if (!cat_file) {
+			start();
+		}
 
-	int			argi = parse_plumbing_options(&key_name, &key_path, argc, argv);
-	if (argc - argi == 1) {
-		filename = argv[argi];
-	} else if (!key_name && !key_path && argc - argi == 2) { // Deprecated - for compatibility with pre-0.4
-		legacy_key_path = argv[argi];
-		filename = argv[argi + 1];
-	} else {
-		std::clog << "Usage: git-crypt diff [--key-name=NAME] [--key-file=PATH] FILENAME" << std::endl;
-		return 2;
+		if (skipped_paths.count(entry->path)) {
+			continue;
+		}
+
+		uint64_t		size;
+		if (!can_write(*entry, &size)) {
+			checkout_paths.push_back(entry->path);
+			continue;
+		}
+
+		jobs.push_back(Job());
+		Job&			job = jobs.back();
+		job.key_file = key_file;
+		job.entry = *entry;
+		job.size = size;
+		job.is_written = false;
+		job.contents.resize(size);
+		if (size > 0) {
+			cat_file->read(&job.contents[0], size);
+		}
+
+		{
+			std::unique_lock<std::mutex>	lock(mutex);
+			while (pending_bytes > 0 && pending_bytes + size > MAX_PENDING_BYTES) {
+				job_done.wait(lock);
+			}
+			pending_bytes += size;
+		}
+		pool->submit(std::bind(&Worktree_materializer::write, this, &job));
 	}
-	Key_file		key_file;
-	load_key(key_file, key_name, key_path, legacy_key_path);
+}
 
-	// Open the file
-	std::ifstream		in(filename, std::fstream::binary);
-	if (!in) {
-		std::clog << "git-crypt: " << filename << ": unable to open for reading" << std::endl;
-		return 1;
+bool		Worktree_materializer::finish ()
+{
+	std::string			written_entries;
+	if (cat_file) {
+		pool->wait();
+		cat_file->close();
+		check_attr->close();
+
+		for (std::list<Job>::const_iterator job(jobs.begin()); job != jobs.end(); ++job) {
+			if (job->is_written) {
+				// (--index-info takes paths relative to the top of the working tree, unlike the others)
+				written_entries += job->entry.mode + ' ' + job->entry.object_id + ' ' + job->entry.stage + '\t' + get_path_from_top(job->entry.path);
+				written_entries.push_back('\0');
+			} else {
+				checkout_paths.push_back(job->entry.path);
+			}
+		}
 	}
-	in.exceptions(std::fstream::badbit);
 
-	// Read the header to get the nonce and determine if it's actually encrypted
-	unsigned char		header[10 + Aes_ctr_decryptor::NONCE_LEN];
-	in.read(reinterpret_cast<char*>(header), sizeof(header));
-	if (in.gcount() != sizeof(header) || std::memcmp(header, "\0GITCRYPT\0", 10) != 0) {
-		// File not encrypted - just copy it out to stdout
-		std::cout.write(reinterpret_cast<char*>(header), in.gcount()); // include the bytes which we already read
-		std::cout << in.rdbuf();
-		return 0;
+	if (!written_entries.empty()) {
+		// The index still has the stat information of the old files.  Git assumes that
+		// a file whose size has changed is modified, without looking at its contents,
+		// so first re-add the entries as they are, which clears their stat information.
+		std::vector<std::string>	update_index_command;
+		update_index_command.push_back("git");
+		update_index_command.push_back("update-index");
+		update_index_command.push_back("-z");
+		update_index_command.push_back("--index-info");
+		if (!successful_exit(exec_command_with_input(update_index_command, written_entries.data(), written_entries.size()))) {
+			throw Error("'git update-index' failed");
+		}
+
+		// Then have Git check that the files we wrote match the index, and record their
+		// stat information.  (update-index would add any paths given to it after --refresh,
+		// so the whole index is refreshed, which is quick for the entries we didn't touch.
+		// -q leaves files which really are modified alone instead of failing.)
+		std::vector<std::string>	refresh_command;
+		refresh_command.push_back("git");
+		refresh_command.push_back("update-index");
+		refresh_command.push_back("-q");
+		refresh_command.push_back("--refresh");
+		if (!successful_exit(exec_command(refresh_command))) {
+			throw Error("'git update-index --refresh' failed");
+		}
 	}
 
-	// Go ahead and decrypt it
-	return decrypt_file_to_stdout(key_file, header, in);
+	// Git won't check out a file if its mtime hasn't changed, so touch every file first.
+	for (std::vector<std::string>::const_iterator path(checkout_paths.begin()); path != checkout_paths.end(); ++path) {
+		touch_file(*path);
+	}
+	return git_checkout(checkout_paths);
 }
 
 void help_init (std::ostream& out)
@@ -1013,15 +3395,17 @@ void help_unlock (std::ostream& out)
 }
 int unlock (int argc, const char** argv)
 {
-	// 1. Make sure working directory is clean (ignoring untracked files)
+	// 1. Make sure the encrypted files are clean
 	// We do this because we check out files later, and we don't want the
-	// user to lose any changes.  (TODO: only care if encrypted files are
-	// modified, since we only check out encrypted files)
+	// user to lose any changes.
+
+	// Running 'git ls-files' also serves as a check that the Git repo is accessible.
 
-	// Running 'git status' also serves as a check that the Git repo is accessible.
+	Files_by_attribute	files_by_attribute;
+	get_encrypted_files(files_by_attribute);
 
 	std::stringstream	status_output;
-	get_git_status(status_output);
+	get_git_status(status_output, files_by_attribute);
 	if (status_output.peek() != -1) {
 		std::clog << "Error: Working directory not clean." << std::endl;
 		std::clog << "Please commit your changes or 'git stash' them before running 'git-crypt unlock'." << std::endl;
@@ -1077,7 +3461,6 @@ int unlock (int argc, const char** argv)
 
 
 	// 3. Install the key(s) and configure the git filters
-	std::vector<std::string>	encrypted_files;
 	for (std::vector<Key_file>::iterator key_file(key_files.begin()); key_file != key_files.end(); ++key_file) {
 		std::string		internal_key_path(get_internal_key_path(key_file->get_key_name()));
 		// TODO: croak if internal_key_path already exists???
@@ -1088,15 +3471,14 @@ int unlock (int argc, const char** argv)
 		}
 
 		configure_git_filters(key_file->get_key_name());
-		get_encrypted_files(encrypted_files, key_file->get_key_name());
 	}
 
-	// 4. Check out the files that are currently encrypted.
-	// Git won't check out a file if its mtime hasn't changed, so touch every file first.
-	for (std::vector<std::string>::const_iterator file(encrypted_files.begin()); file != encrypted_files.end(); ++file) {
-		touch_file(*file);
+	// 4. Write out the decrypted versions of the files that are currently encrypted.
+	Worktree_materializer		materializer;
+	for (std::vector<Key_file>::const_iterator key_file(key_files.begin()); key_file != key_files.end(); ++key_file) {
+		materializer.add(&*key_file, get_encrypted_files(files_by_attribute, key_file->get_key_name()));
 	}
-	if (!git_checkout(encrypted_files)) {
+	if (!materializer.finish()) {
 		std::clog << "Error: 'git checkout' failed" << std::endl;
 		std::clog << "git-crypt has been set up but existing encrypted files have not been decrypted" << std::endl;
 		return 1;
@@ -1141,15 +3523,17 @@ int lock (int argc, const char** argv)
 		return 2;
 	}
 
-	// 1. Make sure working directory is clean (ignoring untracked files)
+	// 1. Make sure the encrypted files are clean
 	// We do this because we check out files later, and we don't want the
-	// user to lose any changes.  (TODO: only care if encrypted files are
-	// modified, since we only check out encrypted files)
+	// user to lose any changes.
+
+	// Running 'git ls-files' also serves as a check that the Git repo is accessible.
 
-	// Running 'git status' also serves as a check that the Git repo is accessible.
+	Files_by_attribute	files_by_attribute;
+	get_encrypted_files(files_by_attribute);
 
 	std::stringstream	status_output;
-	get_git_status(status_output);
+	get_git_status(status_output, files_by_attribute);
 	if (!force && status_output.peek() != -1) {
 		std::clog << "Error: Working directory not clean." << std::endl;
 		std::clog << "Please commit your changes or 'git stash' them before running 'git-crypt lock'." << std::endl;
@@ -1158,7 +3542,7 @@ int lock (int argc, const char** argv)
 	}
 
 	// 2. deconfigure the git filters and remove decrypted keys
-	std::vector<std::string>	encrypted_files;
+	Worktree_materializer		materializer;
 	if (all_keys) {
 		// deconfigure for all keys
 		std::vector<std::string> dirents = get_directory_contents(get_internal_keys_path().c_str());
@@ -1166,8 +3550,9 @@ int lock (int argc, const char** argv)
 		for (std::vector<std::string>::const_iterator dirent(dirents.begin()); dirent != dirents.end(); ++dirent) {
 			const char* this_key_name = (*dirent == "default" ? 0 : dirent->c_str());
 			remove_file(get_internal_key_path(this_key_name));
+			Plaintext_cache::clear(get_plaintext_cache_path(this_key_name));
 			deconfigure_git_filters(this_key_name);
-			get_encrypted_files(encrypted_files, this_key_name);
+			materializer.add(nullptr, get_encrypted_files(files_by_attribute, this_key_name));
 		}
 	} else {
 		// just handle the given key
@@ -1182,16 +3567,13 @@ int lock (int argc, const char** argv)
 		}
 
 		remove_file(internal_key_path);
+		Plaintext_cache::clear(get_plaintext_cache_path(key_name));
 		deconfigure_git_filters(key_name);
-		get_encrypted_files(encrypted_files, key_name);
+		materializer.add(nullptr, get_encrypted_files(files_by_attribute, key_name));
 	}
 
-	// 3. Check out the files that are currently decrypted but should be encrypted.
-	// Git won't check out a file if its mtime hasn't changed, so touch every file first.
-	for (std::vector<std::string>::const_iterator file(encrypted_files.begin()); file != encrypted_files.end(); ++file) {
-		touch_file(*file);
-	}
-	if (!git_checkout(encrypted_files)) {
+	// 3. Write out the encrypted versions of the files that are currently decrypted.
+	if (!materializer.finish()) {
 		std::clog << "Error: 'git checkout' failed" << std::endl;
 		std::clog << "git-crypt has been locked up but existing decrypted files have not been encrypted" << std::endl;
 		return 1;
@@ -1508,7 +3890,7 @@ void help_status (std::ostream& out)
 	out << "    -u             Show unencrypted files only" << std::endl;
 	//out << "    -r             Show repository status only" << std::endl;
 	out << "    -f, --fix      Fix problems with the repository" << std::endl;
-	//out << "    -z             Machine-parseable output" << std::endl;
+	out << "    -z             Machine-parseable output" << std::endl;
 	out << std::endl;
 }
 int status (int argc, const char** argv)
@@ -1559,9 +3941,8 @@ int status (int argc, const char** argv)
 		return 2;
 	}
 
-	if (machine_output) {
-		// TODO: implement machine-parseable output
-		std::clog << "Sorry, machine-parseable output is not yet implemented" << std::endl;
+	if (fix_problems && machine_output) {
+		std::clog << "Error: -z option cannot be used with -f" << std::endl;
 		return 2;
 	}
 
@@ -1594,43 +3975,42 @@ int status (int argc, const char** argv)
 		}
 	}
 
-	std::stringstream		output;
-	if (!successful_exit(exec_command(command, output))) {
-		throw Error("'git ls-files' failed - is this a Git repository?");
+	// Blobs checked by earlier runs needn't be read again.  (The index checksum must
+	// be read before listing the files, so it's not newer than the listing.)
+	const std::string		index_checksum(get_index_checksum());
+	Manifest			old_manifest;
+	const bool			has_old_manifest = load_manifest(old_manifest);
+	Blob_statuses			blob_statuses;
+	if (has_old_manifest) {
+		blob_statuses = get_blob_statuses(old_manifest);
 	}
+	const size_t			nbr_old_blob_statuses = blob_statuses.size();
+	Manifest			manifest;
 
-	// Output looks like (w/o newlines):
-	// ? .gitignore\0
-	// H 100644 06ec22e5ed0de9280731ef000a10f9c3fbc26338 0     afile\0
+	Attributed_file_lister		files(command, true);
+
+	// With -z, each file is output as "XYZ SP filename NUL", where X is E if the file
+	// is encrypted or U if it isn't, Y is D if its diff attribute doesn't match its
+	// filter attribute, and Z is B if its staged/committed blob is not encrypted.
+	// Y and Z are . if there's no problem.
 
-	std::vector<std::string>	files;
+	std::unique_ptr<Cat_file_batch>	cat_file;	// started when first needed
+	Attributed_file_lister::File	file;
 	bool				attribute_errors = false;
 	bool				unencrypted_blob_errors = false;
 	unsigned int			nbr_of_fixed_blobs = 0;
 	unsigned int			nbr_of_fix_errors = 0;
 
-	while (output.peek() != -1) {
-		std::string		tag;
-		std::string		object_id;
-		std::string		filename;
-		output >> tag;
-		if (tag != "?") {
-			std::string	mode;
-			std::string	stage;
-			output >> mode >> object_id >> stage;
-			if (!is_git_file_mode(mode)) {
-				continue;
-			}
-		}
-		output >> std::ws;
-		std::getline(output, filename, '\0');
-
-		// TODO: get file attributes en masse for efficiency... unfortunately this requires machine-parseable output from git check-attr to be workable, and this is only supported in Git 1.8.5 and above (released 27 Nov 2013)
-		const std::pair<std::string, std::string> file_attrs(get_file_attributes(filename));
+	while (files.next(file)) {
+		const std::string&	filename = file.path;
+		const std::string&	object_id = file.object_id;
 
-		if (file_attrs.first == "git-crypt" || std::strncmp(file_attrs.first.c_str(), "git-crypt-", 10) == 0) {
+		if (is_git_crypt_attribute(file.filter_attr)) {
 			// File is encrypted
-			const bool	blob_is_unencrypted = !object_id.empty() && !check_if_blob_is_encrypted(object_id);
+			if (!object_id.empty()) {
+				manifest.entries.push_back(make_manifest_entry(file.filter_attr, file.mode, object_id, file.stage, get_path_from_top(filename)));
+			}
+			const bool	blob_is_unencrypted = !object_id.empty() && !check_if_blob_is_encrypted(cat_file, blob_statuses, object_id);
 
 			if (fix_problems && blob_is_unencrypted) {
 				if (access(filename.c_str(), F_OK) != 0) {
@@ -1646,7 +4026,10 @@ int status (int argc, const char** argv)
 					if (!successful_exit(exec_command(git_add_command))) {
 						throw Error("'git-add' failed");
 					}
-					if (check_if_file_is_encrypted(filename)) {
+					if (!cat_file) {
+						cat_file.reset(new Cat_file_batch);
+					}
+					if (check_if_file_is_encrypted(*cat_file, filename)) {
 						std::cout << filename << ": staged encrypted version" << std::endl;
 						++nbr_of_fixed_blobs;
 					} else {
@@ -1655,31 +4038,66 @@ int status (int argc, const char** argv)
 					}
 				}
 			} else if (!fix_problems && !show_unencrypted_only) {
+				const bool	diff_attr_is_wrong = file.diff_attr != file.filter_attr;
+				attribute_errors |= diff_attr_is_wrong;
+				unencrypted_blob_errors |= blob_is_unencrypted;
+
+				if (machine_output) {
+					std::cout << 'E' << (diff_attr_is_wrong ? 'D' : '.') << (blob_is_unencrypted ? 'B' : '.') << ' ' << filename << '\0';
+					continue;
+				}
+
 				// TODO: output the key name used to encrypt this file
 				std::cout << "    encrypted: " << filename;
-				if (file_attrs.second != file_attrs.first) {
+				if (diff_attr_is_wrong) {
 					// but diff filter is not properly set
-					std::cout << " *** WARNING: diff=" << file_attrs.first << " attribute not set ***";
-					attribute_errors = true;
+					std::cout << " *** WARNING: diff=" << file.filter_attr << " attribute not set ***";
 				}
 				if (blob_is_unencrypted) {
 					// File not actually encrypted
 					std::cout << " *** WARNING: staged/committed version is NOT ENCRYPTED! ***";
-					unencrypted_blob_errors = true;
 				}
 				std::cout << std::endl;
 			}
 		} else {
 			// File not encrypted
 			if (!fix_problems && !show_encrypted_only) {
-				std::cout << "not encrypted: " << filename << std::endl;
+				if (machine_output) {
+					std::cout << "U.. " << filename << '\0';
+				} else {
+					std::cout << "not encrypted: " << filename << std::endl;
+				}
 			}
 		}
 	}
+	std::cout.flush();
+
+	files.close();
+	if (cat_file) {
+		cat_file->close();
+	}
+
+	// Having listed the whole index (and not changed it), save a fresh manifest for
+	// get_encrypted_files() to use; otherwise just remember the newly-checked blobs
+	if (argc - argi == 0 && !fix_problems && !index_checksum.empty() && files.get_attributes_digest(manifest.attributes_dirs, manifest.attributes_digest)) {
+		manifest.index_checksum = index_checksum;
+		copy_blob_statuses(manifest, blob_statuses);
+		if (!has_old_manifest || old_manifest.index_checksum != manifest.index_checksum || old_manifest.attributes_digest != manifest.attributes_digest || blob_statuses.size() != nbr_old_blob_statuses) {
+			save_manifest(manifest);
+		}
+	} else if (has_old_manifest && blob_statuses.size() != nbr_old_blob_statuses) {
+		copy_blob_statuses(old_manifest, blob_statuses);
+		save_manifest(old_manifest);
+	}
 
 	int				exit_status = 0;
 
-	if (attribute_errors) {
+	if (machine_output) {
+		// The problems are flagged in each record, so only set the exit status
+		if (attribute_errors || unencrypted_blob_errors) {
+			exit_status = 1;
+		}
+	} else if (attribute_errors) {
 		std::cout << std::endl;
 		std::cout << "Warning: one or more files has a git-crypt filter attribute but not a" << std::endl;
 		std::cout << "corresponding git-crypt diff attribute.  For proper 'git diff' operation" << std::endl;
@@ -1687,7 +4105,7 @@ int status (int argc, const char** argv)
 		std::cout << "Consult the git-crypt documentation for help." << std::endl;
 		exit_status = 1;
 	}
-	if (unencrypted_blob_errors) {
+	if (unencrypted_blob_errors && !machine_output) {
 		std::cout << std::endl;
 		std::cout << "Warning: one or more files is marked for encryption via .gitattributes but" << std::endl;
 		std::cout << "was staged and/or committed before the .gitattributes file was in effect." << std::endl;
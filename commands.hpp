@@ -32,6 +32,7 @@
 #define GIT_CRYPT_COMMANDS_HPP
 
 #include <string>
+#include <vector>
 #include <iosfwd>
 
 struct Error {
@@ -44,6 +45,7 @@ struct Error {
 int clean (int argc, const char** argv);
 int smudge (int argc, const char** argv);
 int diff (int argc, const char** argv);
+int filter_process (int argc, const char** argv);
 // Public commands:
 int init (int argc, const char** argv);
 int unlock (int argc, const char** argv);
@@ -72,5 +74,7 @@ void help_status (std::ostream&);
 
 // other
 std::string get_git_config (const std::string& name);
+const std::vector<int>& git_version ();
+std::vector<int> make_version (int a, int b, int c);
 
 #endif
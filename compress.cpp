@@ -0,0 +1,224 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "compress.hpp"
+#include <zlib.h>
+#include <algorithm>
+#include <climits>
+
+namespace {
+	// zlib takes unsigned int lengths, so feed it at most 1GB at a time
+	const size_t	MAX_ZLIB_LEN = 1 << 30;
+
+	// zlib's default level, fixed so that every git-crypt compresses a file the same way
+	const int	COMPRESSION_LEVEL = 6;
+
+	const size_t	BUFFER_LEN = 65536;
+}
+
+struct Zlib_compress_buf::Zlib_impl {
+	z_stream	strm;
+};
+
+Zlib_compress_buf::Zlib_compress_buf (std::istream& arg_source)
+: impl(new Zlib_impl), source(arg_source), in_buffer(BUFFER_LEN), out_buffer(BUFFER_LEN), is_source_done(false), is_done(false)
+{
+	impl->strm = z_stream();
+	if (deflateInit(&impl->strm, COMPRESSION_LEVEL) != Z_OK) {
+		throw Compression_error("deflateInit failed");
+	}
+}
+
+Zlib_compress_buf::~Zlib_compress_buf ()
+{
+	deflateEnd(&impl->strm);
+}
+
+Zlib_compress_buf::int_type Zlib_compress_buf::underflow ()
+{
+	if (gptr() < egptr()) {
+		return traits_type::to_int_type(*gptr());
+	}
+
+	while (!is_done) {
+		if (impl->strm.avail_in == 0 && !is_source_done) {
+			source.read(&in_buffer[0], in_buffer.size());
+			if (source.bad()) {
+				throw Compression_error("Unable to read input");
+			}
+			impl->strm.next_in = reinterpret_cast<Bytef*>(&in_buffer[0]);
+			impl->strm.avail_in = source.gcount();
+			is_source_done = !source;
+		}
+
+		impl->strm.next_out = reinterpret_cast<Bytef*>(&out_buffer[0]);
+		impl->strm.avail_out = out_buffer.size();
+		const int	ret = deflate(&impl->strm, is_source_done ? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			is_done = true;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			throw Compression_error("deflate failed");
+		}
+
+		const size_t	out_len = out_buffer.size() - impl->strm.avail_out;
+		if (out_len > 0) {
+			setg(&out_buffer[0], &out_buffer[0], &out_buffer[0] + out_len);
+			return traits_type::to_int_type(*gptr());
+		}
+	}
+	return traits_type::eof();
+}
+
+struct Zlib_decompress_buf::Zlib_impl {
+	z_stream	strm;
+};
+
+Zlib_decompress_buf::Zlib_decompress_buf (std::ostream& arg_sink)
+: impl(new Zlib_impl), sink(arg_sink), out_buffer(BUFFER_LEN), is_done(false)
+{
+	impl->strm = z_stream();
+	if (inflateInit(&impl->strm) != Z_OK) {
+		throw Compression_error("inflateInit failed");
+	}
+}
+
+Zlib_decompress_buf::~Zlib_decompress_buf ()
+{
+	inflateEnd(&impl->strm);
+}
+
+Zlib_decompress_buf::int_type Zlib_decompress_buf::overflow (int_type ch)
+{
+	if (traits_type::eq_int_type(ch, traits_type::eof())) {
+		return traits_type::not_eof(ch);
+	}
+	const char	c = traits_type::to_char_type(ch);
+	return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+std::streamsize Zlib_decompress_buf::xsputn (const char* s, std::streamsize n)
+{
+	const char*	p = s;
+	const char*	end = s + n;
+
+	while (p < end) {
+		if (is_done) {
+			// Trailing garbage after the end of the compressed data
+			return 0;
+		}
+
+		const size_t	in_len = std::min<size_t>(end - p, MAX_ZLIB_LEN);
+		impl->strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p));
+		impl->strm.avail_in = in_len;
+		do {
+			impl->strm.next_out = reinterpret_cast<Bytef*>(&out_buffer[0]);
+			impl->strm.avail_out = out_buffer.size();
+			const int	ret = inflate(&impl->strm, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END) {
+				is_done = true;
+			} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				return 0;
+			}
+			sink.write(&out_buffer[0], out_buffer.size() - impl->strm.avail_out);
+			if (!sink) {
+				return 0;
+			}
+		} while (impl->strm.avail_out == 0 && !is_done);
+
+		if (is_done && impl->strm.avail_in != 0) {
+			return 0;
+		}
+		p += in_len - impl->strm.avail_in;
+	}
+	return n;
+}
+
+void	zlib_compress (const unsigned char* in, size_t len, std::vector<unsigned char>& out)
+{
+	z_stream	strm = z_stream();
+	if (deflateInit(&strm, COMPRESSION_LEVEL) != Z_OK) {
+		throw Compression_error("deflateInit failed");
+	}
+
+	const size_t	out_start = out.size();
+	out.resize(out_start + deflateBound(&strm, len));
+	strm.next_out = &out[out_start];
+	int		ret;
+	do {
+		const size_t	in_len = std::min(len, MAX_ZLIB_LEN);
+		strm.next_in = const_cast<Bytef*>(in);
+		strm.avail_in = in_len;
+		strm.avail_out = std::min<size_t>(out.data() + out.size() - strm.next_out, MAX_ZLIB_LEN);
+		ret = deflate(&strm, in_len == len ? Z_FINISH : Z_NO_FLUSH);
+		in += in_len - strm.avail_in;
+		len -= in_len - strm.avail_in;
+	} while (ret == Z_OK);
+
+	if (ret != Z_STREAM_END) {
+		deflateEnd(&strm);
+		throw Compression_error("deflate failed");
+	}
+	out.resize(strm.next_out - out.data());
+	deflateEnd(&strm);
+}
+
+size_t	zlib_compress_bound (size_t len)
+{
+	// Comfortably more than deflateBound(), so that data compressed by other
+	// implementations of zlib isn't rejected
+	return len + (len >> 3) + 64;
+}
+
+bool	zlib_decompress (const unsigned char* in, size_t len, std::vector<unsigned char>& out, size_t max_len)
+{
+	z_stream	strm = z_stream();
+	if (inflateInit(&strm) != Z_OK) {
+		throw Compression_error("inflateInit failed");
+	}
+
+	const size_t	out_start = out.size();
+	out.resize(out_start + max_len);
+	strm.next_out = &out[out_start];
+	int		ret;
+	do {
+		const size_t	in_len = std::min(len, MAX_ZLIB_LEN);
+		strm.next_in = const_cast<Bytef*>(in);
+		strm.avail_in = in_len;
+		strm.avail_out = std::min<size_t>(out.data() + out.size() - strm.next_out, MAX_ZLIB_LEN);
+		ret = inflate(&strm, Z_NO_FLUSH);
+		in += in_len - strm.avail_in;
+		len -= in_len - strm.avail_in;
+	} while (ret == Z_OK && strm.avail_out > 0);
+	out.resize(strm.next_out - out.data());
+	inflateEnd(&strm);
+
+	// The compressed data must end exactly at the end of the input
+	return ret == Z_STREAM_END && len == 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_COMPRESS_HPP
+#define GIT_CRYPT_COMPRESS_HPP
+
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stddef.h>
+
+// zlib compression, for files encrypted with git-crypt-compress.  Compression is
+// deterministic for a given version of zlib, but different implementations (such as
+// zlib-ng) may compress the same data differently, which decompresses the same.
+
+struct Compression_error {
+	std::string	message;
+
+	explicit Compression_error (std::string m) : message(m) { }
+};
+
+// Reads the compression of a source stream
+class Zlib_compress_buf : public std::streambuf {
+	struct Zlib_impl;
+
+	std::unique_ptr<Zlib_impl>	impl;
+	std::istream&			source;
+	std::vector<char>		in_buffer;
+	std::vector<char>		out_buffer;
+	bool				is_source_done;
+	bool				is_done;
+
+				Zlib_compress_buf (const Zlib_compress_buf&);	// Disallow copy
+	Zlib_compress_buf&	operator= (const Zlib_compress_buf&);	// Disallow assignment
+protected:
+	virtual int_type	underflow ();
+
+public:
+	explicit Zlib_compress_buf (std::istream& source);
+	~Zlib_compress_buf ();
+};
+
+class Zlib_compress_istream : public std::istream {
+	Zlib_compress_buf	buf;
+public:
+	explicit Zlib_compress_istream (std::istream& source)
+	: std::istream(0), buf(source)
+	{
+		std::istream::rdbuf(&buf);
+	}
+};
+
+// Decompresses what's written to it, writing the result to a sink stream.  Malformed
+// input puts the stream in a bad state.
+class Zlib_decompress_buf : public std::streambuf {
+	struct Zlib_impl;
+
+	std::unique_ptr<Zlib_impl>	impl;
+	std::ostream&			sink;
+	std::vector<char>		out_buffer;
+	bool				is_done;	// reached the end of the compressed data
+
+				Zlib_decompress_buf (const Zlib_decompress_buf&);	// Disallow copy
+	Zlib_decompress_buf&	operator= (const Zlib_decompress_buf&);	// Disallow assignment
+protected:
+	virtual int_type	overflow (int_type ch =traits_type::eof());
+	virtual std::streamsize	xsputn (const char*, std::streamsize);
+
+public:
+	explicit Zlib_decompress_buf (std::ostream& sink);
+	~Zlib_decompress_buf ();
+
+	bool			is_complete () const { return is_done; }
+};
+
+class Zlib_decompress_ostream : public std::ostream {
+	Zlib_decompress_buf	buf;
+public:
+	explicit Zlib_decompress_ostream (std::ostream& sink)
+	: std::ostream(0), buf(sink)
+	{
+		std::ostream::rdbuf(&buf);
+	}
+
+	// Returns true if the whole of the compressed data was written, and was well-formed
+	bool			finish () { return good() && buf.is_complete(); }
+};
+
+// Compress len bytes from in, appending the result to out
+void	zlib_compress (const unsigned char* in, size_t len, std::vector<unsigned char>& out);
+
+// The most compressed bytes which are accepted for len bytes of uncompressed data
+size_t	zlib_compress_bound (size_t len);
+
+// Decompress len bytes from in, appending the result to out.  Returns false if
+// the input is malformed or decompresses to more than max_len bytes.
+bool	zlib_decompress (const unsigned char* in, size_t len, std::vector<unsigned char>& out, size_t max_len);
+
+#endif
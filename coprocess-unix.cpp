@@ -32,6 +32,8 @@
 #include "util.hpp"
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <errno.h>
 
 static int execvp (const std::string& file, const std::vector<std::string>& args)
@@ -45,6 +47,61 @@ static int execvp (const std::string& file, const std::vector<std::string>& args
 	return execvp(file.c_str(), const_cast<char**>(&args_c_str[0]));
 }
 
+extern char**	environ;
+
+// Spawn the command with posix_spawnp, which avoids copying our page tables like fork does.
+// Returns -1 if it fails, in which case the caller falls back to fork and exec.
+static pid_t posix_spawn_command (const std::vector<std::string>& args, int stdin_reader, int stdin_writer, int stdout_reader, int stdout_writer)
+{
+	std::vector<char*>		args_c_str;
+	args_c_str.reserve(args.size());
+	for (std::vector<std::string>::const_iterator arg(args.begin()); arg != args.end(); ++arg) {
+		args_c_str.push_back(const_cast<char*>(arg->c_str()));
+	}
+	args_c_str.push_back(nullptr);
+
+	posix_spawn_file_actions_t	file_actions;
+	if (posix_spawn_file_actions_init(&file_actions) != 0) {
+		return -1;
+	}
+
+	int				error = 0;
+	if (stdin_writer != -1 && error == 0) {
+		error = posix_spawn_file_actions_addclose(&file_actions, stdin_writer);
+	}
+	if (stdout_reader != -1 && error == 0) {
+		error = posix_spawn_file_actions_addclose(&file_actions, stdout_reader);
+	}
+	if (stdin_reader != -1 && error == 0) {
+		error = posix_spawn_file_actions_adddup2(&file_actions, stdin_reader, 0);
+		if (error == 0) {
+			error = posix_spawn_file_actions_addclose(&file_actions, stdin_reader);
+		}
+	}
+	if (stdout_writer != -1 && error == 0) {
+		error = posix_spawn_file_actions_adddup2(&file_actions, stdout_writer, 1);
+		if (error == 0) {
+			error = posix_spawn_file_actions_addclose(&file_actions, stdout_writer);
+		}
+	}
+
+	pid_t				pid = -1;
+	if (error == 0 && posix_spawnp(&pid, args_c_str[0], &file_actions, nullptr, &args_c_str[0], environ) != 0) {
+		pid = -1;
+	}
+	posix_spawn_file_actions_destroy(&file_actions);
+	return pid;
+}
+
+// Our end of a pipe must not be inherited by other coprocesses, or they would
+// keep it open and this coprocess would never see EOF on its stdin
+static void set_cloexec (int fd)
+{
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+		throw System_error("fcntl", "", errno);
+	}
+}
+
 Coprocess::Coprocess ()
 {
 	pid = -1;
@@ -71,6 +128,7 @@ std::ostream*	Coprocess::stdin_pipe ()
 		}
 		stdin_pipe_reader = fds[0];
 		stdin_pipe_writer = fds[1];
+		set_cloexec(stdin_pipe_writer);
 		stdin_pipe_ostream = new ofhstream(this, write_stdin);
 	}
 	return stdin_pipe_ostream;
@@ -99,6 +157,7 @@ std::istream*	Coprocess::stdout_pipe ()
 		}
 		stdout_pipe_reader = fds[0];
 		stdout_pipe_writer = fds[1];
+		set_cloexec(stdout_pipe_reader);
 		stdout_pipe_istream = new ifhstream(this, read_stdout);
 	}
 	return stdout_pipe_istream;
@@ -120,7 +179,12 @@ void		Coprocess::close_stdout ()
 
 void		Coprocess::spawn (const std::vector<std::string>& args)
 {
-	pid = fork();
+	pid = posix_spawn_command(args, stdin_pipe_reader, stdin_pipe_writer, stdout_pipe_reader, stdout_pipe_writer);
+	if (pid == -1) {
+		// posix_spawnp failed (e.g. because the command couldn't be found), so fork and exec
+		// the old-fashioned way, which reports the problem from the child like it always has
+		pid = fork();
+	}
 	if (pid == -1) {
 		throw System_error("fork", "", errno);
 	}
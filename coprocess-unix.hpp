@@ -55,9 +55,11 @@ public:
 			~Coprocess ();
 
 	std::ostream*	stdin_pipe ();
+	int		stdin_pipe_fd () const { return stdin_pipe_writer; }
 	void		close_stdin ();
 
 	std::istream*	stdout_pipe ();
+	int		stdout_pipe_fd () const { return stdout_pipe_reader; }
 	void		close_stdout ();
 
 	void		spawn (const std::vector<std::string>&);
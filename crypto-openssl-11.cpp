@@ -31,7 +31,6 @@
 #include "crypto.hpp"
 #include "key.hpp"
 #include "util.hpp"
-#include <openssl/aes.h>
 #include <openssl/sha.h>
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
@@ -39,35 +38,86 @@
 #include <openssl/err.h>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
 
 void init_crypto ()
 {
 	ERR_load_crypto_strings();
 }
 
-struct Aes_ecb_encryptor::Aes_impl {
-	AES_KEY key;
+struct Aes_ctr_encryptor::Aes_ctr_impl {
+	EVP_CIPHER_CTX* ctx;
 };
 
-Aes_ecb_encryptor::Aes_ecb_encryptor (const unsigned char* raw_key)
-: impl(new Aes_impl)
+Aes_ctr_encryptor::Aes_ctr_encryptor (const unsigned char* raw_key, const unsigned char* arg_nonce, uint64_t offset)
+: impl(new Aes_ctr_impl), byte_counter(0)
 {
-	if (AES_set_encrypt_key(raw_key, KEY_LEN * 8, &(impl->key)) != 0) {
-		throw Crypto_error("Aes_ctr_encryptor::Aes_ctr_encryptor", "AES_set_encrypt_key failed");
+	std::memcpy(key, raw_key, KEY_LEN);
+	std::memcpy(nonce, arg_nonce, NONCE_LEN);
+
+	impl->ctx = EVP_CIPHER_CTX_new();
+	if (!impl->ctx) {
+		throw Crypto_error("Aes_ctr_encryptor::Aes_ctr_encryptor", "EVP_CIPHER_CTX_new failed");
+	}
+	if (EVP_EncryptInit_ex(impl->ctx, EVP_aes_256_ctr(), nullptr, key, nullptr) != 1) {
+		EVP_CIPHER_CTX_free(impl->ctx);
+		throw Crypto_error("Aes_ctr_encryptor::Aes_ctr_encryptor", "EVP_EncryptInit_ex failed");
 	}
+	seek(offset);
 }
 
-Aes_ecb_encryptor::~Aes_ecb_encryptor ()
+Aes_ctr_encryptor::~Aes_ctr_encryptor ()
 {
 	// Note: Explicit destructor necessary because class contains an unique_ptr
 	// which contains an incomplete type when the unique_ptr is declared.
 
-	explicit_memset(&impl->key, '\0', sizeof(impl->key));
+	EVP_CIPHER_CTX_free(impl->ctx); // also cleanses the key schedule
+	explicit_memset(key, '\0', KEY_LEN);
+}
+
+void Aes_ctr_encryptor::seek (uint64_t offset)
+{
+	if (offset > MAX_CRYPT_BYTES) {
+		throw Crypto_error("Aes_ctr_encryptor::seek", "Too much data to encrypt securely");
+	}
+
+	// The CTR value is the 12 byte nonce followed by a 4 byte (big-endian)
+	// block number.  The cipher increments the CTR value as a 128 bit
+	// big-endian integer, so the block number in the last 4 bytes increases
+	// sequentially with each block, and never carries into the nonce because
+	// we refuse to process more than MAX_CRYPT_BYTES.
+	unsigned char	ctr_value[BLOCK_LEN];
+	std::memcpy(ctr_value, nonce, NONCE_LEN);
+	store_be32(ctr_value + NONCE_LEN, offset / BLOCK_LEN);
+
+	if (EVP_EncryptInit_ex(impl->ctx, nullptr, nullptr, nullptr, ctr_value) != 1) {
+		throw Crypto_error("Aes_ctr_encryptor::seek", "EVP_EncryptInit_ex failed");
+	}
+	byte_counter = offset - offset % BLOCK_LEN;
+
+	// Discard the part of the first pad which precedes offset
+	unsigned char	discard[BLOCK_LEN] = { 0 };
+	process(discard, discard, offset % BLOCK_LEN);
 }
 
-void Aes_ecb_encryptor::encrypt(const unsigned char* plain, unsigned char* cipher)
+void Aes_ctr_encryptor::process (const unsigned char* in, unsigned char* out, size_t len)
 {
-	AES_encrypt(plain, cipher, &(impl->key));
+	if (len > MAX_CRYPT_BYTES - byte_counter) {
+		throw Crypto_error("Aes_ctr_encryptor::process", "Too much data to encrypt securely");
+	}
+	byte_counter += len;
+
+	// EVP_EncryptUpdate takes an int length, so feed it at most 1GB at a time
+	while (len > 0) {
+		const int	chunk_len = static_cast<int>(std::min<size_t>(len, 1 << 30));
+		int		out_len = 0;
+		if (EVP_EncryptUpdate(impl->ctx, out, &out_len, in, chunk_len) != 1 || out_len != chunk_len) {
+			throw Crypto_error("Aes_ctr_encryptor::process", "EVP_EncryptUpdate failed");
+		}
+		in += chunk_len;
+		out += chunk_len;
+		len -= chunk_len;
+	}
 }
 
 struct Hmac_sha1_state::Hmac_impl {
@@ -98,6 +148,144 @@ void Hmac_sha1_state::get (unsigned char* digest)
 	HMAC_Final(impl->ctx, digest, &len);
 }
 
+static const EVP_CIPHER* get_aead_cipher (Aead_cipher::Algorithm algorithm)
+{
+	return algorithm == Aead_cipher::AES_256_GCM ? EVP_aes_256_gcm() : EVP_chacha20_poly1305();
+}
+
+// Feed len bytes to an EVP cipher context, as associated data if out is null.  EVP takes
+// int lengths, so feed it at most 1GB at a time.
+static bool cipher_update (EVP_CIPHER_CTX* ctx, unsigned char* out, const unsigned char* in, size_t len)
+{
+	while (len > 0) {
+		const int	chunk_len = static_cast<int>(std::min<size_t>(len, 1 << 30));
+		int		out_len = 0;
+		if (EVP_CipherUpdate(ctx, out, &out_len, in, chunk_len) != 1 || (out && out_len != chunk_len)) {
+			return false;
+		}
+		in += chunk_len;
+		if (out) {
+			out += chunk_len;
+		}
+		len -= chunk_len;
+	}
+	return true;
+}
+
+struct Aead_cipher::Aead_impl {
+	EVP_CIPHER_CTX* ctx;
+};
+
+Aead_cipher::Aead_cipher (Algorithm algorithm, const unsigned char* key)
+: impl(new Aead_impl)
+{
+	impl->ctx = EVP_CIPHER_CTX_new();
+	if (!impl->ctx) {
+		throw Crypto_error("Aead_cipher::Aead_cipher", "EVP_CIPHER_CTX_new failed");
+	}
+	if (EVP_EncryptInit_ex(impl->ctx, get_aead_cipher(algorithm), nullptr, key, nullptr) != 1) {
+		EVP_CIPHER_CTX_free(impl->ctx);
+		throw Crypto_error("Aead_cipher::Aead_cipher", "EVP_EncryptInit_ex failed");
+	}
+}
+
+Aead_cipher::~Aead_cipher ()
+{
+	EVP_CIPHER_CTX_free(impl->ctx); // also cleanses the key schedule
+}
+
+void Aead_cipher::encrypt (const unsigned char* nonce, const unsigned char* ad, size_t ad_len, const unsigned char* in, size_t len, unsigned char* out, unsigned char* tag)
+{
+	// Re-initializing with just the nonce keeps the key schedule
+	int	final_len = 0;
+	if (EVP_CipherInit_ex(impl->ctx, nullptr, nullptr, nullptr, nonce, 1) != 1 ||
+			!cipher_update(impl->ctx, nullptr, ad, ad_len) ||
+			!cipher_update(impl->ctx, out, in, len) ||
+			EVP_CipherFinal_ex(impl->ctx, out + len, &final_len) != 1 ||
+			EVP_CIPHER_CTX_ctrl(impl->ctx, EVP_CTRL_AEAD_GET_TAG, TAG_LEN, tag) != 1) {
+		throw Crypto_error("Aead_cipher::encrypt", "EVP encryption failed");
+	}
+}
+
+bool Aead_cipher::decrypt (const unsigned char* nonce, const unsigned char* ad, size_t ad_len, const unsigned char* in, size_t len, unsigned char* out, const unsigned char* tag)
+{
+	int	final_len = 0;
+	if (EVP_CipherInit_ex(impl->ctx, nullptr, nullptr, nullptr, nonce, 0) != 1 ||
+			!cipher_update(impl->ctx, nullptr, ad, ad_len) ||
+			!cipher_update(impl->ctx, out, in, len) ||
+			EVP_CIPHER_CTX_ctrl(impl->ctx, EVP_CTRL_AEAD_SET_TAG, TAG_LEN, const_cast<unsigned char*>(tag)) != 1) {
+		throw Crypto_error("Aead_cipher::decrypt", "EVP decryption failed");
+	}
+	return EVP_CipherFinal_ex(impl->ctx, out + len, &final_len) == 1;
+}
+
+struct Aead_siv_state::Aead_siv_impl {
+	Aead_cipher::Algorithm	algorithm;
+	EVP_CIPHER_CTX*		hash_ctx;
+	EVP_CIPHER_CTX*		prf_ctx;
+};
+
+Aead_siv_state::Aead_siv_state (Aead_cipher::Algorithm algorithm, const unsigned char* hash_key, const unsigned char* prf_key)
+: impl(new Aead_siv_impl)
+{
+	static const unsigned char	zero_nonce[Aead_cipher::NONCE_LEN] = { 0 };
+
+	impl->algorithm = algorithm;
+	impl->hash_ctx = EVP_CIPHER_CTX_new();
+	impl->prf_ctx = EVP_CIPHER_CTX_new();
+	if (!impl->hash_ctx || !impl->prf_ctx) {
+		EVP_CIPHER_CTX_free(impl->hash_ctx);
+		EVP_CIPHER_CTX_free(impl->prf_ctx);
+		throw Crypto_error("Aead_siv_state::Aead_siv_state", "EVP_CIPHER_CTX_new failed");
+	}
+	const EVP_CIPHER*	prf_cipher = algorithm == Aead_cipher::AES_256_GCM ? EVP_aes_256_ecb() : EVP_chacha20();
+	if (EVP_EncryptInit_ex(impl->hash_ctx, get_aead_cipher(algorithm), nullptr, hash_key, zero_nonce) != 1 ||
+			EVP_EncryptInit_ex(impl->prf_ctx, prf_cipher, nullptr, prf_key, nullptr) != 1 ||
+			EVP_CIPHER_CTX_set_padding(impl->prf_ctx, 0) != 1) {
+		EVP_CIPHER_CTX_free(impl->hash_ctx);
+		EVP_CIPHER_CTX_free(impl->prf_ctx);
+		throw Crypto_error("Aead_siv_state::Aead_siv_state", "EVP_EncryptInit_ex failed");
+	}
+}
+
+Aead_siv_state::~Aead_siv_state ()
+{
+	EVP_CIPHER_CTX_free(impl->hash_ctx);
+	EVP_CIPHER_CTX_free(impl->prf_ctx);
+}
+
+void Aead_siv_state::add (const unsigned char* buffer, size_t buffer_len)
+{
+	if (!cipher_update(impl->hash_ctx, nullptr, buffer, buffer_len)) {
+		throw Crypto_error("Aead_siv_state::add", "EVP_CipherUpdate failed");
+	}
+}
+
+void Aead_siv_state::get (unsigned char* siv)
+{
+	unsigned char	hash[Aead_cipher::TAG_LEN];
+	int		final_len = 0;
+	if (EVP_EncryptFinal_ex(impl->hash_ctx, hash, &final_len) != 1 ||
+			EVP_CIPHER_CTX_ctrl(impl->hash_ctx, EVP_CTRL_AEAD_GET_TAG, sizeof(hash), hash) != 1) {
+		throw Crypto_error("Aead_siv_state::get", "EVP_EncryptFinal_ex failed");
+	}
+
+	// The hash is only almost-universal, so encrypt it to get a PRF: with AES, as a
+	// single block, and with ChaCha20, by using it as the counter and nonce of a block
+	int		out_len = 0;
+	if (impl->algorithm == Aead_cipher::AES_256_GCM) {
+		if (EVP_EncryptUpdate(impl->prf_ctx, siv, &out_len, hash, LEN) != 1 || out_len != LEN) {
+			throw Crypto_error("Aead_siv_state::get", "EVP_EncryptUpdate failed");
+		}
+	} else {
+		static const unsigned char	zeros[LEN] = { 0 };
+		if (EVP_EncryptInit_ex(impl->prf_ctx, nullptr, nullptr, nullptr, hash) != 1 ||
+				EVP_EncryptUpdate(impl->prf_ctx, siv, &out_len, zeros, LEN) != 1 || out_len != LEN) {
+			throw Crypto_error("Aead_siv_state::get", "EVP_EncryptUpdate failed");
+		}
+	}
+	explicit_memset(hash, 0, sizeof(hash));
+}
 
 void random_bytes (unsigned char* buffer, size_t len)
 {
@@ -29,41 +29,50 @@
  */
 
 #include "crypto.hpp"
+#include "thread_pool.hpp"
 #include "util.hpp"
 #include <cstring>
+#include <algorithm>
 
-Aes_ctr_encryptor::Aes_ctr_encryptor (const unsigned char* raw_key, const unsigned char* nonce)
-: ecb(raw_key)
+void Aes_ctr_encryptor::process_parallel (const unsigned char* in, unsigned char* out, size_t len, Thread_pool* pool)
 {
-	// Set first 12 bytes of the CTR value to the nonce.
-	// This stays the same for the entirety of this object's lifetime.
-	std::memcpy(ctr_value, nonce, NONCE_LEN);
-	byte_counter = 0;
-}
+	const unsigned int	threads = pool ? std::min<uint64_t>(pool->size(), len / MIN_SEGMENT_LEN) : 1;
+	if (threads <= 1) {
+		process(in, out, len);
+		return;
+	}
+	if (len > MAX_CRYPT_BYTES - byte_counter) {
+		throw Crypto_error("Aes_ctr_encryptor::process_parallel", "Too much data to encrypt securely");
+	}
 
-Aes_ctr_encryptor::~Aes_ctr_encryptor ()
-{
-	explicit_memset(pad, '\0', BLOCK_LEN);
-}
+	// Every segment but the last is a whole number of blocks long.  Since each
+	// segment is processed by its own encryptor, seeked to the segment's offset
+	// in the stream, the output doesn't depend on where the segments start.
+	const size_t		segment_len = (len / threads + BLOCK_LEN - 1) / BLOCK_LEN * BLOCK_LEN;
 
-void Aes_ctr_encryptor::process (const unsigned char* in, unsigned char* out, size_t len)
-{
-	for (size_t i = 0; i < len; ++i) {
-		if (byte_counter % BLOCK_LEN == 0) {
-			// Set last 4 bytes of CTR to the (big-endian) block number (sequentially increasing with each block)
-			store_be32(ctr_value + NONCE_LEN, byte_counter / BLOCK_LEN);
+	try {
+		for (unsigned int i = 0; i < threads && i * segment_len < len; ++i) {
+			const size_t	segment_offset = i * segment_len;
+			const size_t	this_segment_len = std::min(segment_len, len - segment_offset);
+			const uint64_t	stream_offset = byte_counter + segment_offset;
 
-			// Generate a new pad
-			ecb.encrypt(ctr_value, pad);
+			pool->submit([=] {
+				Aes_ctr_encryptor	segment_aes(key, nonce, stream_offset);
+				segment_aes.process(in + segment_offset, out + segment_offset, this_segment_len);
+			});
 		}
-
-		// encrypt one byte
-		out[i] = in[i] ^ pad[byte_counter++ % BLOCK_LEN];
-
-		if (byte_counter == 0) {
-			throw Crypto_error("Aes_ctr_encryptor::process", "Too much data to encrypt securely");
+	} catch (...) {
+		// Don't return while the segments already submitted are still using the buffers
+		try {
+			pool->wait();
+		} catch (...) {
 		}
+		throw;
 	}
+	pool->wait();
+
+	// Leave this encryptor positioned just past the data we've processed
+	seek(byte_counter + len);
 }
 
 // Encrypt/decrypt an entire input stream, writing to the given output stream
@@ -71,7 +80,7 @@ void Aes_ctr_encryptor::process_stream (std::istream& in, std::ostream& out, con
 {
 	Aes_ctr_encryptor	aes(key, nonce);
 
-	unsigned char		buffer[1024];
+	unsigned char		buffer[65536];
 	while (in) {
 		in.read(reinterpret_cast<char*>(buffer), sizeof(buffer));
 		aes.process(buffer, buffer, in.gcount());
@@ -38,6 +38,8 @@
 #include <string>
 #include <memory>
 
+class Thread_pool;
+
 void init_crypto ();
 
 struct Crypto_error {
@@ -47,45 +49,37 @@ struct Crypto_error {
 	Crypto_error (const std::string& w, const std::string& m) : where(w), message(m) { }
 };
 
-class Aes_ecb_encryptor {
-public:
-	enum {
-		KEY_LEN		= AES_KEY_LEN,
-		BLOCK_LEN	= 16
-	};
-
-private:
-	struct Aes_impl;
-
-	std::unique_ptr<Aes_impl>	impl;
-
-public:
-	Aes_ecb_encryptor (const unsigned char* key);
-	~Aes_ecb_encryptor ();
-	void encrypt (const unsigned char* plain, unsigned char* cipher);
-};
-
 class Aes_ctr_encryptor {
 public:
 	enum {
 		NONCE_LEN	= 12,
 		KEY_LEN		= AES_KEY_LEN,
 		BLOCK_LEN	= 16,
-		MAX_CRYPT_BYTES	= (1ULL<<32)*16 // Don't encrypt more than this or the CTR value will repeat itself
+		MAX_CRYPT_BYTES	= (1ULL<<32)*16, // Don't encrypt more than this or the CTR value will repeat itself
+		MIN_SEGMENT_LEN	= 1<<20		// Don't give a thread less than this much data to process in parallel
 	};
 
 private:
-	Aes_ecb_encryptor	ecb;
-	unsigned char		ctr_value[BLOCK_LEN];	// Current CTR value (used as input to AES to derive pad)
-	unsigned char		pad[BLOCK_LEN];		// Current encryption pad (output of AES)
-	uint32_t		byte_counter;		// How many bytes processed so far?
+	struct Aes_ctr_impl;
+
+	std::unique_ptr<Aes_ctr_impl>	impl;
+	unsigned char			key[KEY_LEN];
+	unsigned char			nonce[NONCE_LEN];
+	uint64_t			byte_counter;	// How many bytes processed so far?
+
+	void seek (uint64_t offset);
 
 public:
-	Aes_ctr_encryptor (const unsigned char* key, const unsigned char* nonce);
+	// offset is the position in the stream at which to start (need not be block-aligned)
+	Aes_ctr_encryptor (const unsigned char* key, const unsigned char* nonce, uint64_t offset =0);
 	~Aes_ctr_encryptor ();
 
 	void process (const unsigned char* in, unsigned char* out, size_t len);
 
+	// Like process, but split the buffer into segments which are processed by the
+	// pool's threads (if pool isn't null).  Output is identical to that of process.
+	void process_parallel (const unsigned char* in, unsigned char* out, size_t len, Thread_pool* pool);
+
 	// Encrypt/decrypt an entire input stream, writing to the given output stream
 	static void process_stream (std::istream& in, std::ostream& out, const unsigned char* key, const unsigned char* nonce);
 };
@@ -112,6 +106,67 @@ public:
 	void get (unsigned char*);
 };
 
+// The AEADs of the chunked format's faster cipher suites.  A nonce must never be
+// reused with different data, which the chunked format ensures by deriving nonces
+// from a synthetic IV (see Aead_siv_state).
+class Aead_cipher {
+public:
+	enum Algorithm {
+		AES_256_GCM,
+		CHACHA20_POLY1305
+	};
+	enum {
+		KEY_LEN		= 32,
+		NONCE_LEN	= 12,
+		TAG_LEN		= 16
+	};
+
+private:
+	struct Aead_impl;
+
+	std::unique_ptr<Aead_impl>	impl;
+
+				Aead_cipher (const Aead_cipher&);	// Disallow copy
+	Aead_cipher&		operator= (const Aead_cipher&);	// Disallow assignment
+public:
+	Aead_cipher (Algorithm, const unsigned char* key);
+	~Aead_cipher ();
+
+	// Encrypt len bytes from in to out (which may be the same), authenticating them
+	// and ad_len bytes of associated data, and write the TAG_LEN-byte tag to tag
+	void encrypt (const unsigned char* nonce, const unsigned char* ad, size_t ad_len, const unsigned char* in, size_t len, unsigned char* out, unsigned char* tag);
+
+	// The reverse of encrypt(). Returns false if the tag is wrong, in which case
+	// out must not be used.
+	bool decrypt (const unsigned char* nonce, const unsigned char* ad, size_t ad_len, const unsigned char* in, size_t len, unsigned char* out, const unsigned char* tag);
+};
+
+// A PRF of a message, for use as a synthetic IV, which is faster than HMAC-SHA1.  Like
+// AES-GCM-SIV, it hashes the message with a universal hash (the AEAD's tag over the message
+// as associated data, under a fixed nonce) and encrypts the hash under a second key, with
+// AES or the ChaCha20 block function.
+class Aead_siv_state {
+public:
+	enum {
+		LEN	= 16,
+		KEY_LEN	= Aead_cipher::KEY_LEN
+	};
+
+private:
+	struct Aead_siv_impl;
+
+	std::unique_ptr<Aead_siv_impl>	impl;
+
+				Aead_siv_state (const Aead_siv_state&);	// Disallow copy
+	Aead_siv_state&		operator= (const Aead_siv_state&);	// Disallow assignment
+public:
+	Aead_siv_state (Aead_cipher::Algorithm, const unsigned char* hash_key, const unsigned char* prf_key);
+	~Aead_siv_state ();
+
+	void add (const unsigned char* buffer, size_t buffer_len);
+	void get (unsigned char*);
+};
+
 void random_bytes (unsigned char*, size_t);
 
 #endif
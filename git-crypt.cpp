@@ -34,6 +34,7 @@
 #include "crypto.hpp"
 #include "key.hpp"
 #include "gpg.hpp"
+#include "compress.hpp"
 #include "parse_options.hpp"
 #include <cstring>
 #include <unistd.h>
@@ -73,6 +74,7 @@ static void print_usage (std::ostream& out)
 	out << "   clean [LEGACY-KEYFILE]" << std::endl;
 	out << "   smudge [LEGACY-KEYFILE]" << std::endl;
 	out << "   diff [LEGACY-KEYFILE] FILE" << std::endl;
+	out << "   filter-process" << std::endl;
 	*/
 	out << std::endl;
 	out << "See 'git-crypt help COMMAND' for more information on a specific command." << std::endl;
@@ -231,6 +233,9 @@ try {
 		if (std::strcmp(command, "diff") == 0) {
 			return diff(argc, argv);
 		}
+		if (std::strcmp(command, "filter-process") == 0) {
+			return filter_process(argc, argv);
+		}
 	} catch (const Option_error& e) {
 		std::clog << "git-crypt: Error: " << e.option_name << ": " << e.message << std::endl;
 		help_for_command(command, std::clog);
@@ -252,6 +257,9 @@ try {
 } catch (const Crypto_error& e) {
 	std::cerr << "git-crypt: Crypto error: " << e.where << ": " << e.message << std::endl;
 	return 1;
+} catch (const Compression_error& e) {
+	std::cerr << "git-crypt: Compression error: " << e.message << std::endl;
+	return 1;
 } catch (Key_file::Incompatible) {
 	std::cerr << "git-crypt: This repository contains a incompatible key file.  Please upgrade git-crypt." << std::endl;
 	return 1;
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "ls_files.hpp"
+#include <istream>
+#include <cstring>
+
+namespace {
+	enum {
+		INITIAL_BUFFER_SIZE = 65536
+	};
+
+	// Splits the span at the first occurrence of c, returning the part before it
+	// and leaving the part after it in span.  Returns false if c isn't found.
+	bool	split (Byte_span& span, char c, Byte_span& before)
+	{
+		const char*	pos = static_cast<const char*>(std::memchr(span.p, c, span.len));
+		if (!pos) {
+			return false;
+		}
+		before = Byte_span(span.p, pos - span.p);
+		span.len -= pos + 1 - span.p;
+		span.p = pos + 1;
+		return true;
+	}
+}
+
+bool		Byte_span::equals (const char* s) const
+{
+	return std::strlen(s) == len && std::memcmp(s, p, len) == 0;
+}
+
+Nul_record_reader::Nul_record_reader (std::istream& arg_in)
+: in(arg_in), buffer(INITIAL_BUFFER_SIZE), start(0), end(0), is_eof(false)
+{
+}
+
+bool		Nul_record_reader::next (Byte_span& record)
+{
+	size_t		search_pos = start;
+	while (true) {
+		const char*	nul = static_cast<const char*>(std::memchr(&buffer[0] + search_pos, '\0', end - search_pos));
+		if (nul) {
+			record = Byte_span(&buffer[0] + start, nul - &buffer[0] - start);
+			start = nul + 1 - &buffer[0];
+			return true;
+		}
+		if (is_eof) {
+			if (start == end) {
+				return false;
+			}
+			record = Byte_span(&buffer[0] + start, end - start);
+			start = end;
+			return true;
+		}
+
+		// Make room for more data: move the partial record to the front of the
+		// buffer, and grow the buffer only if the record fills it
+		if (start > 0) {
+			std::memmove(&buffer[0], &buffer[0] + start, end - start);
+			end -= start;
+			start = 0;
+		} else if (end == buffer.size()) {
+			buffer.resize(buffer.size() * 2);
+		}
+		search_pos = end;
+
+		in.read(&buffer[0] + end, buffer.size() - end);
+		end += in.gcount();
+		if (!in) {
+			is_eof = true;
+		}
+	}
+}
+
+bool		parse_ls_files_record (Byte_span record, bool has_tag, Ls_files_record& parsed)
+{
+	parsed = Ls_files_record();
+	if (has_tag) {
+		if (!split(record, ' ', parsed.tag)) {
+			return false;
+		}
+		if (parsed.tag.equals("?")) {
+			parsed.path = record;
+			return true;
+		}
+	}
+	if (!split(record, ' ', parsed.mode) || !split(record, ' ', parsed.object_id) || !split(record, '\t', parsed.stage)) {
+		return false;
+	}
+	parsed.path = record;
+	return true;
+}
+
+bool		is_regular_file_mode (Byte_span mode)
+{
+	unsigned long	value = 0;
+	for (size_t i = 0; i < mode.len; ++i) {
+		if (mode.p[i] < '0' || mode.p[i] > '7') {
+			return false;
+		}
+		value = value * 8 + (mode.p[i] - '0');
+	}
+	return (value & 0170000) == 0100000;
+}
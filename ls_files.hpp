@@ -0,0 +1,91 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_LS_FILES_HPP
+#define GIT_CRYPT_LS_FILES_HPP
+
+#include <string>
+#include <vector>
+#include <iosfwd>
+#include <cstddef>
+
+// A range of bytes in someone else's buffer
+struct Byte_span {
+	const char*	p;
+	size_t		len;
+
+	Byte_span () : p(0), len(0) { }
+	Byte_span (const char* arg_p, size_t arg_len) : p(arg_p), len(arg_len) { }
+
+	bool		empty () const { return len == 0; }
+	bool		equals (const char* s) const;
+	std::string	str () const { return std::string(p, len); }
+};
+
+// Splits NUL-terminated records (such as the output of `git ls-files -z`) out of a
+// stream, which is read in large chunks.  The records are returned as spans of the
+// reader's buffer, and are only valid until the next call to next(), so nothing
+// is copied unless the caller wants to keep it.
+class Nul_record_reader {
+	std::istream&		in;
+	std::vector<char>	buffer;
+	size_t			start;		// offset in buffer of the first byte not yet returned
+	size_t			end;		// offset in buffer of the end of the data read so far
+	bool			is_eof;
+
+			Nul_record_reader (const Nul_record_reader&);	// Disallow copy
+	Nul_record_reader& operator= (const Nul_record_reader&);	// Disallow assignment
+public:
+	explicit	Nul_record_reader (std::istream& in);
+
+	// Returns false at the end of the stream.  A final record without a terminating
+	// NUL is returned like any other.
+	bool		next (Byte_span& record);
+};
+
+// A record output by `git ls-files -s -z`, optionally with -t:
+//  [<tag> SP] <mode> SP <object> SP <stage> TAB <path>
+// or, for an untracked file listed with -o and -t:
+//  ? SP <path>
+struct Ls_files_record {
+	Byte_span	tag;		// empty without -t
+	Byte_span	mode;		// empty for untracked files
+	Byte_span	object_id;	// empty for untracked files
+	Byte_span	stage;		// empty for untracked files
+	Byte_span	path;
+};
+
+// Returns false if the record is malformed
+bool		parse_ls_files_record (Byte_span record, bool has_tag, Ls_files_record& parsed);
+
+// Is mode that of a regular file (as opposed to a symlink or submodule)?
+bool		is_regular_file_mode (Byte_span mode);
+
+#endif
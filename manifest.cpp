@@ -0,0 +1,126 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "manifest.hpp"
+#include "ls_files.hpp"
+#include <istream>
+#include <ostream>
+#include <cstdlib>
+
+// The manifest is a sequence of NUL-terminated fields:
+//  "git-crypt manifest 1" <index checksum> <attributes digest> <# of attributes dirs>
+//  followed by each attributes dir
+//  followed by <attribute> <mode> <object id> <stage> <path> <blob status> for each entry
+static const char	MANIFEST_VERSION[] = "git-crypt manifest 1";
+
+bool		Manifest::load (std::istream& in)
+{
+	Nul_record_reader	reader(in);
+	Byte_span		field;
+
+	if (!reader.next(field) || !field.equals(MANIFEST_VERSION)) {
+		return false;
+	}
+	if (!reader.next(field)) {
+		return false;
+	}
+	index_checksum = field.str();
+	if (!reader.next(field)) {
+		return false;
+	}
+	attributes_digest = field.str();
+	if (!reader.next(field)) {
+		return false;
+	}
+	const unsigned long	nbr_attributes_dirs = std::strtoul(field.str().c_str(), nullptr, 10);
+
+	attributes_dirs.clear();
+	for (unsigned long i = 0; i < nbr_attributes_dirs; ++i) {
+		if (!reader.next(field)) {
+			return false;
+		}
+		attributes_dirs.push_back(field.str());
+	}
+
+	entries.clear();
+	while (reader.next(field)) {
+		Entry			entry;
+		entry.attribute = field.str();
+		if (!reader.next(field)) {
+			return false;
+		}
+		entry.mode = field.str();
+		if (!reader.next(field)) {
+			return false;
+		}
+		entry.object_id = field.str();
+		if (!reader.next(field)) {
+			return false;
+		}
+		entry.stage = field.str();
+		if (!reader.next(field)) {
+			return false;
+		}
+		entry.path = field.str();
+		if (!reader.next(field) || field.len != 1) {
+			return false;
+		}
+		switch (field.p[0]) {
+		case BLOB_UNCHECKED:
+		case BLOB_ENCRYPTED:
+		case BLOB_UNENCRYPTED:
+			entry.blob_status = static_cast<Blob_status>(field.p[0]);
+			break;
+		default:
+			return false;
+		}
+		entries.push_back(entry);
+	}
+	return !in.bad();
+}
+
+void		Manifest::store (std::ostream& out) const
+{
+	out << MANIFEST_VERSION << '\0';
+	out << index_checksum << '\0';
+	out << attributes_digest << '\0';
+	out << attributes_dirs.size() << '\0';
+	for (std::vector<std::string>::const_iterator dir(attributes_dirs.begin()); dir != attributes_dirs.end(); ++dir) {
+		out << *dir << '\0';
+	}
+	for (std::vector<Entry>::const_iterator entry(entries.begin()); entry != entries.end(); ++entry) {
+		out << entry->attribute << '\0'
+		    << entry->mode << '\0'
+		    << entry->object_id << '\0'
+		    << entry->stage << '\0'
+		    << entry->path << '\0'
+		    << static_cast<char>(entry->blob_status) << '\0';
+	}
+}
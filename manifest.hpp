@@ -0,0 +1,73 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_MANIFEST_HPP
+#define GIT_CRYPT_MANIFEST_HPP
+
+#include <string>
+#include <vector>
+#include <iosfwd>
+
+// A cache of which files in the index are encrypted, under which key, and whether
+// their blobs have been verified to actually be encrypted, so that this needn't be
+// worked out from scratch every time.  It's stored in $GIT_DIR/git-crypt/manifest.
+//
+// The classification of the files is only valid while the index and the attributes
+// files are unchanged, which is checked using index_checksum (the checksum at the
+// end of $GIT_DIR/index) and attributes_digest (a digest of the contents of the
+// attributes files in attributes_dirs, plus the global and info attributes files).
+// A blob's status is always valid, since blobs never change.
+struct Manifest {
+	enum Blob_status {
+		BLOB_UNCHECKED = '?',
+		BLOB_ENCRYPTED = 'E',
+		BLOB_UNENCRYPTED = 'U'
+	};
+
+	struct Entry {
+		std::string	attribute;	// the git-crypt filter attribute
+		std::string	mode;
+		std::string	object_id;
+		std::string	stage;
+		std::string	path;		// relative to the top of the working tree
+		Blob_status	blob_status;
+	};
+
+	std::string			index_checksum;
+	std::string			attributes_digest;
+	std::vector<std::string>	attributes_dirs;
+	std::vector<Entry>		entries;
+
+	// Returns false if the manifest is malformed or in an unknown format
+	bool		load (std::istream&);
+	void		store (std::ostream&) const;
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "multiplexer.hpp"
+#include "util.hpp"
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+static void set_nonblocking (int fd)
+{
+	const int	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		throw System_error("fcntl", "", errno);
+	}
+}
+
+size_t		Coprocess_multiplexer::add_input (Coprocess& proc)
+{
+	Input		input;
+	input.proc = &proc;
+	input.buffer_pos = 0;
+	input.is_closing = false;
+	input.is_closed = false;
+	inputs.push_back(input);
+	return inputs.size() - 1;
+}
+
+void		Coprocess_multiplexer::add_output (Coprocess& proc, const Output_fun& on_data)
+{
+	Output		output;
+	output.proc = &proc;
+	output.on_data = on_data;
+	output.is_eof = false;
+	outputs.push_back(output);
+}
+
+void		Coprocess_multiplexer::write (size_t input, const char* p, size_t len)
+{
+	inputs[input].buffer.append(p, len);
+}
+
+void		Coprocess_multiplexer::close_input (size_t input)
+{
+	inputs[input].is_closing = true;
+}
+
+void		Coprocess_multiplexer::run ()
+{
+	for (std::vector<Input>::iterator input(inputs.begin()); input != inputs.end(); ++input) {
+		set_nonblocking(input->proc->stdin_pipe_fd());
+	}
+	for (std::vector<Output>::iterator output(outputs.begin()); output != outputs.end(); ++output) {
+		set_nonblocking(output->proc->stdout_pipe_fd());
+	}
+
+	std::vector<char>		buffer(65536);
+	std::vector<struct pollfd>	pollfds;
+	std::vector<size_t>		pollfd_owners;	// index into inputs or outputs
+	while (true) {
+		pollfds.clear();
+		pollfd_owners.clear();
+
+		for (size_t i = 0; i < inputs.size(); ++i) {
+			Input&		input = inputs[i];
+			if (input.is_closed) {
+				continue;
+			}
+			if (input.buffer_pos == input.buffer.size()) {
+				input.buffer.clear();
+				input.buffer_pos = 0;
+				if (input.is_closing) {
+					input.proc->close_stdin();
+					input.is_closed = true;
+				}
+				continue;
+			}
+			struct pollfd	pfd;
+			pfd.fd = input.proc->stdin_pipe_fd();
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			pollfds.push_back(pfd);
+			pollfd_owners.push_back(i);
+		}
+		const size_t		nbr_input_pollfds = pollfds.size();
+
+		for (size_t i = 0; i < outputs.size(); ++i) {
+			if (outputs[i].is_eof) {
+				continue;
+			}
+			struct pollfd	pfd;
+			pfd.fd = outputs[i].proc->stdout_pipe_fd();
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			pollfds.push_back(pfd);
+			pollfd_owners.push_back(i);
+		}
+
+		if (pollfds.empty()) {
+			break;
+		}
+
+		if (poll(&pollfds[0], pollfds.size(), -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw System_error("poll", "", errno);
+		}
+
+		for (size_t k = 0; k < nbr_input_pollfds; ++k) {
+			if (!pollfds[k].revents) {
+				continue;
+			}
+			Input&		input = inputs[pollfd_owners[k]];
+			const ssize_t	bytes_written = ::write(pollfds[k].fd, input.buffer.data() + input.buffer_pos, input.buffer.size() - input.buffer_pos);
+			if (bytes_written == -1) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+					continue;
+				}
+				throw System_error("write", "", errno);
+			}
+			input.buffer_pos += bytes_written;
+			if (input.buffer_pos >= 65536 && input.buffer_pos >= input.buffer.size() / 2) {
+				// Don't let the buffer grow without bound if it's never completely drained
+				input.buffer.erase(0, input.buffer_pos);
+				input.buffer_pos = 0;
+			}
+		}
+
+		for (size_t k = nbr_input_pollfds; k < pollfds.size(); ++k) {
+			if (!pollfds[k].revents) {
+				continue;
+			}
+			Output&		output = outputs[pollfd_owners[k]];
+			const ssize_t	bytes_read = read(pollfds[k].fd, &buffer[0], buffer.size());
+			if (bytes_read == -1) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+					continue;
+				}
+				throw System_error("read", "", errno);
+			}
+			if (bytes_read == 0) {
+				output.is_eof = true;
+			}
+			output.on_data(&buffer[0], bytes_read);
+		}
+	}
+}
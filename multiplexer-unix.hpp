@@ -0,0 +1,86 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_MULTIPLEXER_HPP
+#define GIT_CRYPT_MULTIPLEXER_HPP
+
+#include "coprocess.hpp"
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+// Moves data to and from the pipes of several coprocesses at once, so that the
+// coprocesses can run as a pipeline without any of them waiting on another (or
+// on us) to read its output.  The coprocesses must have been spawned with the
+// pipes passed to add_input() and add_output() (see Coprocess::stdin_pipe() and
+// Coprocess::stdout_pipe()).
+//
+// Data read from an output is passed to its callback, which may queue more data
+// for the inputs with write() and close_input().  All callbacks run on the thread
+// which called run().
+class Coprocess_multiplexer {
+public:
+	typedef std::function<void (const char* p, size_t len)> Output_fun;	// len is 0 at EOF
+
+private:
+	struct Input {
+		Coprocess*	proc;
+		std::string	buffer;		// data not yet written
+		size_t		buffer_pos;	// offset in buffer of the first byte not yet written
+		bool		is_closing;	// close the pipe once buffer has been written
+		bool		is_closed;
+	};
+	struct Output {
+		Coprocess*	proc;
+		Output_fun	on_data;
+		bool		is_eof;
+	};
+
+	std::vector<Input>		inputs;
+	std::vector<Output>		outputs;
+
+			Coprocess_multiplexer (const Coprocess_multiplexer&);	// Disallow copy
+	Coprocess_multiplexer& operator= (const Coprocess_multiplexer&);	// Disallow assignment
+public:
+			Coprocess_multiplexer () { }
+
+	// Returns the input # to pass to write() and close_input()
+	size_t		add_input (Coprocess&);
+	void		add_output (Coprocess&, const Output_fun& on_data);
+
+	void		write (size_t input, const char* p, size_t len);
+	void		close_input (size_t input);	// once everything written so far has been written
+
+	// Returns once every output has reached EOF and every closed input has been written
+	void		run ();
+};
+
+#endif
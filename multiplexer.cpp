@@ -0,0 +1,3 @@
+#ifndef _WIN32
+#include "multiplexer-unix.cpp"
+#endif
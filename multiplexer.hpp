@@ -0,0 +1,6 @@
+// The multiplexer needs pipes which can be polled together, so it is only built on
+// unix.  Windows takes the sequential paths which are used when a Coprocess_multiplexer
+// can't be (see get_encrypted_files()).
+#ifndef _WIN32
+#include "multiplexer-unix.hpp"
+#endif
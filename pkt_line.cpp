@@ -0,0 +1,167 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "pkt_line.hpp"
+#include "commands.hpp"
+#include <istream>
+#include <ostream>
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+static size_t read_pkt_len (std::istream& in)
+{
+	char		hex[4];
+	in.read(hex, 4);
+	if (in.gcount() != 4) {
+		throw Error("Unexpected end of input while reading pkt-line");
+	}
+
+	size_t		len = 0;
+	for (int i = 0; i < 4; ++i) {
+		len <<= 4;
+		if (hex[i] >= '0' && hex[i] <= '9') {
+			len |= hex[i] - '0';
+		} else if (hex[i] >= 'a' && hex[i] <= 'f') {
+			len |= hex[i] - 'a' + 10;
+		} else {
+			throw Error("Malformed pkt-line length");
+		}
+	}
+
+	if (len == 0) {
+		return 0; // flush packet
+	}
+	if (len <= 4 || len - 4 > PKT_LINE_MAX_DATA_LEN) {
+		throw Error("Malformed pkt-line length");
+	}
+	return len - 4;
+}
+
+static void write_pkt_len (std::ostream& out, size_t len)
+{
+	char		hex[5];
+	std::sprintf(hex, "%04x", static_cast<unsigned int>(len));
+	out.write(hex, 4);
+}
+
+bool		read_pkt_line (std::istream& in, std::string& data)
+{
+	const size_t	len = read_pkt_len(in);
+	if (len == 0) {
+		return false;
+	}
+	data.resize(len);
+	in.read(&data[0], len);
+	if (static_cast<size_t>(in.gcount()) != len) {
+		throw Error("Unexpected end of input while reading pkt-line");
+	}
+	return true;
+}
+
+bool		read_pkt_text (std::istream& in, std::string& line)
+{
+	if (!read_pkt_line(in, line)) {
+		return false;
+	}
+	if (!line.empty() && line[line.size() - 1] == '\n') {
+		line.resize(line.size() - 1);
+	}
+	return true;
+}
+
+void		write_pkt_line (std::ostream& out, const char* data, size_t len)
+{
+	write_pkt_len(out, len + 4);
+	out.write(data, len);
+}
+
+void		write_pkt_text (std::ostream& out, const std::string& line)
+{
+	write_pkt_len(out, line.size() + 1 + 4);
+	out.write(line.data(), line.size());
+	out.put('\n');
+}
+
+void		write_flush_pkt (std::ostream& out)
+{
+	out.write("0000", 4);
+}
+
+Pkt_line_reader::Pkt_line_reader (std::istream& arg_in)
+: in(arg_in), packet_bytes_left(0), at_flush(false), content_istream(this, read_content)
+{
+	content_istream.exceptions(std::ios_base::badbit);
+}
+
+size_t		Pkt_line_reader::read_content (void* handle, void* buf, size_t count)
+{
+	Pkt_line_reader*	reader = static_cast<Pkt_line_reader*>(handle);
+
+	if (reader->at_flush) {
+		return 0;
+	}
+	if (reader->packet_bytes_left == 0) {
+		reader->packet_bytes_left = read_pkt_len(reader->in);
+		if (reader->packet_bytes_left == 0) {
+			reader->at_flush = true;
+			return 0;
+		}
+	}
+
+	reader->in.read(static_cast<char*>(buf), std::min(count, reader->packet_bytes_left));
+	const size_t		bytes_read = reader->in.gcount();
+	if (bytes_read == 0) {
+		throw Error("Unexpected end of input while reading pkt-line");
+	}
+	reader->packet_bytes_left -= bytes_read;
+	return bytes_read;
+}
+
+void		Pkt_line_reader::skip_rest ()
+{
+	content_istream.clear();
+	content_istream.ignore(std::numeric_limits<std::streamsize>::max());
+}
+
+Pkt_line_writer::Pkt_line_writer (std::ostream& arg_out)
+: out(arg_out), content_ostream(this, write_content)
+{
+	content_ostream.exceptions(std::ios_base::badbit);
+}
+
+size_t		Pkt_line_writer::write_content (void* handle, const void* buf, size_t count)
+{
+	Pkt_line_writer*	writer = static_cast<Pkt_line_writer*>(handle);
+	const size_t		len = std::min<size_t>(count, PKT_LINE_MAX_DATA_LEN);
+
+	write_pkt_line(writer->out, static_cast<const char*>(buf), len);
+	return len;
+}
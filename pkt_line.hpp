@@ -0,0 +1,82 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_PKT_LINE_HPP
+#define GIT_CRYPT_PKT_LINE_HPP
+
+#include "fhstream.hpp"
+#include <string>
+#include <cstddef>
+
+// Git's pkt-line format, as used by the long-running filter process protocol
+// (see gitprotocol-common(5) and gitattributes(5)).
+
+enum {
+	PKT_LINE_MAX_DATA_LEN = 65516
+};
+
+bool		read_pkt_line (std::istream&, std::string& data);	// returns false for a flush packet
+bool		read_pkt_text (std::istream&, std::string& line);	// like read_pkt_line, but strips the trailing LF
+void		write_pkt_line (std::ostream&, const char* data, size_t len);
+void		write_pkt_text (std::ostream&, const std::string& line);	// appends a LF
+void		write_flush_pkt (std::ostream&);
+
+// Reads the data of a sequence of pkt-lines, up to (and including) the next flush packet
+class Pkt_line_reader {
+	std::istream&	in;
+	size_t		packet_bytes_left;
+	bool		at_flush;
+	ifhstream	content_istream;
+	static size_t	read_content (void*, void*, size_t);
+
+			Pkt_line_reader (const Pkt_line_reader&);	// Disallow copy
+	Pkt_line_reader& operator= (const Pkt_line_reader&);	// Disallow assignment
+public:
+	explicit	Pkt_line_reader (std::istream& in);
+
+	std::istream&	content () { return content_istream; }
+	void		skip_rest ();	// discard any data not yet read, through the flush packet
+};
+
+// Writes data as a sequence of pkt-lines (but does not write the terminating flush packet)
+class Pkt_line_writer {
+	std::ostream&	out;
+	ofhstream	content_ostream;
+	static size_t	write_content (void*, const void*, size_t);
+
+			Pkt_line_writer (const Pkt_line_writer&);	// Disallow copy
+	Pkt_line_writer& operator= (const Pkt_line_writer&);	// Disallow assignment
+public:
+	explicit	Pkt_line_writer (std::ostream& out);
+
+	std::ostream&	content () { return content_ostream; }
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "plaintext_cache.hpp"
+#include "util.hpp"
+#include "crypto.hpp"
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+
+// Object IDs are hex, so they can't be confused with temporary files
+static bool	is_object_id (const std::string& name)
+{
+	return !name.empty() && name.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+Plaintext_cache::Plaintext_cache (const std::string& arg_dir, uint64_t arg_max_bytes)
+: dir(arg_dir), max_bytes(arg_max_bytes), has_added(false)
+{
+}
+
+bool		Plaintext_cache::open (const std::string& object_id, std::ifstream& in)
+{
+	if (!is_object_id(object_id)) {
+		return false;
+	}
+	const std::string	path(get_path(object_id));
+	in.open(path.c_str(), std::fstream::binary);
+	if (!in) {
+		return false;
+	}
+	try {
+		touch_file(path);	// for evict()
+	} catch (const System_error&) {
+	}
+	return true;
+}
+
+bool		Plaintext_cache::start_add (const std::string& object_id, std::string& temp_path, std::ofstream& out)
+{
+	if (!is_object_id(object_id)) {
+		return false;
+	}
+
+	// Several filter processes could be adding the same file at once
+	unsigned char		suffix[8];
+	random_bytes(suffix, sizeof(suffix));
+	temp_path = get_path(object_id) + ".tmp." + hex_encode(suffix, sizeof(suffix));
+	try {
+		mkdir_parent(temp_path);
+		create_protected_file(temp_path.c_str());
+	} catch (const System_error&) {
+		return false;
+	}
+	out.open(temp_path.c_str(), std::fstream::binary | std::fstream::trunc);
+	if (!out) {
+		remove_file(temp_path);
+		return false;
+	}
+	return true;
+}
+
+void		Plaintext_cache::finish_add (const std::string& object_id, const std::string& temp_path)
+{
+	if (util_rename(temp_path.c_str(), get_path(object_id).c_str()) == -1) {
+		remove_file(temp_path);
+		return;
+	}
+	has_added = true;
+}
+
+void		Plaintext_cache::evict ()
+{
+	if (!has_added) {
+		return;
+	}
+
+	std::vector<std::pair<int64_t, std::string> >	files;	// (mtime, name)
+	uint64_t					total_bytes = 0;
+	try {
+		const std::vector<std::string>		names(get_directory_contents(dir.c_str()));
+		for (std::vector<std::string>::const_iterator name(names.begin()); name != names.end(); ++name) {
+			File_stamp			stamp;
+			if (!is_object_id(*name)) {
+				continue;
+			}
+			if (get_file_stamp(dir + "/" + *name, stamp)) {
+				files.push_back(std::make_pair(stamp.mtime_ns, *name));
+				total_bytes += stamp.size;
+			} else {
+				// Its size can't be counted against the budget, so don't keep it
+				remove_file(dir + "/" + *name);
+			}
+		}
+
+		std::sort(files.begin(), files.end());
+		for (std::vector<std::pair<int64_t, std::string> >::const_iterator file(files.begin()); file != files.end() && total_bytes > max_bytes; ++file) {
+			File_stamp			stamp;
+			if (get_file_stamp(dir + "/" + file->second, stamp)) {
+				remove_file(dir + "/" + file->second);
+				total_bytes -= std::min(total_bytes, stamp.size);
+			}
+		}
+	} catch (const System_error&) {
+		// It's only a cache
+	}
+}
+
+void		Plaintext_cache::clear (const std::string& dir)
+{
+	if (access(dir.c_str(), F_OK) != 0) {
+		return;
+	}
+	const std::vector<std::string>	names(get_directory_contents(dir.c_str()));
+	for (std::vector<std::string>::const_iterator name(names.begin()); name != names.end(); ++name) {
+		remove_file(dir + "/" + *name);
+	}
+}
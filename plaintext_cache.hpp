@@ -0,0 +1,72 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_PLAINTEXT_CACHE_HPP
+#define GIT_CRYPT_PLAINTEXT_CACHE_HPP
+
+#include <string>
+#include <fstream>
+#include <stdint.h>
+
+// A directory of decrypted files, named by the object ID of their encrypted blob, so that
+// a large file which is checked out again (e.g. when switching back and forth between
+// branches) can be copied out instead of being decrypted and verified again.  Only files
+// whose decryption succeeded are added.  The files are accessible only by the current
+// user, and the least recently used ones are evicted to keep the directory under a size
+// budget.  The directory is emptied when its key is locked.
+class Plaintext_cache {
+	std::string		dir;
+	uint64_t		max_bytes;
+	bool			has_added;
+
+	std::string		get_path (const std::string& object_id) const { return dir + "/" + object_id; }
+
+			Plaintext_cache (const Plaintext_cache&);	// Disallow copy
+	Plaintext_cache& operator= (const Plaintext_cache&);	// Disallow assignment
+public:
+	Plaintext_cache (const std::string& dir, uint64_t max_bytes);
+
+	// Opens the plaintext of the given blob, returning false if it isn't cached
+	bool			open (const std::string& object_id, std::ifstream&);
+
+	// To add a file, write its plaintext to the stream opened by start_add(), then close
+	// it and call finish_add() with the same temp_path (or remove temp_path to give up).
+	// start_add() returns false if the file can't be added.
+	bool			start_add (const std::string& object_id, std::string& temp_path, std::ofstream&);
+	void			finish_add (const std::string& object_id, const std::string& temp_path);
+
+	// Evicts the least recently used files until the cache fits in its budget
+	void			evict ();
+
+	// Removes every file in the cache in dir
+	static void		clear (const std::string& dir);
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+// Evaluates the filter and diff attributes of paths with Attribute_matcher, printing
+// them like `git check-attr -z filter diff`.  Run from the top of a working tree with
+// NUL-terminated paths (relative to the top) on stdin.  Loads the .gitattributes file
+// of every directory containing a path, and $GIT_DIR/info/attributes (which must be
+// .git/info/attributes), but no global files.  Exits with status 3 if the matcher
+// can't handle one of the files, in which case git-crypt would use `git check-attr`.
+// Built and run by attributes_differential.sh.
+
+#include "../attributes.hpp"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <string>
+
+namespace {
+	// Returns false if the file exists but the matcher can't handle it
+	bool add_file (Attribute_matcher& matcher, Attribute_matcher::Level level, const std::string& dir, const std::string& path)
+	{
+		std::ifstream		in(path.c_str(), std::fstream::binary);
+		if (!in) {
+			return true;
+		}
+		const std::string	contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		return matcher.add_file(level, dir, contents);
+	}
+
+	void print_attribute (const std::string& path, const char* name, const std::string& value)
+	{
+		std::cout << path << '\0' << name << '\0' << value << '\0';
+	}
+}
+
+int main ()
+{
+	Attribute_matcher		matcher;
+	std::set<std::string>		loaded_dirs;
+	if (!add_file(matcher, Attribute_matcher::INFO, "", ".git/info/attributes")) {
+		return 3;
+	}
+
+	std::string			path;
+	while (std::getline(std::cin, path, '\0')) {
+		// Load the .gitattributes of every directory containing path, from the top down
+		for (std::string::size_type slash = 0; slash != std::string::npos; slash = path.find('/', slash + 1)) {
+			const std::string	dir(path, 0, slash);
+			if (loaded_dirs.insert(dir).second &&
+					!add_file(matcher, Attribute_matcher::DIRECTORY, dir, dir.empty() ? ".gitattributes" : dir + "/.gitattributes")) {
+				return 3;
+			}
+		}
+
+		std::string		filter;
+		std::string		diff;
+		matcher.get(path, filter, diff);
+		print_attribute(path, "filter", filter);
+		print_attribute(path, "diff", diff);
+	}
+	return 0;
+}
@@ -0,0 +1,106 @@
+#!/usr/bin/env bash
+#
+# Differential test of Attribute_matcher (attributes.cpp) against git check-attr.
+# Builds random trees of .gitattributes files, from patterns and attributes chosen
+# to exercise precedence between and within files, "**", directory-only patterns,
+# the binary macro, and unset/unspecified values, then compares the filter and diff
+# attributes of every path, as printed by attributes_check.cpp and by
+# `git check-attr -z`.  Trees the matcher refuses (negative patterns, quoted
+# patterns, [attr] macros) are counted but not compared, since git-crypt falls back
+# to git check-attr for them.
+#
+# Usage: tests/attributes_differential.sh [TRIALS [SEED]]
+#
+# CXX is the compiler to build the checker with (default: c++).  attributes.o must
+# already be built (run make first).
+
+set -e
+
+TRIALS=${1:-200}
+SEED=${2:-1}
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+if [ ! -f "$top/attributes.o" ]; then
+	echo "$0: $top/attributes.o not found - run make first" >&2
+	exit 1
+fi
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+${CXX:-c++} -std=c++11 -O2 -o "$work/attributes_check" "$top/tests/attributes_check.cpp" "$top/attributes.o"
+
+# Keep the user's and system's configuration (including core.attributesFile) out of it
+export HOME=$work XDG_CONFIG_HOME=$work GIT_CONFIG_NOSYSTEM=1 GIT_ATTR_NOSYSTEM=1
+
+DIRS=("" a a/b a/b/c d d/e build a/build)
+FILES=(x.txt y.txt z.c x.bin .x a.txt)
+PATTERNS=('*' '*.txt' '/x.txt' 'x.txt' 'a/*.txt' 'b/*.txt' '**/x.txt' 'a/**' 'a/**/z.c' '**/build/**'
+	'build/' 'build' 'b/' '[xy].txt' '*.t?t' '[!x]*.txt' 'x*' '.x' 'a/b' '*/z.c' 'd/**/*' 'c/*')
+UNSUPPORTED_PATTERNS=('!*.txt' '"x.txt"' '[attr]secret filter=git-crypt diff=git-crypt')
+ATTRIBUTES=(filter=git-crypt filter=other -filter '!filter' filter diff=git-crypt diff=other -diff
+	'!diff' diff binary text -text 'filter=git-crypt diff=git-crypt' 'binary filter=git-crypt')
+
+pick ()
+{
+	local -n choices=$1
+	echo "${choices[RANDOM % ${#choices[@]}]}"
+}
+
+# Prints a random attributes file
+attributes_file ()
+{
+	local nbr_lines=$((RANDOM % 5)) i
+	for ((i = 0; i < nbr_lines; ++i)); do
+		if ((RANDOM % 40 == 0)); then
+			pick UNSUPPORTED_PATTERNS
+		elif ((RANDOM % 10 == 0)); then
+			echo "# $(pick PATTERNS) $(pick ATTRIBUTES)"
+		else
+			echo "$(pick PATTERNS) $(pick ATTRIBUTES) $( ((RANDOM % 4 == 0)) && pick ATTRIBUTES)"
+		fi
+	done
+}
+
+RANDOM=$SEED
+nbr_checked=0
+nbr_refused=0
+nbr_failed=0
+for ((trial = 0; trial < TRIALS; ++trial)); do
+	repo=$work/repo$trial
+	git init -q "$repo"
+	for dir in "${DIRS[@]}"; do
+		mkdir -p "$repo/$dir"
+		for file in "${FILES[@]}"; do
+			touch "$repo/$dir/$file"
+		done
+		if ((RANDOM % 2 == 0)); then
+			attributes_file > "$repo/$dir/.gitattributes"
+		fi
+	done
+	touch "$repo/d/build"	# a file, which directory-only patterns mustn't match
+	if ((RANDOM % 3 == 0)); then
+		attributes_file > "$repo/.git/info/attributes"
+	fi
+
+	(cd "$repo" && git ls-files -oz --exclude-standard) > "$work/paths"
+	if ! (cd "$repo" && "$work/attributes_check") < "$work/paths" > "$work/actual"; then
+		nbr_refused=$((nbr_refused + 1))
+		rm -rf "$repo"
+		continue
+	fi
+	(cd "$repo" && git check-attr -z --stdin filter diff) < "$work/paths" > "$work/expected"
+	nbr_checked=$((nbr_checked + 1))
+	if ! cmp -s "$work/expected" "$work/actual"; then
+		nbr_failed=$((nbr_failed + 1))
+		echo "Trial $trial: Attribute_matcher disagrees with git check-attr (path, attribute, expected, actual):" >&2
+		paste <(tr '\0' '\n' < "$work/expected" | paste - - -) <(tr '\0' '\n' < "$work/actual" | paste - - - | cut -f3) \
+			| awk -F '\t' '$3 != $4' >&2
+		(cd "$repo" && for file in .git/info/attributes $(find . -name .gitattributes | sort); do
+			[ -f "$file" ] && { echo "--- $file"; cat "$file"; }
+		done) >&2
+	fi
+	rm -rf "$repo"
+done
+
+echo "$nbr_checked trees compared, $nbr_failed mismatched; $nbr_refused trees refused by Attribute_matcher"
+[ "$nbr_failed" -eq 0 ]
@@ -0,0 +1,166 @@
+#!/usr/bin/env bash
+#
+# Known-answer tests for the encrypted file formats, whose ciphertext is permanent,
+# so any change to how it's computed must be caught.  With a fixed key, encrypts
+# fixed plaintexts and compares the results byte for byte, then checks that the
+# expected encryptions decrypt back to the plaintexts.
+#
+# The original format (\0GITCRYPT\0) is checked against vectors made by the
+# byte-at-a-time AES-CTR of git-crypt 0.8.0, from short files around the AES block
+# size and a file large enough to be encrypted by several threads.
+#
+# The AEAD cipher suites of the chunked format (git-crypt-cipher=aes-gcm and
+# chacha20) have synthetic IVs built by hand (see Aead_siv_state).  They're checked
+# by the header (including the SIV), the ciphertext, and the chunk tags.
+#
+# Usage: tests/known_answers.sh
+#
+# GIT_CRYPT is the git-crypt binary to test (default: the one built in the parent directory).
+
+set -e
+
+GIT_CRYPT=${GIT_CRYPT:-$(cd "$(dirname "$0")/.." && pwd)/git-crypt}
+if [ ! -x "$GIT_CRYPT" ]; then
+	echo "$0: $GIT_CRYPT not found - run make first, or set GIT_CRYPT" >&2
+	exit 1
+fi
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Key version 0, with an AES key of bytes 0x00-0x1f and an HMAC key of bytes 0x20-0x5f
+KEY_FILE=\
+0047495443525950544b455900000002000000000000000100000004000000000000000300000020\
+000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f0000000500000040\
+202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f\
+404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f00000000
+
+# Original format: the magic, the nonce and the ciphertext, of the first N bytes of SHORT_PLAINTEXT
+V1_0=004749544352595054005f6a7f22f3a5763ad9408faf
+V1_1=0047495443525950540000b13d1dfea004622d6e6e932d
+V1_15=004749544352595054005fd8768a6d5c22182d30e3dc0d059231ba754a30e241e6c664937c
+V1_16=0047495443525950540015e6f7591e34c7fe5ec3b3a13255724ed9388a7eda4098e09c9426fa
+V1_17=00474954435259505400d774f542b377104fcde1632a0743689c1f6d76b9056810c006dc0ad953
+
+# ...and of PARALLEL_CRYPT_MIN_BYTES + 17 bytes of "abc...zabc...", by its SHA-256
+V1_LONG_LEN=8388625
+V1_LONG_SHA256=c94d45de4ac38ab7e461ce211399d102362bb4c2fbebcc658a74e65361725db8
+
+# The header is the magic, then the key version, chunk size, SIV and cipher fields
+HEADER_LEN=70
+CHUNK_SIZE=1048576
+TAG_LEN=16
+
+# The short plaintext fits in one chunk, which is also the last
+SHORT_PLAINTEXT='The quick brown fox jumps over the lazy dog'
+
+GCM_SHORT_HEADER=00474954435259505402000000010000000400000000000000030000000400100000000000050000000c0d9c51f51ba6c5c84a0feab00000000b000000040000000100000000
+GCM_SHORT_CIPHERTEXT=74d09f588d1fbc64267871b8696feaaa84bec59a12bb915cebceb53a8db94527d942bc118626882896b2f9
+GCM_SHORT_TAG=19790f4dc7b63d6daadb84ffaf4782fc
+
+CHACHA20_SHORT_HEADER=00474954435259505402000000010000000400000000000000030000000400100000000000050000000c3d60b1237b3aef20d05291220000000b000000040000000200000000
+CHACHA20_SHORT_CIPHERTEXT=537661badef0ce61b61224b10cec2cda01198d3f2922458689c027b4cedc4e6854a58be5ae7370286038b3
+CHACHA20_SHORT_TAG=78752799b4f512b510ddbf250193fe00
+
+# The long plaintext (see long_plaintext) is a full chunk and then a partial last chunk,
+# so the tags cover a chunk which isn't the last one too
+GCM_LONG_HEADER=00474954435259505402000000010000000400000000000000030000000400100000000000050000000cbe34bee23ec65870b78be6e60000000b000000040000000100000000
+GCM_LONG_FIRST_TAG=69e573857d7e53fe1d9d0729d1f36c7a
+GCM_LONG_LAST_TAG=08b0e938f7386673b0ec5e1456edb362
+
+CHACHA20_LONG_HEADER=00474954435259505402000000010000000400000000000000030000000400100000000000050000000c99e3521f6f705c53fe10e7c00000000b000000040000000200000000
+CHACHA20_LONG_FIRST_TAG=dd01bf435c05a7741beaec5d24e1278b
+CHACHA20_LONG_LAST_TAG=a8b5202d7ad2f2b83d2b3e0800984ed5
+
+# long_plaintext FILE [LEN] - LEN (default CHUNK_SIZE + 1024) bytes of "abc...zabc..."
+long_plaintext () {
+	awk -v len="${2:-$((CHUNK_SIZE + 1024))}" 'BEGIN { for (i = 0; i < len; ++i) printf "%c", 97 + i % 26 }' > "$1"
+}
+
+# to_hex FILE [OFFSET [LEN]]
+to_hex () {
+	od -An -v -tx1 -j "${2:-0}" ${3:+-N "$3"} "$1" | tr -d ' \n'
+}
+
+# sha256 FILE
+sha256 () {
+	openssl dgst -sha256 -r "$1" | cut -d ' ' -f 1
+}
+
+# from_hex HEX > FILE
+from_hex () {
+	printf "$(printf '%s' "$1" | sed 's/../\\x&/g')"
+}
+
+failed=0
+check () {
+	if [ "$2" != "$3" ]; then
+		echo "FAIL: $1" >&2
+		echo "  expected $2" >&2
+		echo "  got      $3" >&2
+		failed=1
+	fi
+}
+
+mkdir "$work/repo"
+cd "$work/repo"
+git init -q
+# Use several threads even on a single CPU, so the parallel code is checked too
+git config git-crypt.threads 4
+"$GIT_CRYPT" init > /dev/null 2>&1
+from_hex "$KEY_FILE" > .git/git-crypt/keys/default
+from_hex "$KEY_FILE" > "$work/key"
+cat > .gitattributes <<ATTRIBUTES
+*.v1 filter=git-crypt
+*.gcm filter=git-crypt git-crypt-cipher=aes-gcm
+*.chacha20 filter=git-crypt git-crypt-cipher=chacha20
+ATTRIBUTES
+printf '%s' "$SHORT_PLAINTEXT" > "$work/short"
+long_plaintext "$work/long"
+for len in 0 1 15 16 17; do
+	printf '%s' "$(printf '%s' "$SHORT_PLAINTEXT" | head -c $len)" > short$len.v1
+done
+long_plaintext "$work/long.v1" $V1_LONG_LEN
+cp "$work/long.v1" long.v1
+for suite in gcm chacha20; do
+	cp "$work/short" short.$suite
+	cp "$work/long" long.$suite
+done
+git add .
+
+for len in 0 1 15 16 17; do
+	eval "expected=\$V1_$len"
+	check "v1 $len bytes" "$expected" "$(git cat-file -p :short$len.v1 | to_hex /dev/stdin)"
+	from_hex "$expected" > "$work/expected.v1"
+	check "v1 $len bytes decryption" "$(to_hex short$len.v1)" "$("$GIT_CRYPT" smudge --key-file="$work/key" < "$work/expected.v1" | to_hex /dev/stdin)"
+done
+git cat-file -p :long.v1 > "$work/long.v1.encrypted"
+check "v1 long" "$V1_LONG_SHA256" "$(sha256 "$work/long.v1.encrypted")"
+check "v1 long decryption" "$(sha256 "$work/long.v1")" "$("$GIT_CRYPT" smudge < "$work/long.v1.encrypted" | sha256 /dev/stdin)"
+
+for suite in gcm chacha20; do
+	SUITE=$(echo $suite | tr a-z A-Z)
+	eval "short_header=\$${SUITE}_SHORT_HEADER short_ciphertext=\$${SUITE}_SHORT_CIPHERTEXT short_tag=\$${SUITE}_SHORT_TAG"
+	eval "long_header=\$${SUITE}_LONG_HEADER long_first_tag=\$${SUITE}_LONG_FIRST_TAG long_last_tag=\$${SUITE}_LONG_LAST_TAG"
+
+	# Encryption
+	git cat-file -p :short.$suite > "$work/short.$suite"
+	short_len=${#SHORT_PLAINTEXT}
+	check "$suite short header" "$short_header" "$(to_hex "$work/short.$suite" 0 $HEADER_LEN)"
+	check "$suite short ciphertext" "$short_ciphertext" "$(to_hex "$work/short.$suite" $HEADER_LEN $short_len)"
+	check "$suite short tag" "$short_tag" "$(to_hex "$work/short.$suite" $((HEADER_LEN + short_len)))"
+
+	git cat-file -p :long.$suite > "$work/long.$suite"
+	long_len=$(wc -c < "$work/long")
+	check "$suite long header" "$long_header" "$(to_hex "$work/long.$suite" 0 $HEADER_LEN)"
+	check "$suite long first tag" "$long_first_tag" "$(to_hex "$work/long.$suite" $((HEADER_LEN + CHUNK_SIZE)) $TAG_LEN)"
+	check "$suite long last tag" "$long_last_tag" "$(to_hex "$work/long.$suite" $((HEADER_LEN + long_len + TAG_LEN)))"
+
+	# Decryption of the expected encryption
+	from_hex "$short_header$short_ciphertext$short_tag" > "$work/expected.$suite"
+	check "$suite short decryption" "$(to_hex "$work/short")" "$("$GIT_CRYPT" smudge --key-file="$work/key" < "$work/expected.$suite" | to_hex /dev/stdin)"
+done
+
+if [ $failed -ne 0 ]; then
+	exit 1
+fi
+echo "All known-answer tests passed"
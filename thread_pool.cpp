@@ -0,0 +1,122 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "thread_pool.hpp"
+
+Thread_pool::Thread_pool (unsigned int nbr_threads)
+: nbr_running(0), is_stopping(false)
+{
+	// Reserve first, so push_back can't throw with a started thread in hand
+	workers.reserve(nbr_threads);
+	try {
+		for (unsigned int i = 0; i < nbr_threads; ++i) {
+			workers.push_back(std::thread(&Thread_pool::run, this));
+		}
+	} catch (...) {
+		// Destroying a joinable std::thread terminates the program, so stop the workers
+		// which did start before giving up
+		stop();
+		throw;
+	}
+}
+
+Thread_pool::~Thread_pool ()
+{
+	stop();
+}
+
+void		Thread_pool::stop ()
+{
+	{
+		std::lock_guard<std::mutex>	lock(mutex);
+		jobs.clear();
+		is_stopping = true;
+	}
+	job_available.notify_all();
+	for (std::vector<std::thread>::iterator worker(workers.begin()); worker != workers.end(); ++worker) {
+		worker->join();
+	}
+}
+
+void		Thread_pool::run ()
+{
+	std::unique_lock<std::mutex>	lock(mutex);
+	while (true) {
+		while (jobs.empty() && !is_stopping) {
+			job_available.wait(lock);
+		}
+		if (is_stopping) {
+			break;
+		}
+
+		std::function<void()>	job(jobs.front());
+		jobs.pop_front();
+		++nbr_running;
+
+		lock.unlock();
+		try {
+			job();
+		} catch (...) {
+			lock.lock();
+			if (!error) {
+				error = std::current_exception();
+			}
+			lock.unlock();
+		}
+		lock.lock();
+
+		--nbr_running;
+		if (jobs.empty() && nbr_running == 0) {
+			all_done.notify_all();
+		}
+	}
+}
+
+void		Thread_pool::submit (const std::function<void()>& job)
+{
+	{
+		std::lock_guard<std::mutex>	lock(mutex);
+		jobs.push_back(job);
+	}
+	job_available.notify_one();
+}
+
+void		Thread_pool::wait ()
+{
+	std::unique_lock<std::mutex>	lock(mutex);
+	while (!jobs.empty() || nbr_running != 0) {
+		all_done.wait(lock);
+	}
+	if (error) {
+		std::exception_ptr	e(error);
+		error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
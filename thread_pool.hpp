@@ -0,0 +1,70 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of git-crypt.
+ *
+ * git-crypt is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-crypt is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-crypt.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef GIT_CRYPT_THREAD_POOL_HPP
+#define GIT_CRYPT_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed number of worker threads which run jobs in the order they're submitted
+class Thread_pool {
+	std::vector<std::thread>		workers;
+	std::deque<std::function<void()> >	jobs;
+	unsigned int				nbr_running;
+	bool					is_stopping;
+	std::exception_ptr			error;		// first exception thrown by a job
+	std::mutex				mutex;
+	std::condition_variable			job_available;
+	std::condition_variable			all_done;
+
+	void		run ();
+	void		stop ();	// discards jobs which haven't started yet, and joins the workers
+
+			Thread_pool (const Thread_pool&);	// Disallow copy
+	Thread_pool&	operator= (const Thread_pool&);	// Disallow assignment
+public:
+	explicit	Thread_pool (unsigned int nbr_threads);
+			~Thread_pool ();	// discards jobs which haven't started yet
+
+	unsigned int	size () const { return workers.size(); }
+
+	void		submit (const std::function<void()>&);
+
+	// Wait for all submitted jobs to finish, and rethrow the first exception thrown by a job, if any
+	void		wait ();
+};
+
+#endif
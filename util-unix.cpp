@@ -179,6 +179,102 @@ int util_rename (const char* from, const char* to)
 	return rename(from, to);
 }
 
+static mode_t	read_umask ()
+{
+	// The umask can only be read by setting it.  This is harmless even if another
+	// thread is in replace_file, since mkstemp always uses mode 0600.
+	const mode_t	mask = umask(0);
+	umask(mask);
+	return mask;
+}
+
+static mode_t	get_umask ()
+{
+	static const mode_t	mask = read_umask();
+	return mask;
+}
+
+// mode is applied to the new file, unless it's 0, in which case it keeps mkstemp's mode of 0600
+static void	replace_file_with_mode (const std::string& filename, const char* p, size_t len, mode_t mode)
+{
+	std::vector<char>	path_buffer(filename.begin(), filename.end());
+	const char		suffix[] = ".git-crypt.XXXXXX";
+	path_buffer.insert(path_buffer.end(), suffix, suffix + sizeof(suffix));
+	char*			path = &path_buffer[0];
+
+	int			fd = mkstemp(path);
+	if (fd == -1) {
+		throw System_error("mkstemp", filename, errno);
+	}
+	try {
+		while (len > 0) {
+			const ssize_t	bytes_written = write(fd, p, len);
+			if (bytes_written == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				throw System_error("write", path, errno);
+			}
+			p += bytes_written;
+			len -= bytes_written;
+		}
+		if (mode != 0 && fchmod(fd, mode) == -1) {
+			throw System_error("fchmod", path, errno);
+		}
+		const int	close_result = close(fd);
+		fd = -1;
+		if (close_result == -1) {
+			throw System_error("close", path, errno);
+		}
+		if (rename(path, filename.c_str()) == -1) {
+			throw System_error("rename", filename, errno);
+		}
+	} catch (...) {
+		if (fd != -1) {
+			close(fd);
+		}
+		unlink(path);
+		throw;
+	}
+}
+
+void	replace_file (const std::string& filename, const char* p, size_t len, bool executable)
+{
+	// mkstemp creates the file with mode 0600, so give it the mode Git would
+	replace_file_with_mode(filename, p, len, (executable ? 0777 : 0666) & ~get_umask());
+}
+
+void	replace_protected_file (const std::string& filename, const char* p, size_t len)
+{
+	replace_file_with_mode(filename, p, len, 0);
+}
+
+bool	can_protect_files ()
+{
+	return true;
+}
+
+bool	get_file_stamp (const std::string& path, File_stamp& stamp)
+{
+	struct stat	status;
+	if (lstat(path.c_str(), &status) == -1 || !S_ISREG(status.st_mode)) {
+		return false;
+	}
+#ifdef __APPLE__
+	const struct timespec&	mtime = status.st_mtimespec;
+	const struct timespec&	ctime = status.st_ctimespec;
+#else
+	const struct timespec&	mtime = status.st_mtim;
+	const struct timespec&	ctime = status.st_ctim;
+#endif
+	stamp.size = status.st_size;
+	stamp.mtime_ns = static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+	stamp.ctime_ns = static_cast<int64_t>(ctime.tv_sec) * 1000000000 + ctime.tv_nsec;
+	stamp.inode = status.st_ino;
+	stamp.device = status.st_dev;
+	return true;
+}
+
 std::vector<std::string> get_directory_contents (const char* path)
 {
 	std::vector<std::string>		contents;
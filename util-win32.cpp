@@ -183,6 +183,32 @@ int util_rename (const char* from, const char* to)
 	return rename(from, to);
 }
 
+void	replace_file (const std::string& filename, const char* p, size_t len, bool executable)
+{
+	// Not implemented yet: the worktree materializer is unix-only for now, and the
+	// manifest, which is only a cache, simply isn't saved
+	throw System_error("replace_file", filename, ERROR_CALL_NOT_IMPLEMENTED);
+}
+
+// The clean and plaintext caches, which are the only users of the functions below, are
+// unix-only for now (see can_protect_files()), so on Windows these just report that
+// they're unavailable.
+
+void	replace_protected_file (const std::string& filename, const char* p, size_t len)
+{
+	throw System_error("replace_protected_file", filename, ERROR_CALL_NOT_IMPLEMENTED);
+}
+
+bool	can_protect_files ()
+{
+	return false;
+}
+
+bool	get_file_stamp (const std::string& path, File_stamp& stamp)
+{
+	return false;
+}
+
 std::vector<std::string> get_directory_contents (const char* path)
 {
 	std::vector<std::string>	filenames;
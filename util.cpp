@@ -108,6 +108,45 @@ void		write_be32 (std::ostream& out, uint32_t i)
 	out.write(reinterpret_cast<const char*>(buffer), 4);
 }
 
+std::string	hex_encode (const unsigned char* p, size_t len)
+{
+	static const char	digits[] = "0123456789abcdef";
+	std::string		hex(len * 2, '0');
+	for (size_t i = 0; i < len; ++i) {
+		hex[i * 2] = digits[p[i] >> 4];
+		hex[i * 2 + 1] = digits[p[i] & 0xf];
+	}
+	return hex;
+}
+
+static int	hex_digit_value (char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+bool		hex_decode (const std::string& hex, unsigned char* p, size_t len)
+{
+	if (hex.size() != len * 2) {
+		return false;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		const int	high = hex_digit_value(hex[i * 2]);
+		const int	low = hex_digit_value(hex[i * 2 + 1]);
+		if (high == -1 || low == -1) {
+			return false;
+		}
+		p[i] = (high << 4) | low;
+	}
+	return true;
+}
+
 void*		explicit_memset (void* s, int c, std::size_t n)
 {
 	volatile unsigned char* p = reinterpret_cast<unsigned char*>(s);
@@ -49,6 +49,22 @@ struct System_error {
 	std::string message () const;
 };
 
+// What a file's stat information says about its contents: if the stamp is unchanged,
+// so are the contents (unless the file was changed within the resolution of its timestamps)
+struct File_stamp {
+	uint64_t	size;
+	int64_t		mtime_ns;
+	int64_t		ctime_ns;
+	uint64_t	inode;
+	uint64_t	device;
+
+	bool operator== (const File_stamp& other) const
+	{
+		return size == other.size && mtime_ns == other.mtime_ns && ctime_ns == other.ctime_ns && inode == other.inode && device == other.device;
+	}
+	bool operator!= (const File_stamp& other) const { return !(*this == other); }
+};
+
 class temp_fstream : public std::fstream {
 	std::string	filename;
 public:
@@ -72,11 +88,17 @@ uint32_t	load_be32 (const unsigned char*);
 void		store_be32 (unsigned char*, uint32_t);
 bool		read_be32 (std::istream& in, uint32_t&);
 void		write_be32 (std::ostream& out, uint32_t);
+std::string	hex_encode (const unsigned char*, size_t);
+bool		hex_decode (const std::string&, unsigned char*, size_t len); // false unless exactly len bytes of hex
 void*		explicit_memset (void* s, int c, size_t n);	// memset that won't be optimized away
 bool		leakless_equals (const void* a, const void* b, size_t len); // compare bytes w/o leaking timing
 void		init_std_streams ();
 void		create_protected_file (const char* path); // create empty file accessible only by current user
 int		util_rename (const char*, const char*);
+void		replace_file (const std::string&, const char* p, size_t len, bool executable); // atomically replace contents of file (unix only)
+void		replace_protected_file (const std::string&, const char* p, size_t len); // like replace_file, but accessible only by current user
+bool		can_protect_files (); // false if the protected file functions can't actually restrict access on this platform (always on Windows)
+bool		get_file_stamp (const std::string& path, File_stamp&); // false if path isn't a regular file or has no usable stamp (always on Windows)
 std::vector<std::string> get_directory_contents (const char* path);
 
 #endif